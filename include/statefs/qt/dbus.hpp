@@ -1,29 +1,37 @@
 #ifndef _STATEFS_QT_DBUS_HPP_
 #define _STATEFS_QT_DBUS_HPP_
 
+#include <statefs/qt/record.hpp>
+#include <statefs/qt/stats.hpp>
+
+#include <QDBusArgument>
 #include <QDBusPendingReply>
 #include <QDBusServiceWatcher>
 #include <QDebug>
+#include <QElapsedTimer>
+#include <QPointer>
+#include <QTimer>
 
 #include <stdexcept>
 #include <tuple>
 #include <memory>
+#include <functional>
+#include <vector>
 
 namespace statefs { namespace qt {
 
-template <typename T>
-QDBusPendingReply<T> sync(QDBusPendingReply<T> &&reply)
-{
-    QDBusPendingCallWatcher watcher(reply);
-    watcher.waitForFinished();
-    if (!watcher.isFinished())
-        throw std::logic_error("D-Bus request is not executed");
-    return reply;
-}
+/*
+ * Optional method parameter of request helpers below is the full
+ * method name (interface.method), it is used to collect call
+ * statistics (see stats.hpp) and to record replies (see record.hpp)
+ * if it is enabled.
+ */
 
 template <typename OnValue, typename T>
-bool callback_or_error(QDBusPendingReply<T> const &reply, OnValue on_value)
+bool callback_or_error(QDBusPendingReply<T> const &reply, OnValue on_value
+                       , CallTimer const &timer = CallTimer())
 {
+    timer.done(reply.isError());
     if (reply.isError()) {
         auto err = reply.error();
         qWarning() << "D-Bus request error " << err.name()
@@ -36,27 +44,282 @@ bool callback_or_error(QDBusPendingReply<T> const &reply, OnValue on_value)
 }
 
 template <typename OnValue, typename T>
-void async(QObject *parent, QDBusPendingReply<T> &&reply, OnValue on_value)
+void async(QObject *parent, QDBusPendingReply<T> &&reply, OnValue on_value
+           , char const *method = nullptr)
 {
+    CallTimer timer(method);
     auto watcher = new QDBusPendingCallWatcher(reply, parent);
     parent->connect(watcher, &QDBusPendingCallWatcher::finished
-                  , [on_value](QDBusPendingCallWatcher *w) {
+                  , [on_value, timer, method](QDBusPendingCallWatcher *w) {
                         QDBusPendingReply<T> reply = *w;
-                        callback_or_error(reply, on_value);
+                        trace::record_reply(method, reply);
+                        callback_or_error(reply, on_value, timer);
                         w->deleteLater();
                     });
 }
 
-template <typename OnValue, typename T>
-bool sync(QDBusPendingReply<T> reply, OnValue on_value)
+/**
+ * Result of the asynchronous D-Bus request. Continuations are
+ * executed in the thread of the context object and only while it is
+ * alive: if the context is destroyed the future is cancelled.
+ */
+template <typename T>
+class Future
 {
-    QDBusPendingCallWatcher watcher(reply);
-    watcher.waitForFinished();
-    if (!watcher.isFinished()) {
-        qWarning() << "D-Bus request is not executed";
-        return false;
+public:
+    typedef T value_type;
+    typedef std::function<void (T const&)> value_handler_type;
+    typedef std::function<void (QDBusError const&)> error_handler_type;
+
+    Future(QObject *context)
+        : state_(std::make_shared<State>(context))
+    {
+        if (!context)
+            throw std::logic_error("Future w/o context object");
+    }
+
+    /// fn is called when value is received, immediately if it is
+    /// already received
+    Future const& then(value_handler_type const &fn) const
+    {
+        auto &s = *state_;
+        if (s.status == Pending)
+            s.on_value.push_back(fn);
+        else if (s.status == Done && s.context)
+            call(fn, s.value);
+        return *this;
+    }
+
+    /// fn is called on the error or timeout, if there is no error
+    /// handlers the error is just logged
+    Future const& on_error(error_handler_type const &fn) const
+    {
+        auto &s = *state_;
+        if (s.status == Pending)
+            s.on_error.push_back(fn);
+        else if (s.status == Failed && s.context)
+            call(fn, s.error);
+        return *this;
+    }
+
+    /// continuations will not be called after cancellation
+    void cancel() const
+    {
+        state_->finish(Cancelled);
+    }
+
+    bool is_pending() const
+    {
+        return state_->status == Pending;
     }
-    return callback_or_error(reply, on_value);
+
+    void resolve(T const &v) const
+    {
+        auto &s = *state_;
+        if (s.status != Pending)
+            return;
+        if (!s.context) {
+            s.finish(Cancelled);
+            return;
+        }
+        s.value = v;
+        auto handlers = std::move(s.on_value);
+        s.finish(Done);
+        for (auto const &fn : handlers)
+            call(fn, s.value);
+    }
+
+    void fail(QDBusError const &err) const
+    {
+        auto &s = *state_;
+        if (s.status != Pending)
+            return;
+        if (!s.context) {
+            s.finish(Cancelled);
+            return;
+        }
+        s.error = err;
+        auto handlers = std::move(s.on_error);
+        s.finish(Failed);
+        if (handlers.empty())
+            qWarning() << "D-Bus request error " << err.name()
+                       << ": " << err.message();
+        for (auto const &fn : handlers)
+            call(fn, s.error);
+    }
+
+private:
+
+    enum Status { Pending, Done, Failed, Cancelled };
+
+    struct State
+    {
+        State(QObject *ctx) : context(ctx), status(Pending) {}
+
+        void finish(Status s)
+        {
+            status = s;
+            on_value.clear();
+            on_error.clear();
+        }
+
+        QPointer<QObject> context;
+        Status status;
+        T value;
+        QDBusError error;
+        std::vector<value_handler_type> on_value;
+        std::vector<error_handler_type> on_error;
+    };
+
+    template <typename FnT, typename ArgT>
+    static void call(FnT const &fn, ArgT const &arg)
+    {
+        try {
+            fn(arg);
+        } catch (std::exception const &e) {
+            qWarning() << "Exception " << e.what()
+                       << " in D-Bus request continuation";
+        }
+    }
+
+    std::shared_ptr<State> state_;
+};
+
+/// resolve the future with the value extracted from the reply by
+/// extract(QDBusPendingReply<T> const&), see future() below
+template <typename ResultT, typename T, typename ExtractT>
+Future<ResultT> watch_reply(QObject *context, QDBusPendingReply<T> const &reply
+                            , char const *method, int timeout_ms
+                            , ExtractT extract)
+{
+    Future<ResultT> res(context);
+    CallTimer timer(method);
+    // reply and timeout can be both queued in the same event loop
+    // pass, only the first one settles the request
+    auto is_settled = std::make_shared<bool>(false);
+    auto watcher = new QDBusPendingCallWatcher(reply, context);
+    QObject::connect(watcher, &QDBusPendingCallWatcher::finished
+                     , [res, timer, extract, method, is_settled]
+                     (QDBusPendingCallWatcher *w) {
+                         w->deleteLater();
+                         if (*is_settled)
+                             return;
+                         *is_settled = true;
+                         QDBusPendingReply<T> reply = *w;
+                         timer.done(reply.isError());
+                         trace::record_reply(method, reply);
+                         if (reply.isError())
+                             res.fail(reply.error());
+                         else
+                             res.resolve(extract(reply));
+                     });
+    if (timeout_ms >= 0) {
+        auto expire = new QTimer(watcher);
+        expire->setSingleShot(true);
+        QObject::connect(expire, &QTimer::timeout
+                         , [res, watcher, timer, is_settled]() {
+                             watcher->deleteLater();
+                             if (*is_settled)
+                                 return;
+                             *is_settled = true;
+                             timer.done(true);
+                             res.fail(QDBusError
+                                      (QDBusError::Timeout
+                                       , "D-Bus request is timed out"));
+                         });
+        expire->start(timeout_ms);
+    }
+    return res;
+}
+
+/**
+ * Wrap pending D-Bus reply into the future. Request is cancelled if
+ * the context object is destroyed before the reply is received, if
+ * timeout_ms is not negative request is failed with
+ * QDBusError::Timeout after this interval.
+ */
+template <typename T>
+Future<T> future(QObject *context, QDBusPendingReply<T> const &reply
+                 , char const *method, int timeout_ms = -1)
+{
+    return watch_reply<T>(context, reply, method, timeout_ms
+                          , [](QDBusPendingReply<T> const &r) {
+                              return r.value();
+                          });
+}
+
+template <typename T>
+Future<T> future(QObject *context, QDBusPendingReply<T> const &reply
+                 , int timeout_ms = -1)
+{
+    return future(context, reply, nullptr, timeout_ms);
+}
+
+/**
+ * The same as future() but the first reply argument is not
+ * demarshalled into T, it is passed as is to be read by the
+ * streaming reader (e.g. find_object() from objects.hpp).
+ */
+template <typename T>
+Future<QDBusArgument> argument_future
+(QObject *context, QDBusPendingReply<T> const &reply
+ , char const *method, int timeout_ms = -1)
+{
+    return watch_reply<QDBusArgument>
+        (context, reply, method, timeout_ms
+         , [](QDBusPendingReply<T> const &r) {
+            return qvariant_cast<QDBusArgument>
+                (r.reply().arguments().value(0));
+        });
+}
+
+template <typename ResultT>
+struct WhenAllData
+{
+    WhenAllData(size_t count) : values(), pending(count) {}
+    ResultT values;
+    size_t pending;
+};
+
+template <size_t Pos, typename ResultT>
+struct WhenAll
+{
+    typedef std::shared_ptr<WhenAllData<ResultT> > data_ptr;
+
+    template <typename T, typename ... Tail>
+    static void attach(Future<ResultT> const &res, data_ptr const &data
+                       , Future<T> const &head, Future<Tail> const& ... tail)
+    {
+        head.then([res, data](T const &v) {
+                std::get<Pos>(data->values) = v;
+                if (!--data->pending)
+                    res.resolve(data->values);
+            }).on_error([res](QDBusError const &err) {
+                    res.fail(err);
+                });
+        WhenAll<Pos + 1, ResultT>::attach(res, data, tail...);
+    }
+
+    static void attach(Future<ResultT> const &, data_ptr const &)
+    {
+        // do nothing, after the last future
+    }
+};
+
+/**
+ * Combine futures to get all values at once, requests are executed
+ * in parallel. Result fails on the first failed request.
+ */
+template <typename ... Args>
+Future<std::tuple<Args...> > when_all
+(QObject *context, Future<Args> const& ... futures)
+{
+    static_assert(sizeof...(Args) > 0, "Nothing to wait for");
+    typedef std::tuple<Args...> result_type;
+    Future<result_type> res(context);
+    auto data = std::make_shared<WhenAllData<result_type> >(sizeof...(Args));
+    WhenAll<0, result_type>::attach(res, data, futures...);
+    return res;
 }
 
 template <size_t Pos, typename T>
@@ -90,13 +353,52 @@ struct TupleDBus<0, T>
 };
 
 
+/**
+ * Watches service (un)registration. By default the service is
+ * reported as unregistered immediately.
+ *
+ * If grace period is set, last known values are held during outage:
+ * unregistration is reported only if the service does not come back
+ * during the grace period. If it does, the bridge is reset and
+ * re-initialized inside of the resync (e.g. update transaction)
+ * lasting settle_ms, so only real changes are published.
+ *
+ * Service restarting quickly (up for less than stable_ms) is
+ * re-initialized with exponentially growing delay, starting from
+ * backoff_ms up to max_backoff_ms, to avoid re-initializing the
+ * bridge constantly during crash loops.
+ */
 class ServiceWatch : public QObject
 {
     Q_OBJECT;
 public:
-    ServiceWatch(QDBusConnection &bus, QString const &service)
-        : bus_(bus), service_(service)
-    {}
+    typedef std::function<void()> handler_type;
+
+    struct Policy
+    {
+        Policy(int grace = 0, int settle = 0
+               , int backoff = 0, int max_backoff = 0, int stable = 0)
+            : grace_ms(grace), settle_ms(settle)
+            , backoff_ms(backoff), max_backoff_ms(max_backoff)
+            , stable_ms(stable)
+        {}
+
+        int grace_ms;
+        int settle_ms;
+        int backoff_ms;
+        int max_backoff_ms;
+        int stable_ms;
+    };
+
+    /// policy used by bridges to survive service restarts: hold
+    /// values for 5s, settle for 1s, back off from 1s up to 1 minute
+    /// if service is up less than 10s
+    static Policy hold_values_policy()
+    {
+        return Policy(5000, 1000, 1000, 60000, 10000);
+    }
+
+    ServiceWatch(QDBusConnection &bus, QString const &service);
 
     virtual ~ServiceWatch() {}
 
@@ -106,34 +408,45 @@ public:
         if (watcher_)
             return;
 
+        on_register_ = onRegister;
+        on_unregister_ = onUnregister;
         watcher_.reset(new QDBusServiceWatcher(service_, bus_));
         // , QDBusServiceWatcher::WatchForRegistration));
 
-        auto cb = [onRegister, onUnregister]
-            (const QString & serviceName
-             , const QString & oldOwner
-             , const QString & newOwner) {
-            try {
-                if (newOwner == "") {
-                    qDebug() << serviceName << " is unregistered";
-                    onUnregister();
-                } else {
-                    qDebug() << serviceName << " is registered";
-                    onRegister();
-                }
-            } catch(std::exception const &e) {
-                qWarning() << "Exception " << e.what() << " handling "
-                << serviceName << " un/registration";
-            }
-        };
         connect(watcher_.get(), &QDBusServiceWatcher::serviceOwnerChanged
-                , cb);
+                , this, &ServiceWatch::owner_changed);
     }
 
+    /// resync handlers are called around reset and re-initialization
+    /// of the bridge after short outage
+    void set_policy(Policy const &, handler_type const &begin_resync
+                    , handler_type const &end_resync);
+
 private:
+    void owner_changed(QString const &, QString const &, QString const &);
+    void registered();
+    void unregistered();
+    void grace_expired();
+    void end_resync();
+    void call(handler_type const &, char const *);
+
     QDBusConnection &bus_;
     QString service_;
     std::unique_ptr<QDBusServiceWatcher> watcher_;
+    handler_type on_register_;
+    handler_type on_unregister_;
+    handler_type begin_resync_;
+    handler_type end_resync_;
+    Policy policy_;
+
+    // service is gone but values are still held
+    bool is_lost_;
+    bool is_resyncing_;
+    unsigned restarts_;
+    QElapsedTimer uptime_;
+    QTimer grace_timer_;
+    QTimer register_timer_;
+    QTimer settle_timer_;
 };
 
 }}
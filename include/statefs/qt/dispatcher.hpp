@@ -0,0 +1,183 @@
+#ifndef _STATEFS_QT_DISPATCHER_HPP_
+#define _STATEFS_QT_DISPATCHER_HPP_
+
+#include <statefs/qt/indices.hpp>
+
+#include <QDBusArgument>
+#include <QDBusConnection>
+#include <QDBusMessage>
+#include <QDebug>
+#include <QHash>
+#include <QObject>
+#include <QSet>
+#include <QString>
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace statefs { namespace qt {
+
+class SignalDispatcher;
+
+/// signal handler registration, handler is removed when
+/// subscription is destroyed or reset
+class Subscription
+{
+public:
+    Subscription() : id_(0) {}
+    Subscription(std::shared_ptr<SignalDispatcher> const &
+                 , QString const &path, unsigned id);
+    Subscription(Subscription &&);
+    Subscription & operator =(Subscription &&);
+    ~Subscription() { reset(); }
+
+    void reset();
+    bool is_active() const { return id_ != 0; }
+
+private:
+    Subscription(Subscription const&) = delete;
+    Subscription & operator =(Subscription const&) = delete;
+
+    std::shared_ptr<SignalDispatcher> dispatcher_;
+    QString path_;
+    unsigned id_;
+};
+
+/// unpacks signal arguments and passes them to the handler
+template <typename ... Args>
+struct SignalArgs
+{
+    template <typename FnT>
+    static void call(FnT const &fn, QDBusMessage const &msg)
+    {
+        auto args = msg.arguments();
+        if (args.size() < static_cast<int>(sizeof...(Args))) {
+            qWarning() << "Signal" << msg.interface() << msg.member()
+                       << "has" << args.size() << "args, expected"
+                       << sizeof...(Args);
+            return;
+        }
+        call(fn, args, typename MakeIndices<sizeof...(Args)>::type());
+    }
+
+private:
+    template <typename FnT, size_t ... I>
+    static void call(FnT const &fn, QVariantList const &args, Indices<I...>)
+    {
+        fn(qdbus_cast<Args>(args[I])...);
+    }
+};
+
+/**
+ * Process-wide dispatcher of signals emitted by the single service.
+ *
+ * Generated proxies install match rule per proxy object and signal,
+ * so bus daemon sends the same signal to the process several
+ * times. Dispatcher installs single match rule for each service
+ * interface handlers are registered for and demultiplexes signals
+ * by the object path and member. Qt does not allow to subscribe to
+ * all signals of the service, so rule can't be narrowed down just
+ * to the sender.
+ *
+ * Dispatcher is shared by all providers using the same connection
+ * and it should be used from the thread of the connection.
+ */
+class SignalDispatcher
+    : public QObject
+    , public std::enable_shared_from_this<SignalDispatcher>
+{
+    Q_OBJECT;
+public:
+    typedef std::function<void (QDBusMessage const&)> handler_type;
+    typedef std::function<void (QString const&, QVariant const&)>
+    property_changed_type;
+
+    SignalDispatcher(QDBusConnection const &bus, QString const &service);
+    virtual ~SignalDispatcher();
+
+    /// get dispatcher for the service, dispatcher is destroyed when
+    /// all subscriptions and references are released
+    static std::shared_ptr<SignalDispatcher> get
+    (QDBusConnection const &bus, QString const &service);
+
+    /// subscribe to raw signal messages, empty path or member
+    /// matches any path/member
+    Subscription subscribe_raw(QString const &path, QString const &interface
+                               , QString const &member, handler_type const &);
+
+    /// subscribe to the signal with Args arguments
+    template <typename ... Args, typename FnT>
+    Subscription subscribe(QString const &path, QString const &interface
+                           , QString const &member, FnT fn)
+    {
+        return subscribe_raw(path, interface, member
+                             , [fn](QDBusMessage const &msg) {
+                                 SignalArgs<Args...>::call(fn, msg);
+                             });
+    }
+
+    /// subscription lasts until context object is destroyed, it is
+    /// the same as connecting to the generated proxy signal
+    template <typename ... Args, typename FnT>
+    void subscribe(QObject *context, QString const &path
+                   , QString const &interface, QString const &member, FnT fn)
+    {
+        bind(context, subscribe<Args...>(path, interface, member, fn));
+    }
+
+    /**
+     * Fast path for the PropertyChanged(sv) signal: property name
+     * and value are passed to the handler by reference to the
+     * message arguments, w/o qdbus_cast copies of the name and of
+     * the QDBusVariant wrapper.
+     */
+    Subscription subscribe_property_changed
+    (QString const &path, QString const &interface
+     , property_changed_type const &);
+
+    void subscribe_property_changed
+    (QObject *context, QString const &path, QString const &interface
+     , property_changed_type const &fn)
+    {
+        bind(context, subscribe_property_changed(path, interface, fn));
+    }
+
+private slots:
+    void handle(QDBusMessage const &);
+
+private:
+    friend class Subscription;
+
+    struct Handler
+    {
+        unsigned id;
+        QString interface;
+        QString member;
+        handler_type fn;
+    };
+    typedef std::vector<Handler> handlers_type;
+
+    void bind(QObject *, Subscription &&);
+    void unsubscribe(QString const &path, unsigned id);
+    void dispatch(QString const &path, QDBusMessage const &);
+    void collect_garbage();
+
+    QDBusConnection bus_;
+    QString service_;
+    // interfaces match rules are installed for
+    QSet<QString> interfaces_;
+    // object path -> handlers, empty path is for any path
+    QHash<QString, handlers_type> handlers_;
+    unsigned last_id_;
+    // handlers can be added or removed while signal is dispatched,
+    // so new handlers are kept separately and removed ones are only
+    // marked (id is 0) until dispatching is finished
+    std::vector<std::pair<QString, Handler> > added_;
+    unsigned dispatch_depth_;
+    bool has_garbage_;
+};
+
+}}
+
+#endif // _STATEFS_QT_DISPATCHER_HPP_
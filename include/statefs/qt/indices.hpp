@@ -0,0 +1,23 @@
+#ifndef _STATEFS_QT_INDICES_HPP_
+#define _STATEFS_QT_INDICES_HPP_
+
+#include <cstddef>
+
+namespace statefs { namespace qt {
+
+/// compile-time sequence 0..N-1 to expand parameter packs, C++11
+/// has no std::index_sequence
+template <size_t ... I> struct Indices {};
+
+template <size_t N, size_t ... I>
+struct MakeIndices : MakeIndices<N - 1, N - 1, I...> {};
+
+template <size_t ... I>
+struct MakeIndices<0, I...>
+{
+    typedef Indices<I...> type;
+};
+
+}}
+
+#endif // _STATEFS_QT_INDICES_HPP_
@@ -2,18 +2,57 @@
 #define _STATEFS_QT_NS_HPP_
 
 #include <statefs/qt/util.hpp>
+#include <statefs/qt/readiness.hpp>
+#include <statefs/qt/schema.hpp>
 #include <statefs/property.hpp>
 
+#include <initializer_list>
 #include <map>
+#include <memory>
+#include <type_traits>
+#include <vector>
+#include <QHash>
 #include <QString>
 #include <QVariant>
 
+class QTimer;
+
 namespace statefs { namespace qt {
 
 class Namespace;
+class ReadersMonitor;
 
 typedef std::vector<std::pair<char const*, char const*> > DefaultProperties;
 
+/**
+ * Precomputed table of source (D-Bus) properties passed straight
+ * through to namespace properties, it is used when the same source
+ * name means different properties for different interfaces
+ * (e.g. MobileCountryCode of ofono NetworkRegistration and
+ * SimManager).
+ */
+class PropertyRoutes
+{
+public:
+    struct Route
+    {
+        template <typename EnumT>
+        Route(char const *src_name, EnumT id)
+            : name(src_name), index(static_cast<size_t>(id))
+        {}
+        char const *name;
+        size_t index;
+    };
+
+    PropertyRoutes(std::initializer_list<Route>);
+
+    /// @return namespace property index or Namespace::npos
+    size_t find(QString const &) const;
+
+private:
+    QHash<QString, size_t> index_;
+};
+
 class PropertiesSource
 {
 public:
@@ -23,6 +62,55 @@ public:
     void setProperties(QVariantMap const &);
     void setProperties(std::map<QString, QVariant> const &);
     void updateProperty(const QString &, const QVariant &);
+    void updateProperty(size_t, const QVariant &);
+
+    /// update namespace property routed from the source property
+    /// name, @return false if there is no route for the name
+    bool updateProperty(PropertyRoutes const &
+                        , const QString &, const QVariant &);
+
+    /// update property described by the namespace schema
+    template <typename EnumT>
+    typename std::enable_if<std::is_enum<EnumT>::value>::type
+    updateProperty(EnumT id, const QVariant &value)
+    {
+        updateProperty(static_cast<size_t>(id), value);
+    }
+
+    /// set schema property to its default value, e.g. when the
+    /// source detaches from the upstream and the value is not
+    /// tracked any more
+    void resetProperty(size_t);
+
+    template <typename EnumT>
+    typename std::enable_if<std::is_enum<EnumT>::value>::type
+    resetProperty(EnumT id)
+    {
+        resetProperty(static_cast<size_t>(id));
+    }
+
+    void beginUpdate();
+    void commitUpdate();
+
+    /**
+     * Called in the namespace thread when the first reader opens
+     * the property or the last one closes it. Source can attach to
+     * the upstream (e.g. D-Bus signals of objects used only to
+     * calculate this property) on demand and detach when nobody is
+     * interested, values should be re-read on attach.
+     */
+    virtual void readersChanged(size_t, bool) {}
+
+    /// true if the property is opened by somebody
+    bool hasReaders(size_t) const;
+
+    template <typename EnumT>
+    typename std::enable_if<std::is_enum<EnumT>::value, bool>::type
+    hasReaders(EnumT id) const
+    {
+        return hasReaders(static_cast<size_t>(id));
+    }
+
 protected:
     Namespace *target_;
 };
@@ -33,14 +121,71 @@ public:
 
     Namespace(char const *, std::unique_ptr<PropertiesSource> &&);
 
-    virtual ~Namespace() {}
+    virtual ~Namespace();
     virtual void release() { }
 
+    static const size_t npos = static_cast<size_t>(-1);
+
+    /// number of property updates received and how many of them
+    /// were dropped because the value was not changed
+    struct Counters
+    {
+        Counters() : updates(0), suppressed(0) {}
+        size_t updates;
+        size_t suppressed;
+    };
+
+    Counters const& counters() const { return counters_; }
+
+    /// stage all following updates until the matching commitUpdate()
+    /// (calls can be nested), each changed property is published
+    /// once on the outermost commit with its last staged value
+    void beginUpdate();
+    void commitUpdate();
+
+    /// property has connected readers, it is tracked in the
+    /// namespace thread
+    bool hasReaders(size_t) const;
+
+    /// initialize the source now or, if lazy initialization is
+    /// enabled, from the event loop after the provider is loaded or
+    /// when the first property is opened; state is set to ready
+    /// after that
+    void initSource(readiness_ptr const &);
+
+    /// namespace w/o own source is updated by the owner namespace
+    /// source, so readers of its properties start the owner source
+    void followSource(std::weak_ptr<Namespace> const &owner);
+
 protected:
-    void addProperty(char const *, char const *);
-    void addProperty(char const *, char const *, char const *);
+    size_t addProperty(char const *, char const *);
+    size_t addProperty(char const *, char const *, char const *);
+
+    /// add all properties from the schema, it should be done before
+    /// adding any other property, so index of the property is the
+    /// same as its EnumT value
+    template <size_t N>
+    void addProperties(PropertyInfo const (&info)[N])
+    {
+        addProperties(info, N);
+    }
+
+    /// set all schema properties to their default values
+    void setDefaults();
+    void resetProperty(size_t);
+
     void setProperties(DefaultProperties const &);
     void updateProperty(const QString &, const QVariant &);
+    void updateProperty(size_t, const QVariant &);
+
+    template <typename EnumT>
+    typename std::enable_if<std::is_enum<EnumT>::value>::type
+    updateProperty(EnumT id, const QVariant &value)
+    {
+        updateProperty(static_cast<size_t>(id), value);
+    }
+
+    size_t propertyIndex(QString const &) const;
 
     std::unique_ptr<PropertiesSource> src_;
 
@@ -48,12 +193,84 @@ private:
 
     void setProperties(QVariantMap const &);
     void setProperties(std::map<QString, QVariant> const &);
+    void addProperties(PropertyInfo const *, size_t);
 
     friend class PropertiesSource;
+    friend class ReadersMonitor;
 
-    std::map<QString, setter_type> setters_for_props_;
+    void readersChanged(size_t, bool);
+    void startSource();
+
+    struct Property
+    {
+        QString name;
+        setter_type set;
+        // last value passed to the setter, the setter is not called
+        // if the new value is the same to avoid waking up readers
+        std::string last;
+        // value staged inside of the transaction
+        std::string pending;
+        bool is_staged;
+        // number of connected statefs slots
+        unsigned readers;
+    };
+
+    // values are passed through buffer_ and swapped with property
+    // strings, so in a steady state there are no allocations
+    bool publish(size_t, std::string &);
+    bool apply(Property &, std::string &);
+
+    // properties are stored in the order of addition, both indices
+    // are resolved once on addProperty, so updates are proportional
+    // to the number of incoming values, not to the namespace size
+    std::vector<Property> props_;
+    // source (e.g. D-Bus) property name -> index in props_
+    QHash<QString, size_t> src_index_;
+    // statefs property name -> index in props_, used for defaults
+    QHash<QString, size_t> name_index_;
+    // schema describing first schema_size_ properties
+    PropertyInfo const *schema_;
+    size_t schema_size_;
+    Counters counters_;
+    std::string buffer_;
+    unsigned transaction_depth_;
+    // indices of properties staged in the current transaction, in
+    // order of the first update
+    std::vector<size_t> staged_;
+    // receives reader connections reported from the statefs thread
+    std::shared_ptr<ReadersMonitor> readers_;
+    // pending lazy initialization
+    std::unique_ptr<QTimer> init_timer_;
+    readiness_ptr readiness_;
+    bool is_started_;
+    std::weak_ptr<Namespace> source_owner_;
+};
+
+/// RAII wrapper for beginUpdate()/commitUpdate() pair, can be used
+/// both with Namespace and PropertiesSource
+template <typename T>
+class Transaction
+{
+public:
+    Transaction(T *target) : target_(target) { target_->beginUpdate(); }
+    ~Transaction() { target_->commitUpdate(); }
+private:
+    Transaction(Transaction const&);
+    Transaction & operator =(Transaction const&);
+
+    T *target_;
 };
 
+/**
+ * Insert provider diagnostic namespaces: ProviderState.<provider>
+ * with the readiness of the ns source (it is initialized here) and,
+ * if statistics is enabled, ProviderStats.<provider> for methods of
+ * the service.
+ */
+void insert_diagnostics(statefs::AProvider &, Namespace &ns
+                        , char const *provider_name
+                        , char const *service_name);
+
 }}
 
 #endif // _STATEFS_QT_NS_HPP_
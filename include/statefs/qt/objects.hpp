@@ -0,0 +1,36 @@
+#ifndef _STATEFS_QT_OBJECTS_HPP_
+#define _STATEFS_QT_OBJECTS_HPP_
+
+#include <QDBusArgument>
+#include <QString>
+#include <QStringList>
+#include <QVariant>
+
+#include <functional>
+
+namespace statefs { namespace qt {
+
+/// return true to stop reading
+typedef std::function<bool (QString const&, QVariantMap const&)>
+object_handler_type;
+
+/**
+ * Streaming reader of the object list with properties, D-Bus type
+ * a(oa{sv}) (e.g. GetServices, GetModems). Objects are passed to fn
+ * one by one as they are read from the reply, so reading can be
+ * stopped on the first interesting object. Only properties with
+ * names from keys are put into the map (all if keys is empty). Other
+ * values are still demarshalled (it is needed to advance to the next
+ * entry) but they are not inserted into the map, and there are no
+ * copies of object paths and property maps for the whole list.
+ *
+ * Argument is consumed by reading.
+ *
+ * @return true if reading was stopped by fn
+ */
+bool find_object(QDBusArgument const &, QStringList const &keys
+                 , object_handler_type const &fn);
+
+}}
+
+#endif // _STATEFS_QT_OBJECTS_HPP_
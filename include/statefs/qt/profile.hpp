@@ -0,0 +1,266 @@
+#ifndef _STATEFS_QT_PROFILE_HPP_
+#define _STATEFS_QT_PROFILE_HPP_
+
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+// header-only and Qt-independent, so it is used also by udev, bme
+// etc. providers, it does not link statefs-providers-qt5
+
+namespace statefs { namespace qt {
+
+/// initialization phases are timed if STATEFS_PROVIDER_PROFILE
+/// environment variable is set to non-zero value
+inline bool is_profile_enabled()
+{
+    static const bool is_enabled = []() {
+        auto v = ::getenv("STATEFS_PROVIDER_PROFILE");
+        return v && ::atoi(v) != 0;
+    }();
+    return is_enabled;
+}
+
+/// directory to write <provider>.json Chrome trace-event files to,
+/// it is set by STATEFS_PROVIDER_TRACE, nullptr if not set
+inline char const *profile_trace_dir()
+{
+    static char const *dir = []() -> char const* {
+        auto v = ::getenv("STATEFS_PROVIDER_TRACE");
+        return (v && *v) ? v : nullptr;
+    }();
+    return dir;
+}
+
+namespace profile {
+
+inline uint64_t monotonic_ns()
+{
+    timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+inline long thread_id()
+{
+    return ::syscall(SYS_gettid);
+}
+
+/// nesting level of phases in the current thread
+inline unsigned & depth()
+{
+    static __thread unsigned v = 0;
+    return v;
+}
+
+/// phase name should have static storage duration, provider name
+/// is copied because it can be owned by the provider
+struct Record
+{
+    std::string provider;
+    char const *name;
+    uint64_t start_ns;
+    uint64_t duration_ns;
+    long tid;
+    unsigned depth;
+};
+
+/**
+ * Process-wide list of finished phases. Phases are recorded only
+ * during initialization, so it is a simple locked list with the
+ * limited capacity.
+ */
+class Registry
+{
+public:
+    enum { capacity = 1024 };
+
+    Registry() : dropped_(0) {}
+
+    void add(Record const &r)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (records_.size() < capacity)
+            records_.push_back(r);
+        else
+            ++dropped_;
+    }
+
+    /// provider phases ordered by the start time
+    std::vector<Record> records(char const *provider) const
+    {
+        std::vector<Record> res;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (auto const &r : records_)
+                if (r.provider == provider)
+                    res.push_back(r);
+        }
+        std::stable_sort(res.begin(), res.end()
+                         , [](Record const &a, Record const &b) {
+                             return a.start_ns < b.start_ns;
+                         });
+        return res;
+    }
+
+    /// table with a line per phase, times are in microseconds,
+    /// start is the CLOCK_MONOTONIC time
+    std::string dump(char const *provider) const
+    {
+        std::string res;
+        for (auto const &r : records(provider)) {
+            res.append(r.depth * 2, ' ').append(r.name)
+                .append(" start=").append(std::to_string(r.start_ns / 1000))
+                .append(" duration=")
+                .append(std::to_string(r.duration_ns / 1000))
+                .append(" tid=").append(std::to_string(r.tid))
+                .append("\n");
+        }
+        return res;
+    }
+
+    /// Chrome trace-event JSON (complete events), it can be loaded
+    /// into chrome://tracing or Perfetto UI
+    std::string trace(char const *provider) const
+    {
+        std::string res("{\"traceEvents\":[");
+        auto pid = std::to_string(static_cast<long>(::getpid()));
+        bool is_first = true;
+        for (auto const &r : records(provider)) {
+            res.append(is_first ? "\n{\"name\":\"" : ",\n{\"name\":\"");
+            append_json(res, r.name);
+            res.append("\",\"cat\":\"");
+            append_json(res, provider);
+            res.append("\",\"ph\":\"X\",\"ts\":");
+            append_us(res, r.start_ns);
+            res.append(",\"dur\":");
+            append_us(res, r.duration_ns);
+            res.append(",\"pid\":").append(pid)
+                .append(",\"tid\":").append(std::to_string(r.tid))
+                .append("}");
+            is_first = false;
+        }
+        res += "\n],\"displayTimeUnit\":\"ms\"}\n";
+        return res;
+    }
+
+    /// (re)write trace file if trace directory is set, file is
+    /// replaced atomically
+    bool write_trace(char const *provider) const
+    {
+        auto dir = profile_trace_dir();
+        if (!dir)
+            return false;
+
+        std::string path(dir);
+        path.append("/").append(provider).append(".json");
+        auto tmp_path = path + ".tmp";
+        auto data = trace(provider);
+        auto f = ::fopen(tmp_path.c_str(), "w");
+        if (!f)
+            return false;
+        auto is_written = (::fwrite(data.data(), 1, data.size(), f)
+                           == data.size());
+        is_written = (::fclose(f) == 0) && is_written;
+        if (!is_written || ::rename(tmp_path.c_str(), path.c_str())) {
+            ::unlink(tmp_path.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    size_t dropped() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return dropped_;
+    }
+
+private:
+    // names are identifiers and literals, only characters breaking
+    // the JSON string are replaced
+    static void append_json(std::string &dst, char const *s)
+    {
+        auto pos = dst.size();
+        dst.append(s);
+        std::replace_if(dst.begin() + pos, dst.end(), [](char c) {
+                return c == '"' || c == '\\' || (unsigned char)c < 0x20;
+            }, '_');
+    }
+
+    /// nanoseconds as microseconds with 3 fractional digits
+    static void append_us(std::string &dst, uint64_t ns)
+    {
+        char frac[] = ".000";
+        auto rem = static_cast<unsigned>(ns % 1000);
+        for (auto p = frac + 3; rem; rem /= 10)
+            *p-- = '0' + rem % 10;
+        dst.append(std::to_string(ns / 1000)).append(frac, 4);
+    }
+
+    mutable std::mutex mutex_;
+    std::vector<Record> records_;
+    size_t dropped_;
+};
+
+inline Registry & registry()
+{
+    static Registry r;
+    return r;
+}
+
+}
+
+/**
+ * Scoped timing of the provider initialization phase, it is
+ * recorded on the scope exit. Phases can be nested, trace file is
+ * rewritten when the outermost phase of the thread is finished.
+ *
+ *     ProfilePhase phase("ofono", "registerDataTypes");
+ */
+class ProfilePhase
+{
+public:
+    ProfilePhase(char const *provider, char const *name)
+        : provider_(provider)
+        , name_(name)
+        , start_(is_profile_enabled() ? profile::monotonic_ns() : 0)
+    {
+        if (start_)
+            ++profile::depth();
+    }
+
+    ~ProfilePhase()
+    {
+        if (!start_)
+            return;
+
+        auto depth = --profile::depth();
+        auto &reg = profile::registry();
+        reg.add(profile::Record{std::string(provider_), name_, start_
+                    , profile::monotonic_ns() - start_
+                    , profile::thread_id(), depth});
+        if (!depth)
+            reg.write_trace(provider_);
+    }
+
+private:
+    ProfilePhase(ProfilePhase const&);
+    ProfilePhase & operator =(ProfilePhase const&);
+
+    char const *provider_;
+    char const *name_;
+    uint64_t start_;
+};
+
+}}
+
+#endif // _STATEFS_QT_PROFILE_HPP_
@@ -0,0 +1,75 @@
+#ifndef _STATEFS_QT_PROPERTIES_HPP_
+#define _STATEFS_QT_PROPERTIES_HPP_
+
+#include <QByteArray>
+#include <statefs/qt/dispatcher.hpp>
+
+#include <QDBusConnection>
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QVariant>
+
+#include <functional>
+
+namespace statefs { namespace qt {
+
+/**
+ * Local copy of D-Bus object properties of the single interface
+ * maintained using org.freedesktop.DBus.Properties. Properties are
+ * fetched with GetAll once and then kept up to date by the
+ * PropertiesChanged signal, so there is no need in round trips to
+ * the service for each change. Handler receives names of properties
+ * those values were really changed.
+ *
+ * For services not emitting PropertiesChanged refresh() can be
+ * called on the service-specific change notification, only
+ * changed properties are reported in this case too.
+ */
+class PropertiesMirror : public QObject
+{
+    Q_OBJECT;
+public:
+    typedef std::function<void (QStringList const&)> handler_type;
+
+    PropertiesMirror(QDBusConnection const &bus
+                     , QString const &service
+                     , QString const &path
+                     , QString const &interface
+                     , QObject *parent = nullptr);
+
+    virtual ~PropertiesMirror();
+
+    /// subscribe to changes and request all properties
+    void init(handler_type const &);
+
+    /// re-read all properties, reporting only changed ones
+    void refresh();
+
+    bool is_ready() const { return is_ready_; }
+    QVariantMap const & values() const { return values_; }
+    QVariant value(QString const &name) const { return values_.value(name); }
+    QString const & path() const { return path_; }
+
+private:
+    void properties_changed(QString const &
+                            , QVariantMap const &
+                            , QStringList const &);
+    void merge(QVariantMap const &);
+
+    QDBusConnection bus_;
+    QString service_;
+    QString path_;
+    QString interface_;
+    // GetAll calls are accounted per mirrored interface
+    QByteArray stats_name_;
+    handler_type on_changed_;
+    QVariantMap values_;
+    bool is_ready_;
+    Subscription signal_;
+    unsigned generation_;
+};
+
+}}
+
+#endif // _STATEFS_QT_PROPERTIES_HPP_
@@ -0,0 +1,109 @@
+#ifndef _STATEFS_QT_READINESS_HPP_
+#define _STATEFS_QT_READINESS_HPP_
+
+#include <statefs/property.hpp>
+#include <statefs/qt/profile.hpp>
+
+#include <memory>
+#include <string>
+#include <stdlib.h>
+
+// readiness is set from plain threads too: udev provider marks it
+// ready from its monitor thread after the device enumeration
+
+namespace statefs { namespace qt {
+
+/**
+ * Provider initialization (connection to the service, device
+ * enumeration etc.) is deferred until the provider is loaded if
+ * STATEFS_PROVIDER_LAZY environment variable is set to non-zero
+ * value, so it does not slow down statefs server startup. Namespaces
+ * and default values are registered immediately.
+ *
+ * Value is the delay in milliseconds, Qt providers start
+ * initialization earlier if any property is opened.
+ */
+inline int lazy_init_delay()
+{
+    static const int delay = []() {
+        auto v = ::getenv("STATEFS_PROVIDER_LAZY");
+        return v ? ::atoi(v) : 0;
+    }();
+    return delay;
+}
+
+inline bool is_lazy_init_enabled()
+{
+    return lazy_init_delay() > 0;
+}
+
+/// provider initialization phases table, calculated on read
+class ProfileSource : public statefs::PropertySource
+{
+public:
+    ProfileSource(std::string const &provider) : provider_(provider) {}
+
+    virtual statefs_ssize_t size() const
+    {
+        return read().size();
+    }
+
+    virtual std::string read() const
+    {
+        return profile::registry().dump(provider_.c_str());
+    }
+
+private:
+    std::string provider_;
+};
+
+/**
+ * Namespace ProviderState.<provider> with the "Ready" property: it
+ * is 0 while provider initialization is pending and 1 after it, so
+ * consumers can wait for it instead of reading default values. It is
+ * always 1 if lazy initialization is disabled.
+ *
+ * If profiling is enabled (see profile.hpp) "Phases" property lists
+ * timed initialization phases of the provider.
+ */
+class ReadinessNamespace : public statefs::Namespace
+{
+public:
+    ReadinessNamespace(std::string const &provider)
+        : statefs::Namespace(("ProviderState." + provider).c_str())
+        , provider_(provider)
+    {
+        auto d = statefs::Discrete
+            ("Ready", is_lazy_init_enabled() ? "0" : "1");
+        auto prop = statefs::create(d);
+        *this << prop;
+        set_ready_ = setter(prop);
+        if (is_profile_enabled()) {
+            std::unique_ptr<statefs::PropertySource> src
+                (new ProfileSource(provider));
+            *this << statefs::create
+                (statefs::Analog{"Phases", ""}, std::move(src));
+        }
+    }
+
+    virtual ~ReadinessNamespace() {}
+    virtual void release() { }
+
+    std::string const & provider() const { return provider_; }
+
+    /// can be called from any thread
+    void set_ready()
+    {
+        set_ready_("1");
+    }
+
+private:
+    std::string provider_;
+    statefs::setter_type set_ready_;
+};
+
+typedef std::shared_ptr<ReadinessNamespace> readiness_ptr;
+
+}}
+
+#endif // _STATEFS_QT_READINESS_HPP_
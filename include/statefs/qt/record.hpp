@@ -0,0 +1,61 @@
+#ifndef _STATEFS_QT_RECORD_HPP_
+#define _STATEFS_QT_RECORD_HPP_
+
+#include <statefs/qt/trace.hpp>
+
+#include <QDBusMessage>
+#include <QDBusPendingCall>
+#include <QString>
+#include <QVariant>
+
+#include <functional>
+
+namespace statefs { namespace qt { namespace trace {
+
+/**
+ * D-Bus inputs of all Qt providers loaded into the process are
+ * recorded to <record_dir>/dbus.trace: names of services signals
+ * are received from, signals and replies to method calls (only if
+ * the method name is passed to the request helper from dbus.hpp).
+ */
+Writer * dbus_writer();
+
+void record_service(QString const &);
+void record_signal(QString const &service, QDBusMessage const &);
+/// record reply or error, method is "interface.member", for
+/// org.freedesktop.DBus.Properties methods interface is the one
+/// properties are requested for
+void record_reply(char const *method, QDBusMessage const &);
+
+inline void record_reply(char const *method, QDBusPendingCall const &reply)
+{
+    if (method && record_dir())
+        record_reply(method, reply.reply());
+}
+
+/**
+ * Arguments are encoded with their D-Bus signatures, so they can be
+ * sent again with the same signatures. @return false if arguments
+ * contain unsupported types (unix fds, structures which are not
+ * received from D-Bus)
+ */
+bool encode(Encoder &, QVariantList const &);
+
+/**
+ * Decode arguments into natural Qt types: a{sv} is decoded into
+ * QVariantMap, as into QStringList, ao into QList<QDBusObjectPath>
+ * etc. Structures and arrays of complex types are decoded into
+ * QVariantList, other maps into QVariantMap with stringified keys,
+ * so they are marshalled with other signatures unless converter to
+ * the registered type is set for the signature.
+ */
+bool decode(Decoder &, QVariantList &);
+
+/// converter from the generic (see decode()) representation into
+/// the registered type
+typedef std::function<QVariant (QVariant const&)> converter_type;
+void set_converter(QString const &signature, converter_type const &);
+
+}}}
+
+#endif // _STATEFS_QT_RECORD_HPP_
@@ -0,0 +1,82 @@
+#ifndef _STATEFS_QT_SCHEMA_HPP_
+#define _STATEFS_QT_SCHEMA_HPP_
+
+#include <cstddef>
+
+namespace statefs { namespace qt {
+
+/**
+ * Static description of the namespace property: statefs name,
+ * default value and name of the source (e.g. D-Bus) property. Source
+ * name is the same as the statefs name if it is not set.
+ *
+ * Namespace schema is a constexpr array of descriptors indexed by
+ * the provider enum ending with EOE, see is_valid_schema().
+ */
+struct PropertyInfo
+{
+    constexpr PropertyInfo(char const *name, char const *def_val)
+        : name(name), default_value(def_val), source(name)
+    {}
+
+    constexpr PropertyInfo(char const *name, char const *def_val
+                           , char const *src_name)
+        : name(name), default_value(def_val), source(src_name)
+    {}
+
+    char const *name;
+    char const *default_value;
+    char const *source;
+};
+
+namespace schema {
+
+constexpr bool is_equal(char const *a, char const *b)
+{
+    return *a == *b && (!*a || is_equal(a + 1, b + 1));
+}
+
+constexpr bool is_valid(PropertyInfo const &info)
+{
+    return info.name && *info.name && info.default_value
+        && info.source && *info.source;
+}
+
+template <size_t N>
+constexpr bool is_valid_from(PropertyInfo const (&info)[N], size_t i)
+{
+    return i >= N || (is_valid(info[i]) && is_valid_from(info, i + 1));
+}
+
+// names of [i] and [j..N) are compared, then [i + 1] and [i + 2..N)
+// etc., constexpr in C++11 can't have loops
+template <size_t N>
+constexpr bool is_unique_from(PropertyInfo const (&info)[N]
+                              , size_t i, size_t j)
+{
+    return i + 1 >= N
+        || (j >= N
+            ? is_unique_from(info, i + 1, i + 2)
+            : (!is_equal(info[i].name, info[j].name)
+               && is_unique_from(info, i, j + 1)));
+}
+
+}
+
+/**
+ * Compile-time schema check to be used in static_assert: there
+ * is a descriptor for each EnumT value (EnumT::EOE is the count),
+ * all names and default values are set and statefs names are
+ * unique.
+ */
+template <typename EnumT, size_t N>
+constexpr bool is_valid_schema(PropertyInfo const (&info)[N])
+{
+    return N == static_cast<size_t>(EnumT::EOE)
+        && schema::is_valid_from(info, 0)
+        && schema::is_unique_from(info, 0, 1);
+}
+
+}}
+
+#endif // _STATEFS_QT_SCHEMA_HPP_
@@ -0,0 +1,191 @@
+#ifndef _STATEFS_QT_STATIC_MAP_HPP_
+#define _STATEFS_QT_STATIC_MAP_HPP_
+
+#include <statefs/qt/indices.hpp>
+
+#include <QChar>
+#include <QString>
+
+#include <cstddef>
+#include <stdint.h>
+
+namespace statefs { namespace qt {
+
+template <typename T>
+struct StaticMapEntry
+{
+    char const *key;
+    T value;
+};
+
+namespace static_map {
+
+// FNV-1a with the seeded basis and final mixing of the high bits
+// into the low ones used as a slot number
+constexpr uint32_t basis(uint32_t seed)
+{
+    return 2166136261u ^ (seed * 0x9e3779b9u);
+}
+
+constexpr uint32_t step(uint32_t h, uint32_t c)
+{
+    return (h ^ c) * 16777619u;
+}
+
+constexpr uint32_t finish(uint32_t h)
+{
+    return h ^ (h >> 16);
+}
+
+constexpr uint32_t hash(char const *s, uint32_t h)
+{
+    return *s ? hash(s + 1, step(h, static_cast<unsigned char>(*s))) : h;
+}
+
+// table is at least 4 times bigger than the number of keys, so
+// collision-free seed is found after a few attempts
+constexpr size_t table_size(size_t n, size_t size = 1)
+{
+    return size >= 4 * n ? size : table_size(n, size * 2);
+}
+
+enum { max_seed = 256 };
+
+template <typename T, size_t N>
+constexpr size_t slot(StaticMapEntry<T> const (&e)[N]
+                      , uint32_t seed, size_t mask, size_t i)
+{
+    return finish(hash(e[i].key, basis(seed))) & mask;
+}
+
+// slot of i-th key differs from slots of keys [j, N)
+template <typename T, size_t N>
+constexpr bool is_unique_slot(StaticMapEntry<T> const (&e)[N]
+                              , uint32_t seed, size_t mask
+                              , size_t i, size_t j)
+{
+    return j >= N || (slot(e, seed, mask, i) != slot(e, seed, mask, j)
+                      && is_unique_slot(e, seed, mask, i, j + 1));
+}
+
+template <typename T, size_t N>
+constexpr bool is_perfect(StaticMapEntry<T> const (&e)[N]
+                          , uint32_t seed, size_t mask, size_t i = 0)
+{
+    return i >= N || (is_unique_slot(e, seed, mask, i, i + 1)
+                      && is_perfect(e, seed, mask, i + 1));
+}
+
+// max_seed is returned if there is no perfect hash (e.g. keys are
+// not unique)
+template <typename T, size_t N>
+constexpr uint32_t find_seed(StaticMapEntry<T> const (&e)[N]
+                             , size_t mask, uint32_t seed = 0)
+{
+    return (seed >= max_seed || is_perfect(e, seed, mask))
+        ? seed : find_seed(e, mask, seed + 1);
+}
+
+// index of the entry occupying slot s or N for empty slot
+template <typename T, size_t N>
+constexpr size_t entry_index(StaticMapEntry<T> const (&e)[N]
+                             , uint32_t seed, size_t mask
+                             , size_t s, size_t i = 0)
+{
+    return (i >= N || slot(e, seed, mask, i) == s)
+        ? i : entry_index(e, seed, mask, s, i + 1);
+}
+
+}
+
+/**
+ * Immutable map from the set of known strings (e.g. D-Bus property
+ * or interface names) to values, built at compile time. Keys are
+ * placed into slots using the perfect hash with the seed found by
+ * the compiler, so lookup is a hash calculation and a single string
+ * comparison, there is no allocation and unknown keys do not change
+ * anything.
+ *
+ * Entries should be a constexpr array with the static storage
+ * duration, map refers to it. Use make_static_map() to create the
+ * map and check is_perfect() in static_assert:
+ *
+ *     static constexpr StaticMapEntry<Id> id_entries[] = {...};
+ *     static constexpr auto ids = make_static_map(id_entries);
+ *     static_assert(ids.is_perfect(), "...");
+ */
+template <typename T, size_t N, size_t Size>
+class StaticMap
+{
+public:
+    typedef StaticMapEntry<T> entry_type;
+
+    constexpr StaticMap(entry_type const (&entries)[N])
+        : StaticMap(entries, static_map::find_seed(entries, Size - 1)
+                    , typename MakeIndices<Size>::type())
+    {}
+
+    /// there is a perfect hash for the keys, it is false also if
+    /// there are duplicated keys
+    constexpr bool is_perfect() const
+    {
+        return seed_ < static_map::max_seed;
+    }
+
+    constexpr size_t size() const { return N; }
+
+    /// @return nullptr if there is no such key
+    T const *find(QChar const *s, size_t len) const
+    {
+        auto h = static_map::basis(seed_);
+        for (size_t i = 0; i < len; ++i)
+            h = static_map::step(h, s[i].unicode());
+        auto idx = slots_[static_map::finish(h) & (Size - 1)];
+        if (idx >= N)
+            return nullptr;
+
+        auto const &e = entries_[idx];
+        for (size_t i = 0; i < len; ++i)
+            if (!e.key[i] || s[i].unicode() != static_cast<unsigned char>(e.key[i]))
+                return nullptr;
+        return e.key[len] ? nullptr : &e.value;
+    }
+
+    T const *find(QString const &s) const
+    {
+        return find(s.constData(), s.size());
+    }
+
+    /// @return value for the key or def_value if there is no such key
+    T value(QString const &s, T const &def_value) const
+    {
+        auto p = find(s);
+        return p ? *p : def_value;
+    }
+
+private:
+    template <size_t ... I>
+    constexpr StaticMap(entry_type const (&entries)[N], uint32_t seed
+                        , Indices<I...>)
+        : entries_(entries)
+        , seed_(seed)
+        , slots_{static_cast<uint16_t>
+            (static_map::entry_index(entries, seed, Size - 1, I))...}
+    {}
+
+    entry_type const *entries_;
+    uint32_t seed_;
+    // index of the entry in the slot, N for empty slots
+    uint16_t slots_[Size];
+};
+
+template <typename T, size_t N>
+constexpr StaticMap<T, N, static_map::table_size(N)>
+make_static_map(StaticMapEntry<T> const (&entries)[N])
+{
+    return StaticMap<T, N, static_map::table_size(N)>(entries);
+}
+
+}}
+
+#endif // _STATEFS_QT_STATIC_MAP_HPP_
@@ -0,0 +1,124 @@
+#ifndef _STATEFS_QT_STATS_HPP_
+#define _STATEFS_QT_STATS_HPP_
+
+#include <statefs/property.hpp>
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <stdint.h>
+#include <stdlib.h>
+
+namespace statefs { namespace qt {
+
+/**
+ * D-Bus method call statistics: number of calls, errors and latency
+ * histogram. Recording is lock-free, so it can be done from any
+ * thread while statistics is read by statefs.
+ *
+ * Histogram buckets are log-linear in microseconds: exact for values
+ * below 8us and 4 buckets per power of 2 after that, so percentiles
+ * are reported with <25% error up to ~30s.
+ */
+class MethodStats
+{
+public:
+    enum {
+        linear_buckets = 8,
+        buckets_per_power = 4,
+        bucket_count = linear_buckets + 22 * buckets_per_power,
+        name_capacity = 96
+    };
+
+    struct Summary
+    {
+        uint64_t calls;
+        uint64_t errors;
+        // latencies in microseconds
+        uint64_t p50;
+        uint64_t p90;
+        uint64_t p99;
+        uint64_t max;
+    };
+
+    void record(uint64_t latency_ns, bool is_error);
+    Summary summary() const;
+    char const *name() const { return name_; }
+
+    static size_t bucket(uint64_t us);
+    static uint64_t bucket_max(size_t);
+
+private:
+    friend MethodStats *method_stats(char const *);
+
+    // no constructor: statistics is allocated in the zero-initialized
+    // static registry
+    char name_[name_capacity];
+    std::atomic<uint64_t> calls_;
+    std::atomic<uint64_t> errors_;
+    std::atomic<uint64_t> max_us_;
+    std::atomic<uint64_t> buckets_[bucket_count];
+};
+
+/// statistics is collected only if STATEFS_PROVIDER_STATS environment
+/// variable is set to non-zero value. It is inline to be used also by
+/// providers not linking statefs-providers-qt5 (udev)
+inline bool is_stats_enabled()
+{
+    static const bool is_enabled = []() {
+        auto v = ::getenv("STATEFS_PROVIDER_STATS");
+        return v && ::atoi(v) != 0;
+    }();
+    return is_enabled;
+}
+
+/**
+ * Get (creating on the first call) statistics for the method with
+ * the full name (interface.method).
+ *
+ * @return nullptr if statistics is disabled, name is nullptr or
+ * registry is full
+ */
+MethodStats *method_stats(char const *name);
+
+/// visit all registered methods those names start with prefix
+void for_each_method_stats(char const *prefix
+                           , std::function<void (MethodStats const&)> const&);
+
+/// measures single call latency, does nothing if there is no
+/// statistics for the method
+class CallTimer
+{
+public:
+    CallTimer(char const *method = nullptr);
+    void done(bool is_error) const;
+
+private:
+    MethodStats *stats_;
+    uint64_t start_;
+};
+
+/**
+ * Diagnostic namespace ProviderStats.<provider> with statistics for
+ * methods of D-Bus interfaces starting with the prefix (usually the
+ * service name). "Methods" property is a table with a line per
+ * method, it is calculated on read.
+ */
+class StatsNamespace : public statefs::Namespace
+{
+public:
+    StatsNamespace(std::string const &provider, std::string const &prefix);
+    virtual ~StatsNamespace() {}
+    virtual void release() { }
+
+    std::string dump() const;
+    /// dump() is not longer than this
+    size_t dump_size_max() const;
+
+private:
+    std::string prefix_;
+};
+
+}}
+
+#endif // _STATEFS_QT_STATS_HPP_
@@ -0,0 +1,420 @@
+#ifndef _STATEFS_QT_TRACE_HPP_
+#define _STATEFS_QT_TRACE_HPP_
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// trace is written from threads w/o Qt event loop (udev monitor,
+// bme client), so it uses only POSIX I/O and a mutex
+
+namespace statefs { namespace qt {
+
+/// upstream inputs are recorded to <dir>/<source>.trace files if
+/// STATEFS_PROVIDER_RECORD is set to the directory name
+inline char const *record_dir()
+{
+    static char const *dir = []() -> char const* {
+        auto v = ::getenv("STATEFS_PROVIDER_RECORD");
+        return (v && *v) ? v : nullptr;
+    }();
+    return dir;
+}
+
+/// trace file inputs are taken from instead of the real source,
+/// STATEFS_PROVIDER_REPLAY, nullptr if not set
+inline char const *replay_path()
+{
+    static char const *path = []() -> char const* {
+        auto v = ::getenv("STATEFS_PROVIDER_REPLAY");
+        return (v && *v) ? v : nullptr;
+    }();
+    return path;
+}
+
+/// STATEFS_PROVIDER_REPLAY_SPEED: 1 (default) is the recorded speed,
+/// N is N times faster, 0 is as fast as possible
+inline double replay_speed()
+{
+    static const double speed = []() {
+        auto v = ::getenv("STATEFS_PROVIDER_REPLAY_SPEED");
+        return v ? ::atof(v) : 1.0;
+    }();
+    return speed;
+}
+
+namespace trace {
+
+/*
+ * Trace file is the "SFTRACE" magic followed by the format version
+ * byte and the sequence of records:
+ *
+ *     varint  time since the previous record, ns (CLOCK_MONOTONIC)
+ *     u8      kind
+ *     varint  payload size
+ *     payload
+ *
+ * Payload is the sequence of fields encoded by Encoder: unsigned
+ * varints, zigzag-encoded signed varints and strings (varint size
+ * and bytes). Fields of each kind are described below.
+ */
+static char const magic[] = "SFTRACE";
+static const uint8_t version = 1;
+
+enum class Kind : uint8_t {
+    // service name the process is subscribed to
+    DBusService = 1,
+    // service, path, interface, member, arguments
+    DBusSignal,
+    // method ("interface.member"), arguments
+    DBusReply,
+    // method, error name, error message
+    DBusError,
+    // source ("monitor", "enumerate" or "refresh"), syspath
+    UdevEvent,
+    // syspath, attribute, value (empty if there is no attribute)
+    SysfsRead,
+    // count, signed values
+    BmeStats,
+    // type, code, signed value
+    InputEvent,
+    // syspath, udev event property, value (empty if it is absent)
+    UdevProperty,
+    EOE
+};
+
+inline uint64_t monotonic_ns()
+{
+    timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+class Encoder
+{
+public:
+    Encoder(std::string &dst) : dst_(dst) {}
+
+    void put(uint64_t v)
+    {
+        while (v >= 0x80) {
+            dst_.push_back(static_cast<char>((v & 0x7f) | 0x80));
+            v >>= 7;
+        }
+        dst_.push_back(static_cast<char>(v));
+    }
+
+    void put_signed(int64_t v)
+    {
+        put((static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63));
+    }
+
+    void put(char const *s, size_t len)
+    {
+        put(static_cast<uint64_t>(len));
+        dst_.append(s, len);
+    }
+
+    void put(std::string const &s)
+    {
+        put(s.data(), s.size());
+    }
+
+    void put_raw(void const *p, size_t len)
+    {
+        dst_.append(static_cast<char const*>(p), len);
+    }
+
+private:
+    std::string &dst_;
+};
+
+/// decoding errors are sticky: after the first one all get() calls
+/// fail
+class Decoder
+{
+public:
+    Decoder(char const *p, size_t len) : p_(p), end_(p + len) {}
+    Decoder(std::string const &src) : p_(src.data()), end_(p_ + src.size()) {}
+
+    bool get(uint64_t &v)
+    {
+        v = 0;
+        for (unsigned shift = 0; p_ < end_ && shift < 64; shift += 7) {
+            auto c = static_cast<uint8_t>(*p_++);
+            v |= static_cast<uint64_t>(c & 0x7f) << shift;
+            if (!(c & 0x80))
+                return true;
+        }
+        return fail();
+    }
+
+    bool get_signed(int64_t &v)
+    {
+        uint64_t u;
+        if (!get(u))
+            return false;
+        v = static_cast<int64_t>(u >> 1) ^ -static_cast<int64_t>(u & 1);
+        return true;
+    }
+
+    bool get(std::string &s)
+    {
+        uint64_t len;
+        if (!get(len) || len > static_cast<uint64_t>(end_ - p_))
+            return fail();
+        s.assign(p_, len);
+        p_ += len;
+        return true;
+    }
+
+    bool get_raw(void *dst, size_t len)
+    {
+        if (len > static_cast<size_t>(end_ - p_))
+            return fail();
+        ::memcpy(dst, p_, len);
+        p_ += len;
+        return true;
+    }
+
+    bool at_end() const { return p_ == end_; }
+    size_t left() const { return end_ - p_; }
+
+private:
+    bool fail()
+    {
+        p_ = end_;
+        return false;
+    }
+
+    char const *p_;
+    char const *end_;
+};
+
+/**
+ * Appends records to the trace file. Each record is written by the
+ * single write(2), so trace is usable even if provider crashes. It
+ * can be used from any thread.
+ */
+class Writer
+{
+public:
+    Writer(std::string const &path)
+        : fd_(::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC
+                     , 0644))
+        , last_ns_(0)
+    {
+        if (fd_ < 0)
+            return;
+        std::string header(magic, sizeof(magic) - 1);
+        header.push_back(static_cast<char>(version));
+        if (!write_all(header)) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+    }
+
+    ~Writer()
+    {
+        if (fd_ >= 0)
+            ::close(fd_);
+    }
+
+    bool is_open() const { return fd_ >= 0; }
+
+    /// encode(Encoder &) writes payload fields
+    template <typename FnT>
+    void write(Kind kind, FnT const &encode)
+    {
+        std::string payload;
+        Encoder payload_encoder(payload);
+        encode(payload_encoder);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (fd_ < 0)
+            return;
+        auto now = monotonic_ns();
+        buf_.clear();
+        Encoder e(buf_);
+        e.put(last_ns_ ? now - last_ns_ : 0);
+        buf_.push_back(static_cast<char>(kind));
+        e.put(payload);
+        last_ns_ = now;
+        write_all(buf_);
+    }
+
+private:
+    Writer(Writer const&);
+    Writer & operator =(Writer const&);
+
+    bool write_all(std::string const &data)
+    {
+        auto p = data.data();
+        auto left = data.size();
+        while (left) {
+            auto n = ::write(fd_, p, left);
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                return false;
+            }
+            p += n;
+            left -= n;
+        }
+        return true;
+    }
+
+    int fd_;
+    uint64_t last_ns_;
+    std::string buf_;
+    std::mutex mutex_;
+};
+
+/// @return writer for <record_dir>/<source>.trace or nullptr if
+/// recording is disabled or trace can't be created
+inline Writer * writer(char const *source)
+{
+    static std::mutex mutex;
+    static std::map<std::string, std::unique_ptr<Writer> > writers;
+
+    auto dir = record_dir();
+    if (!dir)
+        return nullptr;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto &p = writers[source];
+    if (!p) {
+        std::string path(dir);
+        path.append("/").append(source).append(".trace");
+        p.reset(new Writer(path));
+    }
+    return p->is_open() ? p.get() : nullptr;
+}
+
+struct Record
+{
+    // time since the first record
+    uint64_t ns;
+    Kind kind;
+    std::string data;
+};
+
+/// reads the whole trace into memory, it is used offline
+class Reader
+{
+public:
+    Reader(std::string const &path)
+        : pos_(0), ns_(0), is_valid_(false)
+    {
+        auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return;
+        char buf[4096];
+        ssize_t n;
+        while ((n = ::read(fd, buf, sizeof(buf))) > 0
+               || (n < 0 && errno == EINTR))
+            if (n > 0)
+                data_.append(buf, n);
+        ::close(fd);
+
+        auto header_size = sizeof(magic);
+        is_valid_ = (data_.size() >= header_size
+                     && !data_.compare(0, header_size - 1, magic)
+                     && static_cast<uint8_t>(data_[header_size - 1])
+                     == version);
+        pos_ = header_size;
+    }
+
+    bool is_valid() const { return is_valid_; }
+
+    /// @return false at the end or if the trace is truncated
+    bool next(Record &dst)
+    {
+        if (!is_valid_ || pos_ >= data_.size())
+            return false;
+
+        Decoder d(data_.data() + pos_, data_.size() - pos_);
+        uint64_t dt, kind;
+        if (!(d.get(dt) && d.get(kind) && d.get(dst.data))) {
+            pos_ = data_.size();
+            return false;
+        }
+        // kind byte is always < 0x80, so it is a valid varint
+        ns_ += dt;
+        dst.ns = ns_;
+        dst.kind = static_cast<Kind>(kind);
+        pos_ = data_.size() - d.left();
+        return true;
+    }
+
+    void rewind()
+    {
+        pos_ = sizeof(magic);
+        ns_ = 0;
+    }
+
+private:
+    std::string data_;
+    size_t pos_;
+    uint64_t ns_;
+    bool is_valid_;
+};
+
+/**
+ * Replay pacing: record is due at its recorded time since the first
+ * record divided by the speed, speed 0 means no delay.
+ */
+class Pacer
+{
+public:
+    Pacer(double speed = replay_speed())
+        : speed_(speed), start_ns_(0)
+    {}
+
+    /// @return milliseconds left until the record is due
+    int delay_ms(uint64_t record_ns)
+    {
+        auto due = due_ns(record_ns);
+        auto now = monotonic_ns();
+        return due > now ? static_cast<int>((due - now + 999999) / 1000000)
+            : 0;
+    }
+
+    void wait(uint64_t record_ns)
+    {
+        auto due = due_ns(record_ns);
+        if (due <= monotonic_ns())
+            return;
+        timespec ts;
+        ts.tv_sec = due / 1000000000ull;
+        ts.tv_nsec = due % 1000000000ull;
+        while (::clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr)
+               == EINTR) {}
+    }
+
+private:
+    uint64_t due_ns(uint64_t record_ns)
+    {
+        if (!start_ns_)
+            start_ns_ = monotonic_ns();
+        if (speed_ <= 0)
+            return start_ns_;
+        return start_ns_ + static_cast<uint64_t>(record_ns / speed_);
+    }
+
+    double speed_;
+    uint64_t start_ns_;
+};
+
+}}}
+
+#endif // _STATEFS_QT_TRACE_HPP_
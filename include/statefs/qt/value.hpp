@@ -0,0 +1,30 @@
+#ifndef _STATEFS_QT_VALUE_HPP_
+#define _STATEFS_QT_VALUE_HPP_
+
+#include <QVariant>
+#include <string>
+
+namespace statefs { namespace qt {
+
+/**
+ * Encode value directly into statefs string representation, the
+ * result is the same as valueEncode(src).toStdString(). Values of
+ * bool, uchar (ASCII character), (u)short, (u)int, (u)longlong,
+ * integral double and ASCII QString or QByteArray (so all basic
+ * D-Bus types used by services)
+ * are written into dst reusing its storage, so there is no heap
+ * allocation for them if dst is big enough (short values like
+ * "0"/"1" always fit into std::string small buffer).
+ *
+ * @return false if value can't be encoded w/o valueEncode(), dst is
+ * not changed in this case
+ */
+bool encodeDirect(QVariant const &src, std::string &dst);
+
+/// encode value into dst, falling back to valueEncode() for types
+/// not supported by encodeDirect()
+void encode(QVariant const &src, std::string &dst);
+
+}}
+
+#endif // _STATEFS_QT_VALUE_HPP_
@@ -24,6 +24,7 @@
 
 #include <statefs/provider.hpp>
 #include <statefs/property.hpp>
+#include <statefs/qt/trace.hpp>
 #include <thread>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -35,6 +36,10 @@
 #define DEV_DIR "/dev/input/"
 #define TOH_NAME "toh-event"
 
+namespace trace = statefs::qt::trace;
+
+static char const *provider_name = "BackCover";
+
 #define LONG_BITS (sizeof(long) * 8)
 #define NLONGS(x) (((x) + LONG_BITS - 1) / LONG_BITS)
 
@@ -44,6 +49,20 @@ bit_is_set(const unsigned long *array, int bit)
     return !!(array[bit / LONG_BITS] & (1LL << (bit % LONG_BITS)));
 }
 
+static void record_input_event(int type, int code, int value)
+{
+    trace::Writer *writer = trace::writer(provider_name);
+    if (!writer) {
+        return;
+    }
+
+    writer->write(trace::Kind::InputEvent, [=](trace::Encoder &e) {
+            e.put(static_cast<uint64_t>(type));
+            e.put(static_cast<uint64_t>(code));
+            e.put_signed(value);
+        });
+}
+
 class Provider : public statefs::AProvider
 {
 public:
@@ -85,8 +104,10 @@ private:
     int findDevice();
     bool isBackCover(int fd);
     void readValue();
+    void onInputEvent(struct input_event const &ev);
 
     static void run_thread(BackCoverMonitor& that);
+    static void run_replay(BackCoverMonitor& that);
 
     statefs::AProperty *m_parent;
     statefs_slot *m_slot;
@@ -97,7 +118,7 @@ private:
 };
 
 Provider::Provider(struct statefs_server *server)
-    : AProvider("BackCover", server)
+    : AProvider(provider_name, server)
 {
     insert(new NsChild);
 }
@@ -221,6 +242,13 @@ ssize_t BackCoverMonitor::size() const
 
 bool BackCoverMonitor::connect(statefs_slot *slot)
 {
+    // Recorded events are used instead of the device
+    if (statefs::qt::replay_path()) {
+        m_slot = slot;
+        m_thread = std::thread(run_replay, std::ref(*this));
+        return true;
+    }
+
     // Let's find our device:
     int fd = findDevice();
     if (fd == -1) {
@@ -257,6 +285,9 @@ void BackCoverMonitor::readValue()
     }
 
     m_val = bit_is_set(bits, SW_DOCK);
+
+    // initial value is recorded as the event to be replayed
+    record_input_event(EV_SW, SW_DOCK, m_val);
 }
 
 void BackCoverMonitor::disconnect()
@@ -274,7 +305,8 @@ void BackCoverMonitor::disconnect()
     }
 
     // Close fd
-    close(m_fd);
+    if (m_fd != -1)
+        close(m_fd);
     m_fd = -1;
 
     m_slot = 0;
@@ -332,19 +364,60 @@ void BackCoverMonitor::run_thread(BackCoverMonitor& that)
             continue;
         }
         else {
-            if (buf.type == EV_SW && buf.code == SW_DOCK) {
-                that.m_mutex.lock();
-                if (that.m_val == buf.value) {
-                    that.m_mutex.unlock();
-                    continue;
-                }
-                else {
-                    that.m_val = buf.value;
-                    that.m_mutex.unlock();
-                    that.m_slot->on_changed(that.m_slot, that.m_parent);
-                }
-            }
+            record_input_event(buf.type, buf.code, buf.value);
+            that.onInputEvent(buf);
+        }
+    }
+}
+
+void BackCoverMonitor::onInputEvent(struct input_event const &ev)
+{
+    if (ev.type != EV_SW || ev.code != SW_DOCK) {
+        return;
+    }
+
+    m_mutex.lock();
+    if (m_val == ev.value) {
+        m_mutex.unlock();
+        return;
+    }
+
+    m_val = ev.value;
+    m_mutex.unlock();
+    m_slot->on_changed(m_slot, m_parent);
+}
+
+void BackCoverMonitor::run_replay(BackCoverMonitor& that)
+{
+    trace::Reader reader(statefs::qt::replay_path());
+    if (!reader.is_valid()) {
+        std::cerr << "Can't read trace " << statefs::qt::replay_path() << std::endl;
+        return;
+    }
+
+    trace::Pacer pacer;
+    trace::Record rec;
+    while (reader.next(rec)) {
+        if (rec.kind != trace::Kind::InputEvent) {
+            continue;
+        }
+
+        // clock_nanosleep is a cancellation point, so disconnect()
+        // stops replay while it is waiting
+        pacer.wait(rec.ns);
+
+        struct input_event ev;
+        memset(&ev, 0, sizeof(ev));
+        trace::Decoder d(rec.data);
+        uint64_t type = 0, code = 0;
+        int64_t value = 0;
+        if (!(d.get(type) && d.get(code) && d.get_signed(value))) {
+            continue;
         }
+        ev.type = type;
+        ev.code = code;
+        ev.value = value;
+        that.onInputEvent(ev);
     }
 }
 
@@ -27,32 +27,50 @@
 #include <functional>
 #include <cor/util.hpp>
 #include <statefs/qt/dbus.hpp>
+#include <statefs/qt/profile.hpp>
 
 namespace statefs { namespace bluez {
 
 using statefs::qt::Namespace;
 using statefs::qt::PropertiesSource;
+using statefs::qt::ProfilePhase;
 using statefs::qt::async;
 
 static char const *service_name = "org.bluez";
+static char const *provider_name = "bluez";
+
+// adapter properties are passed as is, other properties are ignored
+static const statefs::qt::PropertyRoutes adapter_routes = {
+    {"Powered", Prop::Enabled}
+    , {"Discoverable", Prop::Visible}
+    , {"Address", Prop::Address}
+};
 
 Bridge::Bridge(BlueZ *ns, QDBusConnection &bus)
     : PropertiesSource(ns)
     , bus_(bus)
     , watch_(bus, service_name)
+    , signals_(SignalDispatcher::get(bus, service_name))
 {
 }
 
 void Bridge::init()
 {
     auto setup_manager = [this]() {
-        manager_.reset(new Manager(service_name, "/", bus_));
-        connect(manager_.get(), &Manager::DefaultAdapterChanged
-                , this, &Bridge::defaultAdapterChanged);
+        {
+            ProfilePhase phase(provider_name, "Manager proxy");
+            manager_.reset(new Manager(service_name, "/", bus_));
+        }
+        signals_->subscribe<QDBusObjectPath>
+            (manager_.get(), "/", Manager::staticInterfaceName()
+             , "DefaultAdapterChanged", [this](QDBusObjectPath const &v) {
+                defaultAdapterChanged(v);
+            });
 
         async(this, manager_->DefaultAdapter()
               , std::bind(&Bridge::defaultAdapterChanged, this
-                          , std::placeholders::_1));
+                          , std::placeholders::_1)
+              , "org.bluez.Manager.DefaultAdapter");
     };
     auto reset_manager = [this]() {
         manager_.reset();
@@ -69,50 +87,90 @@ void Bridge::defaultAdapterChanged(const QDBusObjectPath &v)
 
     adapter_.reset(new Adapter(service_name, v.path(), bus_));
 
-    connect(adapter_.get(), &Adapter::PropertyChanged
-            , [this](const QString &name, const QDBusVariant &value) {
-                updateProperty(name, value.variant());
-            });
-    connect(adapter_.get(), &Adapter::DeviceRemoved
-            , [this](const QDBusObjectPath &path) {
-                removeDevice(path);
-            });
-    connect(adapter_.get(), &Adapter::DeviceCreated
-            , [this](const QDBusObjectPath &path) {
-                addDevice(path);
-            });
+    auto ctx = adapter_.get();
+    auto interface = Adapter::staticInterfaceName();
+    signals_->subscribe_property_changed
+        (ctx, v.path(), interface
+         , [this](const QString &name, const QVariant &value) {
+            updateProperty(adapter_routes, name, value);
+        });
+    signals_->subscribe<QDBusObjectPath>
+        (ctx, v.path(), interface, "DeviceRemoved"
+         , [this](const QDBusObjectPath &path) {
+            removeDevice(path);
+        });
+    signals_->subscribe<QDBusObjectPath>
+        (ctx, v.path(), interface, "DeviceCreated"
+         , [this](const QDBusObjectPath &path) {
+            addDevice(path);
+        });
 
     async(this, adapter_->GetProperties(),
           [this](QVariantMap const &v) {
               setProperties(v);
-          });
+          }, "org.bluez.Adapter.GetProperties");
+
+    listDevices();
+}
+
+void Bridge::listDevices()
+{
+    if (!adapter_ || !hasReaders(Prop::Connected))
+        return;
 
     async(this, adapter_->ListDevices()
           , [this](const QList<QDBusObjectPath> &devs) {
               foreach(QDBusObjectPath dev, devs) {
                   addDevice(dev);
               }
-          });
+              // each device updates the property when its
+              // properties are received
+              if (devs.isEmpty())
+                  updateProperty(Prop::Connected, false);
+          }, "org.bluez.Adapter.ListDevices");
+}
+
+void Bridge::readersChanged(size_t idx, bool has_readers)
+{
+    if (idx != static_cast<size_t>(Prop::Connected))
+        return;
+
+    if (has_readers) {
+        listDevices();
+    } else {
+        // devices are only used to calculate Connected
+        qDebug() << "Detach from bluetooth devices";
+        devices_.clear();
+        connected_.clear();
+        resetProperty(Prop::Connected);
+    }
 }
 
 void Bridge::addDevice(const QDBusObjectPath &v)
 {
     removeDevice(v);
+    if (!hasReaders(Prop::Connected))
+        return;
 
-    auto device = cor::make_unique<Device>(service_name, v.path(), bus_);
-
-    connect(device.get(), &Device::PropertyChanged
-        , [this,v](const QString &name, const QDBusVariant &value) {
+    // there is no proxy object per device: signals are received
+    // through the dispatcher and properties are requested directly
+    auto interface = Device::staticInterfaceName();
+    auto signal = signals_->subscribe_property_changed
+        (v.path(), interface
+         , [this,v](const QString &name, const QVariant &value) {
             if (name == QLatin1String("Connected")) {
-                if (value.variant().toBool())
+                if (value.toBool())
                     connected_.insert(v);
                 else
                     connected_.erase(v);
-                updateProperty("Connected", connected_.size() > 0);
+                updateProperty(Prop::Connected, connected_.size() > 0);
             }
         });
 
-    async(this, device.get()->GetProperties()
+    auto msg = QDBusMessage::createMethodCall
+        (service_name, v.path(), interface, "GetProperties");
+    QDBusPendingReply<QVariantMap> reply = bus_.asyncCall(msg);
+    async(this, std::move(reply)
          , [this,v](const QVariantMap &props) {
             QVariantMap::const_iterator it = props.find("Connected");
             if (it != props.end()) {
@@ -120,11 +178,11 @@ void Bridge::addDevice(const QDBusObjectPath &v)
                     connected_.insert(v);
                 else
                     connected_.erase(v);
-                updateProperty("Connected", connected_.size() > 0);
+                updateProperty(Prop::Connected, connected_.size() > 0);
             }
-         });
+         }, "org.bluez.Device.GetProperties");
 
-    devices_.insert(std::make_pair(v, std::move(device)));
+    devices_.insert(std::make_pair(v, std::move(signal)));
 }
 
 void Bridge::removeDevice(const QDBusObjectPath &v)
@@ -133,28 +191,28 @@ void Bridge::removeDevice(const QDBusObjectPath &v)
     if (it != devices_.end())
         devices_.erase(it);
     if (connected_.erase(v))
-        updateProperty("Connected", connected_.size() > 0);
+        updateProperty(Prop::Connected, connected_.size() > 0);
 }
 
+static constexpr statefs::qt::PropertyInfo bluetooth_schema[] = {
+    { "Enabled", "0", "Powered" }
+    , { "Visible", "0", "Discoverable" }
+    , { "Connected", "0" }
+    , { "Address", "00:00:00:00:00:00" }
+};
+static_assert(statefs::qt::is_valid_schema<Prop>(bluetooth_schema)
+              , "Check Bluetooth properties schema");
+
 BlueZ::BlueZ(QDBusConnection &bus)
     : Namespace("Bluetooth", std::unique_ptr<PropertiesSource>
                 (new Bridge(this, bus)))
-    , defaults_({
-            { "Enabled", "0" }
-            , { "Visible", "0" }
-            , { "Connected", "0" }
-            , { "Address", "00:00:00:00:00:00" }})
 {
-    addProperty("Enabled", "0", "Powered");
-    addProperty("Visible", "0", "Discoverable");
-    addProperty("Connected", "0");
-    addProperty("Address", "00:00:00:00:00:00");
-    src_->init();
+    addProperties(bluetooth_schema);
 }
 
 void BlueZ::reset_properties()
 {
-    setProperties(defaults_);
+    setDefaults();
 }
 
 
@@ -162,11 +220,13 @@ class Provider : public statefs::AProvider
 {
 public:
     Provider(statefs_server *server)
-        : AProvider("bluez", server)
+        : AProvider(provider_name, server)
         , bus_(QDBusConnection::systemBus())
     {
         auto ns = std::make_shared<BlueZ>(bus_);
         insert(std::static_pointer_cast<statefs::ANode>(ns));
+        statefs::qt::insert_diagnostics
+            (*this, *ns, provider_name, service_name);
     }
     virtual ~Provider() {}
 
@@ -182,9 +242,13 @@ static Provider *provider = nullptr;
 
 static inline Provider *init_provider(statefs_server *server)
 {
+    ProfilePhase phase(provider_name, "load");
     if (provider)
         throw std::logic_error("provider ptr is already set");
-    registerDataTypes();
+    {
+        ProfilePhase types_phase(provider_name, "registerDataTypes");
+        registerDataTypes();
+    }
     provider = new Provider(server);
     return provider;
 }
@@ -8,6 +8,8 @@
 #include <statefs/provider.hpp>
 #include <statefs/property.hpp>
 #include <statefs/qt/ns.hpp>
+#include <statefs/qt/dbus.hpp>
+#include <statefs/qt/dispatcher.hpp>
 #include <set>
 
 #include <QObject>
@@ -17,9 +19,14 @@ namespace statefs { namespace bluez {
 typedef OrgBluezManagerInterface Manager;
 typedef OrgBluezAdapterInterface Adapter;
 typedef OrgBluezDeviceInterface Device;
+using statefs::qt::SignalDispatcher;
+using statefs::qt::Subscription;
 
 class BlueZ;
 
+// Bluetooth namespace properties, see the schema in provider_bluez.cpp
+enum class Prop { Enabled, Visible, Connected, Address, EOE };
+
 class Bridge : public QObject, public statefs::qt::PropertiesSource
 {
     Q_OBJECT
@@ -30,6 +37,7 @@ public:
     virtual ~Bridge() {}
 
     virtual void init();
+    virtual void readersChanged(size_t, bool);
 
 private slots:
     void defaultAdapterChanged(const QDBusObjectPath &);
@@ -38,13 +46,16 @@ private slots:
 
 private:
 
+    void listDevices();
+
     QDBusConnection &bus_;
     QDBusObjectPath defaultAdapter_;
     std::unique_ptr<Manager> manager_;
     std::unique_ptr<Adapter> adapter_;
-    std::map<QDBusObjectPath,std::unique_ptr<Device> > devices_;
+    std::map<QDBusObjectPath, Subscription> devices_;
     std::set<QDBusObjectPath> connected_;
     statefs::qt::ServiceWatch watch_;
+    std::shared_ptr<SignalDispatcher> signals_;
 };
 
 class BlueZ : public statefs::qt::Namespace
@@ -56,7 +67,6 @@ public:
 private:
     friend class Bridge;
     void reset_properties();
-    statefs::qt::DefaultProperties defaults_;
 };
 
 }}
@@ -35,6 +35,10 @@
 namespace statefs { namespace bme {
 
 using std::make_tuple;
+using statefs::qt::ProfilePhase;
+namespace trace = statefs::qt::trace;
+
+static char const *provider_name = "bme";
 
 template <typename T>
 static inline std::string statefs_attr(T const &v)
@@ -57,7 +61,9 @@ const BatteryNs::info_type BatteryNs::info = {{
     , make_tuple("IsCharging", "0")
 }};
 
-BatteryNs::BatteryNs() : Namespace("Battery")
+BatteryNs::BatteryNs(statefs::qt::readiness_ptr const &state)
+    : Namespace("Battery")
+    , xchg(BME_XCHG_INVAL)
 {
     for (size_t i = 0; i < prop_count; ++i) {
         char const *name;
@@ -77,9 +83,15 @@ BatteryNs::BatteryNs() : Namespace("Battery")
         ufds[1].fd = exit_handler;
         ufds[1].events = POLLIN;
         
-        initialize_bme();
+        // BME is connected from the listener thread in the lazy
+        // mode, it is not used at all if statistics are replayed
+        if (!statefs::qt::is_lazy_init_enabled()
+            && !statefs::qt::replay_path()) {
+            ProfilePhase phase(provider_name, "initialize_bme");
+            initialize_bme();
+        }
 
-        start_listening();
+        start_listening(state);
     }
 }
 
@@ -118,12 +130,27 @@ void BatteryNs::set(Prop id, std::string const &v)
     setters_[static_cast<size_t>(id)](v);
 }
 
-void BatteryNs::start_listening()
+void BatteryNs::start_listening(statefs::qt::readiness_ptr const &state)
 {
     std::cerr << "listening\n";
-    listener = std::thread([this]() {
+    auto is_lazy = statefs::qt::is_lazy_init_enabled();
+    listener = std::thread([this, is_lazy, state]() {
         int rv = 0;
 
+        if (statefs::qt::replay_path()) {
+            state->set_ready();
+            replayBatteryValues();
+            return;
+        }
+
+        if (is_lazy) {
+            {
+                ProfilePhase phase(provider_name, "initialize_bme");
+                initialize_bme();
+            }
+            state->set_ready();
+        }
+
         while (!exiting)
         {
             rv = poll(ufds, 2, -1);
@@ -185,6 +212,21 @@ bool BatteryNs::readBatteryValues()
         return false;
     }
 
+    bme_close(sd);
+
+    if (auto writer = trace::writer(provider_name)) {
+        writer->write(trace::Kind::BmeStats, [&st](trace::Encoder &e) {
+                e.put(static_cast<uint64_t>(bme_stat_ids_end));
+                for (auto v : st)
+                    e.put_signed(v);
+            });
+    }
+    setBatteryValues(st);
+    return true;
+}
+
+void BatteryNs::setBatteryValues(bme_stat_t const &st)
+{
     bool _isCharging = st[bme_stat_charger_state] == bme_charging_state_started
                        && st[bme_stat_bat_state] != bme_bat_state_full;
     set(Prop::IsCharging, statefs_attr(_isCharging));
@@ -208,10 +250,41 @@ bool BatteryNs::readBatteryValues()
     set(Prop::TimeUntilFull, statefs_attr(st[bme_stat_charging_time_left_min] * NANOSECS_PER_MIN));
 
     set(Prop::TimeUntilLow, statefs_attr(st[bme_stat_bat_time_left] * NANOSECS_PER_MIN));
+}
 
-    bme_close(sd);
+/// feed recorded statistics to setBatteryValues() instead of BME,
+/// it is stopped by the exit event
+void BatteryNs::replayBatteryValues()
+{
+    auto path = statefs::qt::replay_path();
+    trace::Reader reader(path);
+    if (!reader.is_valid()) {
+        std::cerr << "Can't read trace " << path << "\n";
+        return;
+    }
 
-    return true;
+    trace::Pacer pacer;
+    trace::Record rec;
+    while (reader.next(rec)) {
+        if (rec.kind != trace::Kind::BmeStats)
+            continue;
+        if (poll(&ufds[1], 1, pacer.delay_ms(rec.ns)) > 0)
+            return;
+
+        bme_stat_t st;
+        memset(st, 0, sizeof(st));
+        trace::Decoder d(rec.data);
+        uint64_t count = 0;
+        d.get(count);
+        for (uint64_t i = 0; i < count; ++i) {
+            int64_t v = 0;
+            if (!d.get_signed(v))
+                break;
+            if (i < bme_stat_ids_end)
+                st[i] = v;
+        }
+        setBatteryValues(st);
+    }
 }
 
 bool BatteryNs::initProviderSource()
@@ -237,10 +310,13 @@ class Provider : public statefs::AProvider
 {
 public:
     Provider(statefs_server *server)
-        : AProvider("bme", server)
+        : AProvider(provider_name, server)
     {
-        ns = std::make_shared<BatteryNs>();
+        auto state = std::make_shared<statefs::qt::ReadinessNamespace>
+            (provider_name);
+        ns = std::make_shared<BatteryNs>(state);
         insert(std::static_pointer_cast<statefs::ANode>(ns));
+        insert(std::static_pointer_cast<statefs::ANode>(state));
     }
     virtual ~Provider() {}
 
@@ -259,6 +335,7 @@ static inline Provider *init_provider(statefs_server *server)
 {
     if (provider)
         throw std::logic_error("provider ptr is already set");
+    ProfilePhase phase(provider_name, "load");
     provider = new Provider(server);
     return provider;
 }
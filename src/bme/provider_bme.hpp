@@ -3,6 +3,8 @@
 
 #include <statefs/property.hpp>
 #include <statefs/consumer.hpp>
+#include <statefs/qt/readiness.hpp>
+#include <statefs/qt/trace.hpp>
 
 #include "bmeipc.h"
 
@@ -29,7 +31,7 @@ public:
 
     static const info_type info;
 
-    BatteryNs();
+    BatteryNs(statefs::qt::readiness_ptr const &);
     virtual ~BatteryNs();
 
     virtual void release() { }
@@ -38,10 +40,12 @@ public:
 
 private:
     void initialize_bme();
-    void start_listening();
+    void start_listening(statefs::qt::readiness_ptr const &);
 
     void onBMEEvent();
     bool readBatteryValues();
+    void setBatteryValues(bme_stat_t const &);
+    void replayBatteryValues();
 
     bool initProviderSource();
     void cleanProviderSource();
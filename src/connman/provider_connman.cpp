@@ -26,32 +26,52 @@
 #include <math.h>
 #include <iostream>
 #include <statefs/qt/dbus.hpp>
+#include <statefs/qt/objects.hpp>
+#include <statefs/qt/static_map.hpp>
+#include <statefs/qt/profile.hpp>
 #include "dbus_types.hpp"
 
 namespace statefs { namespace connman {
 
 using statefs::qt::Namespace;
 using statefs::qt::PropertiesSource;
-using statefs::qt::sync;
+using statefs::qt::ProfilePhase;
+using statefs::qt::StaticMapEntry;
+using statefs::qt::Transaction;
+using statefs::qt::argument_future;
+using statefs::qt::find_object;
+using statefs::qt::future;
+using statefs::qt::make_static_map;
 
 static char const *service_name = "net.connman";
+static char const *provider_name = "connman";
 
-Bridge::Bridge(InternetNs *ns, QDBusConnection &bus)
-    : PropertiesSource(ns)
-    , bus_(bus)
-    , watch_(new ServiceWatch(bus, service_name))
-    , net_type_map_{
+static constexpr StaticMapEntry<char const*> net_type_entries[] = {
     {"wifi", "WLAN"}
     , {"gprs", "GPRS"}
     , {"cellular", "GPRS"}
     , {"edge", "GPRS"}
     , {"umts", "GPRS"}
-    , {"ethernet", "ethernet"}}
-    , state_map_{
-        {"offline", Status::Offline}
-        , {"idle", Status::Offline}
-        , {"online", Status::Online}
-        , {"ready", Status::Online}}
+    , {"ethernet", "ethernet"}
+};
+static constexpr auto net_type_map = make_static_map(net_type_entries);
+static_assert(net_type_map.is_perfect(), "Check network type names");
+
+// unknown states are treated as offline
+static constexpr StaticMapEntry<Status> state_entries[] = {
+    {"offline", Status::Offline}
+    , {"idle", Status::Offline}
+    , {"online", Status::Online}
+    , {"ready", Status::Online}
+};
+static constexpr auto state_map = make_static_map(state_entries);
+static_assert(state_map.is_perfect(), "Check state names");
+
+Bridge::Bridge(InternetNs *ns, QDBusConnection &bus)
+    : PropertiesSource(ns)
+    , bus_(bus)
+    , watch_(new ServiceWatch(bus, service_name))
+    , signals_(SignalDispatcher::get(bus, service_name))
     , states_{"disconnected", "connected"}
 {
 }
@@ -63,7 +83,7 @@ void Bridge::process_manager_props(QVariantMap const &props)
         if (n == "State") {
             auto state = v.toString();
             qDebug() << "Network manager is " << state;
-            if (state_map_[state] == Status::Online) {
+            if (state_map.value(state, Status::Offline) == Status::Online) {
                 process_services();
                 process_technologies();
             } else {
@@ -71,34 +91,42 @@ void Bridge::process_manager_props(QVariantMap const &props)
             }
         }
     };
-    connect(manager_.get(), &Manager::PropertyChanged
-            , [update] (QString const &n, QDBusVariant const &v) {
-                qDebug() << "Manager property " << n;
-                update(n, v.variant());
-            });
-    connect(manager_.get(), &Manager::TechnologyAdded
-            , [this] (const QDBusObjectPath &path, const QVariantMap &props) {
-                qDebug() << "Technology added " << path.path();
+    auto ctx = manager_.get();
+    auto interface = Manager::staticInterfaceName();
+    signals_->subscribe_property_changed
+        (ctx, "/", interface, [update](QString const &n, QVariant const &v) {
+            qDebug() << "Manager property " << n;
+            update(n, v);
+        });
+    signals_->subscribe<QDBusObjectPath, QVariantMap>
+        (ctx, "/", interface, "TechnologyAdded"
+         , [this] (const QDBusObjectPath &path, const QVariantMap &props) {
+            qDebug() << "Technology added " << path.path();
+            if (hasReaders(Prop::Tethering))
                 process_technology(path.path(), props);
-            });
-    connect(manager_.get(), &Manager::TechnologyRemoved
-            , [this] (const QDBusObjectPath &path) {
-                qDebug() << "Technology removed " << path.path();
-                process_technologies();
-            });
-    connect(manager_.get(), &Manager::ServicesAdded
-            , [this] (PathPropertiesArray const &info) {
-                qDebug() << "Services added";
+        });
+    signals_->subscribe<QDBusObjectPath>
+        (ctx, "/", interface, "TechnologyRemoved"
+         , [this] (const QDBusObjectPath &path) {
+            qDebug() << "Technology removed " << path.path();
+            process_technologies();
+        });
+    // services are re-read, so there is no need to demarshal them
+    signals_->subscribe<>
+        (ctx, "/", interface, "ServicesAdded"
+         , [this] () {
+            qDebug() << "Services added";
+            process_services();
+        });
+    signals_->subscribe<QList<QDBusObjectPath> >
+        (ctx, "/", interface, "ServicesRemoved"
+         , [this] (const QList<QDBusObjectPath> &data) {
+            qDebug() << "Services removed";
+            auto services = QSet<QDBusObjectPath>::fromList(data);
+            if (services.contains(QDBusObjectPath(current_service_))) {
                 process_services();
-            });
-    connect(manager_.get(), &Manager::ServicesRemoved
-            , [this] (const QList<QDBusObjectPath> &data) {
-                qDebug() << "Services removed";
-                auto services = QSet<QDBusObjectPath>::fromList(data);
-                if (services.contains(QDBusObjectPath(current_service_))) {
-                    process_services();
-                }
-            });
+            }
+        });
 
     for (auto it = props.begin(); it != props.end(); ++it)
         update(it.key(), it.value());
@@ -108,16 +136,39 @@ void Bridge::init()
 {
     auto init_manager = [this]() {
         qDebug() << "Establish connection with connman";
-        manager_.reset(new Manager(service_name, "/", bus_));
-        sync(manager_->GetProperties()
-             , [this](QVariantMap const &v) {
-                 process_manager_props(v);
-             });
+        {
+            ProfilePhase phase(provider_name, "Manager proxy");
+            manager_.reset(new Manager(service_name, "/", bus_));
+        }
+        future(manager_.get(), manager_->GetProperties()
+               , "net.connman.Manager.GetProperties")
+            .then([this](QVariantMap const &v) {
+                    process_manager_props(v);
+                });
     };
     watch_->init(init_manager, [this]() { reset_manager(); });
+    // connman restart should not cause two waves of changes
+    watch_->set_policy(ServiceWatch::hold_values_policy()
+                       , [this]() { beginUpdate(); }
+                       , [this]() { commitUpdate(); });
     init_manager();
 }
 
+void Bridge::readersChanged(size_t idx, bool has_readers)
+{
+    if (idx != static_cast<size_t>(Prop::Tethering))
+        return;
+
+    if (has_readers) {
+        process_technologies();
+    } else {
+        qDebug() << "Detach from technologies";
+        technologies_.clear();
+        tethering_.clear();
+        resetProperty(Prop::Tethering);
+    }
+}
+
 void Bridge::reset_properties()
 {
     qDebug() << "Internet: reset properties";
@@ -133,22 +184,34 @@ void Bridge::reset_manager()
 
 void Bridge::process_technologies()
 {
-    technologies_.clear();
-    auto process_props = [this](PathPropertiesArray const &techs) {
-        for (auto pp = techs.begin(); pp != techs.end(); ++pp) {
-            auto const &path = std::get<0>(*pp).path();
-            auto const &props = std::get<1>(*pp);
-            process_technology(path, props);
-        }
+    if (!manager_)
+        return;
+
+    // technologies are only used to calculate Tethering
+    if (!hasReaders(Prop::Tethering)) {
+        technologies_.clear();
+        return;
+    }
+
+    auto process_props = [this](QDBusArgument const &techs) {
+        static const QStringList keys = {"Type", "Tethering"};
+        technologies_.clear();
+        find_object(techs, keys, [this](QString const &path
+                                        , QVariantMap const &props) {
+                        process_technology(path, props);
+                        return false;
+                    });
     };
-    sync(manager_->GetTechnologies(), process_props);
+    argument_future(manager_.get(), manager_->GetTechnologies()
+                    , "net.connman.Manager.GetTechnologies")
+        .then(process_props);
 }
 
 Status Bridge::process_service
 (QString const &path, QVariantMap const &props)
 {
     auto get_status = [this](QVariant const &state) {
-        return state_map_[state.toString()];
+        return state_map.value(state.toString(), Status::Offline);
     };
 
     auto status = get_status(props["State"]);
@@ -165,59 +228,63 @@ Status Bridge::process_service
         qDebug() << path << " status ->" << v.toString();
         auto status = get_status(v);
         auto name = states_[static_cast<size_t>(status)];
-        updateProperty("NetworkState", name);
+        updateProperty(Prop::NetworkState, name);
     };
 
     auto update = [this, update_status](QString const &n, QVariant const &v) {
         // qDebug() << "Changed: " << n << " for " << path;
         if (n == "Name") {
-            updateProperty("NetworkName", v);
+            updateProperty(Prop::NetworkName, v);
         } else if (n == "Strength") {
-            updateProperty("SignalStrength", v.toUInt());
+            updateProperty(Prop::SignalStrength, v.toUInt());
         } else if (n == "State") {
             update_status(v);
             process_services();
         } else if (n == "Type") {
-            updateProperty("NetworkType", net_type_map_[v.toString()]);
+            updateProperty(Prop::NetworkType
+                           , net_type_map.value(v.toString(), ""));
         }
     };
 
-    for (QString n : {"Name", "Strength", "Type"})
-        update(n, props[n]);
+    {
+        Transaction<PropertiesSource> tx(this);
+        for (QString n : {"Name", "Strength", "Type"})
+            update(n, props[n]);
 
-    update_status(props["State"]);
+        update_status(props["State"]);
+    }
 
-    service_.reset(new Service(service_name, path, bus_));
-    connect(service_.get(), &Service::PropertyChanged
-            , [update](QString const &n, QDBusVariant const&v) {
-                update(n, v.variant());
-            });
+    service_ = signals_->subscribe_property_changed
+        (path, Service::staticInterfaceName(), update);
     return status;
 }
 
 void Bridge::process_services()
 {
-    current_service_ = "";
-    service_.reset();
-
-    auto process = [this](PathPropertiesArray const &services) {
-
-        if (services.begin() == services.end()) {
+    if (!manager_)
+        return;
+
+    auto process = [this](QDBusArgument const &services) {
+        static const QStringList keys = {"Name", "Strength", "Type", "State"};
+        current_service_ = "";
+        service_.reset();
+
+        // first connection provided by connman according to connman
+        // docs is default, so monitor only it if it is online, the
+        // rest of the (possibly long) list is not even read
+        bool is_empty = true;
+        find_object(services, keys, [this, &is_empty]
+                    (QString const &path, QVariantMap const &props) {
+                        is_empty = false;
+                        return process_service(path, props) == Status::Online;
+                    });
+        if (is_empty) {
             qDebug() << "No services";
             reset_properties();
-        } else {
-            for (auto pp = services.begin(); pp != services.end(); ++pp) {
-                auto const &path = std::get<0>(*pp).path();
-                auto const &props = std::get<1>(*pp);
-                // first connection provided by connman according to
-                // connman docs is default, so monitor only it if it
-                // is online
-                if (process_service(path, props) == Status::Online)
-                    break;
-            }
         }
     };
-    sync(manager_->GetServices(), process);
+    argument_future(manager_.get(), manager_->GetServices()
+                    , "net.connman.Manager.GetServices").then(process);
 }
 
 void Bridge::process_technology(QString const &path
@@ -243,7 +310,7 @@ void Bridge::process_technology(QString const &path
             QStringList values(QStringList::fromSet(tethering_));
             teth_str = values.join("\n");
         }
-        updateProperty("Tethering", teth_str);
+        updateProperty(Prop::Tethering, teth_str);
         qDebug() << "Technology (type=" << net_type << ") tethering is " << teth_str;
     };
 
@@ -253,37 +320,32 @@ void Bridge::process_technology(QString const &path
     };
 
     update_tethering(props["Tethering"]);
-    auto tech = cor::make_unique<Technology>(service_name, path, bus_);
-    connect(tech.get(), &Technology::PropertyChanged
-            , [update](QString const &n, QDBusVariant const&v) {
-                update(n, v.variant());
-            });
-
-    technologies_.insert(std::make_pair(path, std::move(tech)));
+    technologies_[path] = signals_->subscribe_property_changed
+        (path, Technology::staticInterfaceName(), update);
 }
 
+static constexpr statefs::qt::PropertyInfo internet_schema[] = {
+    { "NetworkType", "" }
+    , { "NetworkState", "disconnected" }
+    , { "NetworkName", "" }
+    , { "TrafficIn", "0" }
+    , { "TrafficOut", "0" }
+    , { "SignalStrength", "0" }
+    , { "Tethering", "" }
+};
+static_assert(statefs::qt::is_valid_schema<Prop>(internet_schema)
+              , "Check Internet properties schema");
+
 InternetNs::InternetNs(QDBusConnection &bus)
     : Namespace("Internet", std::unique_ptr<PropertiesSource>
                 (new Bridge(this, bus)))
-    , defaults_({{"NetworkType", ""}
-            , {"NetworkState", "disconnected"}
-            , {"NetworkName", ""}
-            , {"SignalStrength", "0"}
-            , {"Tethering", ""}})
 {
-    addProperty("NetworkType", "");
-    addProperty("NetworkState", "disconnected");
-    addProperty("NetworkName", "");
-    addProperty("TrafficIn", "0");
-    addProperty("TrafficOut", "0");
-    addProperty("SignalStrength", "0");
-    addProperty("Tethering", "");
-    src_->init();
+    addProperties(internet_schema);
 }
 
 void InternetNs::reset_properties()
 {
-    setProperties(defaults_);
+    setDefaults();
 }
 
 class Provider;
@@ -293,11 +355,13 @@ class Provider : public statefs::AProvider
 {
 public:
     Provider(statefs_server *server)
-        : AProvider("connman", server)
+        : AProvider(provider_name, server)
         , bus_(QDBusConnection::systemBus())
     {
         auto ns = std::make_shared<InternetNs>(bus_);
         insert(std::static_pointer_cast<statefs::ANode>(ns));
+        statefs::qt::insert_diagnostics
+            (*this, *ns, provider_name, service_name);
     }
     virtual ~Provider() {}
 
@@ -314,7 +378,11 @@ private:
 
 static inline Provider *init_provider(statefs_server *server)
 {
-    registerDataTypes();
+    ProfilePhase phase(provider_name, "load");
+    {
+        ProfilePhase types_phase(provider_name, "registerDataTypes");
+        registerDataTypes();
+    }
     if (provider)
         throw std::logic_error("provider ptr is already set");
     provider = new Provider(server);
@@ -9,6 +9,7 @@
 #include <statefs/property.hpp>
 #include <statefs/qt/ns.hpp>
 #include <statefs/qt/dbus.hpp>
+#include <statefs/qt/dispatcher.hpp>
 
 #include <map>
 #include <set>
@@ -23,11 +24,26 @@ typedef NetConnmanManagerInterface Manager;
 typedef NetConnmanServiceInterface Service;
 typedef NetConnmanTechnologyInterface Technology;
 using statefs::qt::ServiceWatch;
+using statefs::qt::SignalDispatcher;
+using statefs::qt::Subscription;
 
 class InternetNs;
 
 enum class Status { Offline, Online, EOE };
 
+// Internet namespace properties, see the schema in provider_connman.cpp
+enum class Prop {
+    NetworkType,
+    NetworkState,
+    NetworkName,
+    TrafficIn,
+    TrafficOut,
+    SignalStrength,
+    Tethering,
+
+    EOE
+};
+
 class Bridge : public QObject, public statefs::qt::PropertiesSource
 {
     Q_OBJECT;
@@ -37,6 +53,7 @@ public:
     virtual ~Bridge() {}
 
     virtual void init();
+    virtual void readersChanged(size_t, bool);
 
 private:
 
@@ -50,13 +67,13 @@ private:
 
     QDBusConnection &bus_;
     std::unique_ptr<ServiceWatch> watch_;
+    std::shared_ptr<SignalDispatcher> signals_;
     std::unique_ptr<Manager> manager_;
-    std::unique_ptr<Service> service_;
-    std::map<QString, std::unique_ptr<Technology> > technologies_;
+    // only signals of the current service and technologies are used
+    Subscription service_;
+    std::map<QString, Subscription> technologies_;
 
     QString current_service_;
-    std::map<QString, QString> net_type_map_;
-    std::map<QString, Status> state_map_;
     std::vector<QString> states_;
 
     QSet<QString> tethering_;
@@ -69,7 +86,6 @@ public:
 private:
     friend class Bridge;
     void reset_properties();
-    statefs::qt::DefaultProperties defaults_;
 };
 
 }}
@@ -0,0 +1,218 @@
+#include "host.hpp"
+
+#include <stdexcept>
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+
+namespace statefs { namespace host {
+
+uint64_t monotonic_ns()
+{
+    timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+uint64_t cpu_ns()
+{
+    timespec ts;
+    ::clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+struct ProviderHost::Slot
+{
+    // statefs passes pointer to this member to the callback, so it
+    // should be the first one
+    statefs_slot slot;
+    ProviderHost *host;
+    size_t index;
+    bool is_connected;
+    std::atomic<uint64_t> changes;
+    std::atomic<uint64_t> last_ns;
+};
+
+typedef statefs_provider * (*provider_get_fn)(statefs_server *);
+
+ProviderHost::ProviderHost(std::string const &lib_path)
+    : path_(lib_path)
+    , lib_(nullptr)
+    , provider_(nullptr)
+{
+    // providers register Qt metatypes and leave threads, library
+    // can't be safely unloaded in this case
+    lib_ = ::dlopen(lib_path.c_str(), RTLD_NOW | RTLD_LOCAL | RTLD_NODELETE);
+    if (!lib_)
+        throw std::runtime_error(std::string("Can't load provider: ")
+                                 + ::dlerror());
+
+    auto get = reinterpret_cast<provider_get_fn>
+        (::dlsym(lib_, "statefs_provider_get"));
+    if (!get) {
+        ::dlclose(lib_);
+        throw std::runtime_error(lib_path + " is not a statefs provider");
+    }
+
+    ::memset(&server_, 0, sizeof(server_));
+    provider_ = get(&server_);
+    if (!provider_) {
+        ::dlclose(lib_);
+        throw std::runtime_error(lib_path + ": provider is not created");
+    }
+    walk(&provider_->root.branch, "");
+    slots_.resize(props_.size());
+}
+
+ProviderHost::ProviderHost(statefs_provider *provider)
+    : lib_(nullptr)
+    , provider_(provider)
+{
+    ::memset(&server_, 0, sizeof(server_));
+    walk(&provider_->root.branch, "");
+    slots_.resize(props_.size());
+}
+
+ProviderHost::~ProviderHost()
+{
+    disconnect_all();
+    auto &root = provider_->root.node;
+    if (root.release)
+        root.release(&root);
+    if (lib_)
+        ::dlclose(lib_);
+}
+
+void ProviderHost::walk(statefs_branch const *branch, std::string const &prefix)
+{
+    auto h = branch->first(branch);
+    for (auto node = branch->get(branch, h); node
+             ; branch->next(branch, &h), node = branch->get(branch, h)) {
+        std::string name(prefix);
+        if (!name.empty())
+            name += ".";
+        name += node->name;
+        if (node->type == statefs_node_ns) {
+            // node is the first member of the namespace
+            auto ns = reinterpret_cast<statefs_namespace*>(node);
+            walk(&ns->branch, name);
+        } else if (node->type == statefs_node_prop) {
+            auto prop = reinterpret_cast<statefs_property*>(node);
+            props_.push_back(Property{name, prop, provider_->io.getattr(prop)});
+        }
+    }
+    if (branch->release)
+        branch->release(branch, h);
+}
+
+size_t ProviderHost::find(std::string const &path) const
+{
+    for (size_t i = 0; i < props_.size(); ++i)
+        if (props_[i].path == path)
+            return i;
+    return npos;
+}
+
+void ProviderHost::on_changed(handler_type const &handler)
+{
+    handler_ = handler;
+}
+
+void ProviderHost::changed(statefs_slot *p, statefs_property *)
+{
+    auto now = monotonic_ns();
+    auto slot = reinterpret_cast<Slot*>(p);
+    slot->changes.fetch_add(1, std::memory_order_relaxed);
+    slot->last_ns.store(now, std::memory_order_relaxed);
+    auto const &handler = slot->host->handler_;
+    if (handler)
+        handler(slot->index, now);
+}
+
+bool ProviderHost::connect(size_t idx)
+{
+    if (idx >= props_.size())
+        return false;
+
+    auto const &p = props_[idx];
+    if (!(p.attr & STATEFS_ATTR_DISCRETE))
+        return false;
+
+    auto &slot = slots_[idx];
+    if (slot && slot->is_connected)
+        return true;
+
+    if (!slot) {
+        slot.reset(new Slot());
+        slot->slot.on_changed = &ProviderHost::changed;
+        slot->host = this;
+        slot->index = idx;
+        slot->changes = 0;
+        slot->last_ns = 0;
+    }
+    slot->is_connected = provider_->io.connect(p.prop, &slot->slot);
+    return slot->is_connected;
+}
+
+size_t ProviderHost::connect_all()
+{
+    size_t count = 0;
+    for (size_t i = 0; i < props_.size(); ++i)
+        if (connect(i))
+            ++count;
+    return count;
+}
+
+void ProviderHost::disconnect_all()
+{
+    for (size_t i = 0; i < slots_.size(); ++i) {
+        auto &slot = slots_[i];
+        if (slot && slot->is_connected) {
+            provider_->io.disconnect(props_[i].prop);
+            slot->is_connected = false;
+        }
+    }
+}
+
+std::string ProviderHost::read(size_t idx) const
+{
+    auto prop = props_[idx].prop;
+    auto const &io = provider_->io;
+    auto size = io.size(prop);
+    std::string res(size > 0 ? size : 1, '\0');
+    auto h = io.open(prop, O_RDONLY);
+    if (!h)
+        return std::string();
+
+    // the same as statefs does: size is the upper limit
+    auto len = io.read(h, &res[0], res.size(), 0);
+    io.close(h);
+    res.resize(len > 0 ? len : 0);
+    return res;
+}
+
+uint64_t ProviderHost::changes(size_t idx) const
+{
+    auto const &slot = slots_[idx];
+    return slot ? slot->changes.load(std::memory_order_relaxed) : 0;
+}
+
+uint64_t ProviderHost::last_change(size_t idx) const
+{
+    auto const &slot = slots_[idx];
+    return slot ? slot->last_ns.load(std::memory_order_relaxed) : 0;
+}
+
+void ProviderHost::reset_counters()
+{
+    for (auto &slot : slots_) {
+        if (slot) {
+            slot->changes = 0;
+            slot->last_ns = 0;
+        }
+    }
+}
+
+}}
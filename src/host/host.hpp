@@ -0,0 +1,101 @@
+#ifndef _STATEFS_PROVIDERS_HOST_HPP_
+#define _STATEFS_PROVIDERS_HOST_HPP_
+
+#include <statefs/provider.h>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+namespace statefs { namespace host {
+
+uint64_t monotonic_ns();
+/// CPU time consumed by the process (all threads)
+uint64_t cpu_ns();
+
+/**
+ * Minimal in-process replacement of the statefs server: loads the
+ * provider library, walks its namespaces and subscribes to
+ * discrete properties like statefs does when a property file is
+ * opened, so provider can be exercised w/o FUSE.
+ *
+ * Provider is loaded and should be used in the thread its loader
+ * expects, for Qt providers it is the thread with
+ * QCoreApplication. Change handler is called synchronously from the
+ * provider setter.
+ */
+class ProviderHost
+{
+public:
+    typedef std::function<void (size_t, uint64_t)> handler_type;
+
+    static const size_t npos = static_cast<size_t>(-1);
+
+    struct Property
+    {
+        // "<namespace>.<property>"
+        std::string path;
+        statefs_property *prop;
+        int attr;
+    };
+
+    ProviderHost(std::string const &lib_path);
+    /// provider created in this process (e.g. by tests), it is
+    /// released by the host like loaded one
+    ProviderHost(statefs_provider *);
+    ~ProviderHost();
+
+    std::string const & path() const { return path_; }
+
+    size_t size() const { return props_.size(); }
+    Property const & property(size_t idx) const { return props_[idx]; }
+
+    /// @return property index or npos
+    size_t find(std::string const &path) const;
+
+    /// handler is called with the property index and the change
+    /// time (CLOCK_MONOTONIC), it should be set before connecting
+    void on_changed(handler_type const &);
+
+    /// subscribe to discrete property changes, @return false if
+    /// property is not discrete or provider refused connection
+    bool connect(size_t);
+
+    /// @return number of connected properties
+    size_t connect_all();
+    void disconnect_all();
+
+    /// current property value, it is read as statefs reads it
+    std::string read(size_t) const;
+
+    /// number of changes reported since connection or reset
+    uint64_t changes(size_t) const;
+    /// time of the last change or 0 if there were no changes
+    uint64_t last_change(size_t) const;
+    void reset_counters();
+
+private:
+    ProviderHost(ProviderHost const&);
+    ProviderHost & operator =(ProviderHost const&);
+
+    struct Slot;
+
+    void walk(statefs_branch const *, std::string const &prefix);
+    static void changed(statefs_slot *, statefs_property *);
+
+    std::string path_;
+    void *lib_;
+    statefs_server server_;
+    statefs_provider *provider_;
+    std::vector<Property> props_;
+    std::vector<std::unique_ptr<Slot> > slots_;
+    handler_type handler_;
+};
+
+}}
+
+#endif // _STATEFS_PROVIDERS_HOST_HPP_
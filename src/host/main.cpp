@@ -0,0 +1,326 @@
+#include "host.hpp"
+
+#include <QCoreApplication>
+#include <QSocketNotifier>
+#include <QTimer>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/signalfd.h>
+#include <unistd.h>
+
+using statefs::host::ProviderHost;
+using statefs::host::cpu_ns;
+using statefs::host::monotonic_ns;
+
+/*
+ * Runs the provider outside of the statefs server: all discrete
+ * properties are connected, changes are counted and (optionally)
+ * logged until the time is out or SIGINT/SIGTERM is received, then
+ * per-property statistics is printed. There is no FUSE and no other
+ * load in the process, so it can be run under perf, valgrind etc.
+ */
+
+namespace {
+
+struct Options
+{
+    Options() : loader("default"), duration_s(0), warmup_ms(0) {}
+
+    // the same loader names statefs uses: qt5 providers expect
+    // QCoreApplication event loop, default ones run their own threads
+    std::string loader;
+    unsigned duration_s;
+    unsigned warmup_ms;
+    std::string log_path;
+    std::string filter;
+    std::string lib;
+};
+
+struct Change
+{
+    uint64_t ns;
+    size_t idx;
+};
+
+/// change handler can be called from any provider thread
+class Recorder
+{
+public:
+    Recorder(size_t size, bool is_logging)
+        : is_logging_(is_logging)
+        , last_(size, 0)
+        , min_interval_(size, 0)
+    {}
+
+    void on_changed(size_t idx, uint64_t now)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto &last = last_[idx];
+        if (last) {
+            auto &min = min_interval_[idx];
+            auto interval = now - last;
+            if (!min || interval < min)
+                min = interval;
+        }
+        last = now;
+        if (is_logging_)
+            log_.push_back(Change{now, idx});
+    }
+
+    void reset()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::fill(last_.begin(), last_.end(), 0);
+        std::fill(min_interval_.begin(), min_interval_.end(), 0);
+        log_.clear();
+    }
+
+    uint64_t min_interval(size_t idx) const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return min_interval_[idx];
+    }
+
+    std::vector<Change> log() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return log_;
+    }
+
+private:
+    mutable std::mutex mutex_;
+    bool is_logging_;
+    std::vector<uint64_t> last_;
+    std::vector<uint64_t> min_interval_;
+    std::vector<Change> log_;
+};
+
+/// @return signalfd for SIGINT and SIGTERM, signals are blocked
+/// before provider threads are started, so they inherit the mask
+int block_signals()
+{
+    sigset_t mask;
+    ::sigemptyset(&mask);
+    ::sigaddset(&mask, SIGINT);
+    ::sigaddset(&mask, SIGTERM);
+    if (::pthread_sigmask(SIG_BLOCK, &mask, nullptr))
+        return -1;
+    return ::signalfd(-1, &mask, SFD_CLOEXEC);
+}
+
+typedef std::function<void ()> action_type;
+
+void run_qt(Options const &opts, int sig_fd, int argc, char *argv[]
+            , action_type const &start, action_type const &warmed_up
+            , action_type const &finish)
+{
+    QCoreApplication app(argc, argv);
+    QSocketNotifier notifier(sig_fd, QSocketNotifier::Read);
+    QObject::connect(&notifier, &QSocketNotifier::activated
+                     , &app, &QCoreApplication::quit);
+    QTimer warmup, timeout;
+    warmup.setSingleShot(true);
+    QObject::connect(&warmup, &QTimer::timeout, warmed_up);
+    timeout.setSingleShot(true);
+    QObject::connect(&timeout, &QTimer::timeout
+                     , &app, &QCoreApplication::quit);
+
+    start();
+    warmup.start(opts.warmup_ms);
+    if (opts.duration_s)
+        timeout.start(opts.warmup_ms + opts.duration_s * 1000);
+    app.exec();
+    // Qt provider objects should be destroyed while application
+    // exists
+    finish();
+}
+
+void wait_signal(int sig_fd, int timeout_ms)
+{
+    pollfd fds = {sig_fd, POLLIN, 0};
+    auto end = monotonic_ns() + uint64_t(timeout_ms) * 1000000;
+    while (true) {
+        auto now = monotonic_ns();
+        if (timeout_ms >= 0 && now >= end)
+            return;
+        auto left = timeout_ms >= 0
+            ? static_cast<int>((end - now + 999999) / 1000000) : -1;
+        auto rc = ::poll(&fds, 1, left);
+        if (rc > 0 || (rc < 0 && errno != EINTR))
+            return;
+    }
+}
+
+void report(ProviderHost const &host, Recorder const &rec, uint64_t wall_ns
+            , uint64_t cpu)
+{
+    std::vector<size_t> order;
+    uint64_t total = 0;
+    for (size_t i = 0; i < host.size(); ++i) {
+        auto changes = host.changes(i);
+        total += changes;
+        if (changes)
+            order.push_back(i);
+    }
+    // properties churning most are on the top
+    std::stable_sort(order.begin(), order.end(), [&host](size_t a, size_t b) {
+            return host.changes(a) > host.changes(b);
+        });
+
+    auto seconds = wall_ns / 1e9;
+    ::printf("%s: %.3f s, %llu changes, cpu %.1f ms (%.2f%%)\n"
+             , host.path().c_str(), seconds
+             , static_cast<unsigned long long>(total), cpu / 1e6
+             , wall_ns ? 100.0 * cpu / wall_ns : 0.0);
+    ::printf("%-48s %10s %10s %12s\n", "property", "changes", "per sec"
+             , "min gap, ms");
+    for (auto i : order) {
+        auto changes = host.changes(i);
+        ::printf("%-48s %10llu %10.2f %12.3f\n"
+                 , host.property(i).path.c_str()
+                 , static_cast<unsigned long long>(changes)
+                 , seconds > 0 ? changes / seconds : 0.0
+                 , rec.min_interval(i) / 1e6);
+    }
+    ::fflush(stdout);
+}
+
+bool write_log(std::string const &path, ProviderHost const &host
+               , Recorder const &rec, uint64_t begin)
+{
+    std::ofstream out(path.c_str());
+    if (!out)
+        return false;
+    for (auto const &c : rec.log()) {
+        auto ns = c.ns > begin ? c.ns - begin : 0;
+        out << ns / 1000 << ' ' << host.property(c.idx).path << '\n';
+    }
+    return static_cast<bool>(out);
+}
+
+bool parse_options(int argc, char *argv[], Options &opts)
+{
+    int c;
+    while ((c = ::getopt(argc, argv, "l:t:w:o:p:")) != -1) {
+        switch (c) {
+        case 'l':
+            opts.loader = optarg;
+            break;
+        case 't':
+            opts.duration_s = ::atoi(optarg);
+            break;
+        case 'w':
+            opts.warmup_ms = ::atoi(optarg);
+            break;
+        case 'o':
+            opts.log_path = optarg;
+            break;
+        case 'p':
+            opts.filter = optarg;
+            break;
+        default:
+            return false;
+        }
+    }
+    if (argc - optind != 1
+        || (opts.loader != "default" && opts.loader != "qt5"))
+        return false;
+    opts.lib = argv[optind];
+    return true;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    Options opts;
+    if (!parse_options(argc, argv, opts)) {
+        std::cerr << "Usage: " << argv[0]
+                  << " [-l default|qt5] [-t seconds] [-w warmup_ms]"
+            " [-o changes.log] [-p property_substring] provider.so\n"
+            "Runs until timeout (-t) or SIGINT/SIGTERM" << std::endl;
+        return 1;
+    }
+
+    auto sig_fd = block_signals();
+    if (sig_fd < 0) {
+        std::cerr << "Can't block signals" << std::endl;
+        return 1;
+    }
+
+    std::unique_ptr<ProviderHost> host;
+    std::unique_ptr<Recorder> rec;
+    uint64_t begin = 0, cpu_before = 0;
+    size_t connected = 0;
+
+    // provider should be loaded in the event loop thread
+    auto start = [&]() {
+        host.reset(new ProviderHost(opts.lib));
+        rec.reset(new Recorder(host->size(), !opts.log_path.empty()));
+        auto recorder = rec.get();
+        host->on_changed([recorder](size_t idx, uint64_t now) {
+                recorder->on_changed(idx, now);
+            });
+        for (size_t i = 0; i < host->size(); ++i) {
+            if (host->property(i).path.find(opts.filter) != std::string::npos
+                && host->connect(i))
+                ++connected;
+        }
+        std::cerr << opts.lib << ": " << connected << " of " << host->size()
+                  << " properties connected, pid " << ::getpid() << std::endl;
+    };
+    // initial values are not accounted
+    auto on_warmed_up = [&]() {
+        host->reset_counters();
+        rec->reset();
+        begin = monotonic_ns();
+        cpu_before = cpu_ns();
+    };
+
+    int rc = 0;
+    auto finish = [&]() {
+        // interrupted during warm up
+        if (!begin)
+            on_warmed_up();
+        auto wall = monotonic_ns() - begin;
+        auto cpu = cpu_ns() - cpu_before;
+        host->disconnect_all();
+        report(*host, *rec, wall, cpu);
+        if (!opts.log_path.empty()
+            && !write_log(opts.log_path, *host, *rec, begin)) {
+            std::cerr << "Can't write " << opts.log_path << std::endl;
+            rc = 1;
+        }
+        host.reset();
+    };
+
+    try {
+        if (opts.loader == "qt5") {
+            run_qt(opts, sig_fd, argc, argv, start, on_warmed_up, finish);
+        } else {
+            start();
+            wait_signal(sig_fd, opts.warmup_ms);
+            on_warmed_up();
+            wait_signal(sig_fd, opts.duration_s
+                        ? static_cast<int>(opts.duration_s * 1000) : -1);
+            finish();
+        }
+    } catch (std::exception const &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return rc;
+}
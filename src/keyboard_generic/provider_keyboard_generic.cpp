@@ -1,4 +1,5 @@
 #include <statefs/property.hpp>
+#include <statefs/qt/readiness.hpp>
 #include <cor/util.hpp>
 #include <cor/udev.hpp>
 #include <cor/udev/util.hpp>
@@ -23,6 +24,9 @@ namespace cor {
 namespace asio = boost::asio;
 namespace udevpp = cor::udevpp;
 using cor::str;
+using statefs::qt::ProfilePhase;
+
+static char const *provider_name = "udev-keyboard";
 
 namespace statefs {
 
@@ -67,7 +71,7 @@ enum class KeyboardProp {
 class KeyboardNs : public BasicNamespace<KeyboardProp>
 {
 public:
-    KeyboardNs();
+    KeyboardNs(statefs::qt::readiness_ptr const &);
     ~KeyboardNs();
     virtual void release() { }
 
@@ -131,18 +135,35 @@ void Monitor::run()
     async_read_();
 }
 
-KeyboardNs::KeyboardNs()
+KeyboardNs::KeyboardNs(statefs::qt::readiness_ptr const &state)
     : BasicNamespace<KeyboardProp>("maemo_InternalKeyboard")
 {
     using namespace std::placeholders;
     auto fn = std::bind(&KeyboardNs::on_input_device, this, _1);
     mon_ = cor::make_unique<Monitor>(io_, root_, "input", fn);
-    for_each_device(root_, fn, "input");
-    mon_->run();
-    // monitor thread is started after read operation is queued
+    auto is_lazy = statefs::qt::is_lazy_init_enabled();
+    if (!is_lazy) {
+        ProfilePhase phase(provider_name, "enumeration");
+        for_each_device(root_, fn, "input");
+        mon_->run();
+    }
+    // monitor thread is started after read operation is queued, in
+    // the lazy mode devices are enumerated in the monitor thread
     monitor_thread_ = cor::make_unique<std::thread>
-        ([this]() {
+        ([this, fn, is_lazy, state]() {
             TRACE() << "Monitor thread is started" << std::endl;
+            if (is_lazy) {
+                try {
+                    ProfilePhase phase(provider_name, "enumeration");
+                    for_each_device(root_, fn, "input");
+                    mon_->run();
+                } catch (std::exception const &e) {
+                    std::cerr << "Keyboard monitor error: " << e.what()
+                              << std::endl;
+                    return;
+                }
+                state->set_ready();
+            }
             io_.run();
             TRACE() << "Monitor thread is exiting" << std::endl;
         });
@@ -179,10 +200,13 @@ class Provider : public statefs::AProvider
 {
 public:
     Provider(statefs_server *server)
-        : AProvider("udev-keyboard", server)
+        : AProvider(provider_name, server)
     {
-        auto ns = std::make_shared<KeyboardNs>();
+        auto state = std::make_shared<statefs::qt::ReadinessNamespace>
+            (provider_name);
+        auto ns = std::make_shared<KeyboardNs>(state);
         insert(std::static_pointer_cast<statefs::ANode>(ns));
+        insert(std::static_pointer_cast<statefs::ANode>(state));
     }
 
     virtual ~Provider()
@@ -203,6 +227,7 @@ static inline Provider *init_provider(statefs_server *server)
 {
     if (provider)
         throw std::logic_error("provider ptr is already set");
+    ProfilePhase phase(provider_name, "load");
     provider = new Provider(server);
     return provider;
 }
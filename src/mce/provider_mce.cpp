@@ -26,6 +26,7 @@
 #include <math.h>
 #include <iostream>
 #include <statefs/qt/dbus.hpp>
+#include <statefs/qt/profile.hpp>
 
 #include <mce/dbus-names.h> // from mce-dev
 #include <mce/mode-names.h> // from mce-dev
@@ -34,14 +35,18 @@ namespace statefs { namespace mce {
 
 using statefs::qt::Namespace;
 using statefs::qt::PropertiesSource;
-using statefs::qt::sync;
+using statefs::qt::ProfilePhase;
+using statefs::qt::Transaction;
+using statefs::qt::future;
 
 static char const *service_name = "com.nokia.mce";
+static char const *provider_name = "mce";
 
 Bridge::Bridge(MceNs *ns, QDBusConnection &bus)
     : PropertiesSource(ns)
     , bus_(bus)
     , watch_(new ServiceWatch(bus, service_name))
+    , signals_(SignalDispatcher::get(bus, service_name))
 {
 }
 
@@ -50,7 +55,7 @@ void Bridge::init_request()
     MceNs *ns = static_cast<MceNs*>(target_);
 
     auto on_psm = [this](bool v) {
-        updateProperty("PowerSaveMode", v);
+        updateProperty(Prop::PowerSaveMode, v);
     };
     auto on_display = [this, ns](QString const& v) {
         qDebug() << "Display:" << v;
@@ -58,26 +63,39 @@ void Bridge::init_request()
     };
 
     auto on_radio = [this, ns](unsigned v) {
-        updateProperty("OfflineMode", (v & MCE_RADIO_STATE_CELLULAR) == 0);
-        updateProperty("WlanEnabled", (v & MCE_RADIO_STATE_WLAN) != 0);
-        updateProperty("InternetEnabled", (v & MCE_RADIO_STATE_MASTER) != 0);
+        Transaction<PropertiesSource> tx(this);
+        updateProperty(Prop::OfflineMode, (v & MCE_RADIO_STATE_CELLULAR) == 0);
+        updateProperty(Prop::WlanEnabled, (v & MCE_RADIO_STATE_WLAN) != 0);
+        updateProperty(Prop::InternetEnabled, (v & MCE_RADIO_STATE_MASTER) != 0);
     };
 
+    static char const *signal_path = "/com/nokia/mce/signal";
+    auto interface = MceSignal::staticInterfaceName();
+    subscriptions_.clear();
+    subscriptions_.push_back(signals_->subscribe<bool>
+                             (signal_path, interface, "psm_state_ind"
+                              , on_psm));
+    subscriptions_.push_back(signals_->subscribe<QString>
+                             (signal_path, interface, "display_status_ind"
+                              , on_display));
+    subscriptions_.push_back(signals_->subscribe<uint>
+                             (signal_path, interface, "radio_states_ind"
+                              , on_radio));
+
     request_.reset(new MceRequest(service_name, "/com/nokia/mce/request", bus_));
-    sync(request_->get_psm_state(), on_psm);
-    sync(request_->get_display_status(), on_display);
-    sync(request_->get_radio_states(), on_radio);
-    
-    signal_.reset(new MceSignal(service_name, "/com/nokia/mce/signal", bus_));
-    connect(signal_.get(), &MceSignal::psm_state_ind, on_psm);
-    connect(signal_.get(), &MceSignal::display_status_ind, on_display);
-    connect(signal_.get(), &MceSignal::radio_states_ind, on_radio);
+    auto ctx = request_.get();
+    future(ctx, request_->get_psm_state()
+           , "com.nokia.mce.request.get_psm_state").then(on_psm);
+    future(ctx, request_->get_display_status()
+           , "com.nokia.mce.request.get_display_status").then(on_display);
+    future(ctx, request_->get_radio_states()
+           , "com.nokia.mce.request.get_radio_states").then(on_radio);
 }
 
 void Bridge::init()
 {
     auto reset_all = [this]() {
-        signal_.reset();
+        subscriptions_.clear();
         request_.reset();
     };
     watch_->init([this]() { init_request(); }, reset_all);
@@ -85,18 +103,21 @@ void Bridge::init()
 }
 
 
+static constexpr statefs::qt::PropertyInfo system_schema[] = {
+    { "PowerSaveMode", "0" }
+    , { "OfflineMode", "0" }
+    , { "InternetEnabled", "1" }
+    , { "WlanEnabled", "0" }
+};
+static_assert(statefs::qt::is_valid_schema<Prop>(system_schema)
+              , "Check System properties schema");
+
 MceNs::MceNs(QDBusConnection &bus, std::shared_ptr<ScreenNs> const &screen)
     : Namespace("System", std::unique_ptr<PropertiesSource>
                 (new Bridge(this, bus)))
     , screen_(screen)
-    , defaults_({{"PowerSaveMode", "0"}
-            , {"OfflineMode", "0"}
-            , {"InternetEnabled", "1"}
-            , {"WlanEnabled", "0"}})
 {
-    for (auto v : defaults_)
-        addProperty(v.first, v.second);
-    src_->init();
+    addProperties(system_schema);
 }
 
 void MceNs::set_blanked(bool v)
@@ -104,23 +125,26 @@ void MceNs::set_blanked(bool v)
     screen_->set_blanked(v);
 }
 
+static constexpr statefs::qt::PropertyInfo screen_schema[] = {
+    { "Blanked", "0" }
+};
+static_assert(statefs::qt::is_valid_schema<ScreenProp>(screen_schema)
+              , "Check Screen properties schema");
+
 ScreenNs::ScreenNs()
-    : Namespace("Screen")
+    : Namespace("Screen", std::unique_ptr<PropertiesSource>())
 {
-    auto d = statefs::Discrete("Blanked", "0");
-    auto prop = statefs::create(d);
-    *this << prop;
-    set_blanked_ = setter(prop);
+    addProperties(screen_schema);
 }
 
 void ScreenNs::set_blanked(bool v)
 {
-    set_blanked_(v ? "1" : "0");
+    updateProperty(ScreenProp::Blanked, v);
 }
 
 void MceNs::reset_properties()
 {
-    setProperties(defaults_);
+    setDefaults();
 }
 
 class Provider;
@@ -130,13 +154,16 @@ class Provider : public statefs::AProvider
 {
 public:
     Provider(statefs_server *server)
-        : AProvider("mce", server)
+        : AProvider(provider_name, server)
         , bus_(QDBusConnection::systemBus())
     {
         auto screen_ns = std::make_shared<ScreenNs>();
         auto ns = std::make_shared<MceNs>(bus_, screen_ns);
         insert(std::static_pointer_cast<statefs::ANode>(ns));
         insert(std::static_pointer_cast<statefs::ANode>(screen_ns));
+        screen_ns->followSource(ns);
+        statefs::qt::insert_diagnostics
+            (*this, *ns, provider_name, service_name);
     }
     virtual ~Provider() {}
 
@@ -153,6 +180,7 @@ private:
 
 static inline Provider *init_provider(statefs_server *server)
 {
+    ProfilePhase phase(provider_name, "load");
     if (provider)
         throw std::logic_error("provider ptr is already set");
     provider = new Provider(server);
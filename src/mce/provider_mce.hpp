@@ -7,6 +7,7 @@
 #include <statefs/property.hpp>
 #include <statefs/qt/ns.hpp>
 #include <statefs/qt/dbus.hpp>
+#include <statefs/qt/dispatcher.hpp>
 
 #include <map>
 #include <QDBusConnection>
@@ -19,9 +20,21 @@ namespace statefs { namespace mce {
 typedef ComNokiaMceRequestInterface MceRequest;
 typedef ComNokiaMceSignalInterface MceSignal;
 using statefs::qt::ServiceWatch;
+using statefs::qt::SignalDispatcher;
+using statefs::qt::Subscription;
 
 class MceNs;
 
+// System namespace properties, see the schema in provider_mce.cpp
+enum class Prop {
+    PowerSaveMode, OfflineMode, InternetEnabled, WlanEnabled, EOE
+};
+
+// Screen namespace properties, see the schema in provider_mce.cpp
+enum class ScreenProp {
+    Blanked, EOE
+};
+
 class Bridge : public QObject, public statefs::qt::PropertiesSource
 {
     Q_OBJECT;
@@ -37,8 +50,9 @@ private:
 
     QDBusConnection &bus_;
     std::unique_ptr<ServiceWatch> watch_;
+    std::shared_ptr<SignalDispatcher> signals_;
     std::unique_ptr<MceRequest> request_;
-    std::unique_ptr<MceSignal> signal_;
+    std::vector<Subscription> subscriptions_;
 };
 
 class ScreenNs;
@@ -54,20 +68,18 @@ private:
     void reset_properties();
 
     std::shared_ptr<ScreenNs> screen_;
-    statefs::qt::DefaultProperties defaults_;
 };
 
-class ScreenNs : public statefs::Namespace
+/// Screen namespace is updated by the System namespace source, so
+/// its readers also start it (see followSource())
+class ScreenNs : public statefs::qt::Namespace
 {
 public:
     ScreenNs();
     virtual ~ScreenNs() {}
-    virtual void release() { }
 private:
     friend class MceNs;
     void set_blanked(bool);
-
-    statefs::setter_type set_blanked_;
 };
 
 }}
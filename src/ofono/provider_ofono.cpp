@@ -27,6 +27,9 @@
 #include "provider_ofono.hpp"
 #include "dbus_types.hpp"
 #include <statefs/qt/dbus.hpp>
+#include <statefs/qt/objects.hpp>
+#include <statefs/qt/static_map.hpp>
+#include <statefs/qt/profile.hpp>
 
 #include <math.h>
 #include <iostream>
@@ -48,10 +51,17 @@ namespace statefs { namespace ofono {
 
 using statefs::qt::Namespace;
 using statefs::qt::PropertiesSource;
-using statefs::qt::sync;
+using statefs::qt::ProfilePhase;
+using statefs::qt::StaticMapEntry;
+using statefs::qt::Transaction;
+using statefs::qt::argument_future;
 using statefs::qt::async;
+using statefs::qt::find_object;
+using statefs::qt::future;
+using statefs::qt::make_static_map;
 
 static char const *service_name = "org.ofono";
+static char const *provider_name = "ofono";
 
 Interface& operator ++(Interface &v)
 {
@@ -105,7 +115,7 @@ static QDebug operator << (QDebug dst, interfaces_set_type const &src)
 
 #define MK_IFACE_ID(name) {#name, Interface::name}
 
-static const std::map<QString, Interface> interface_ids = {
+static constexpr StaticMapEntry<Interface> interface_entries[] = {
     MK_IFACE_ID(AssistedSatelliteNavigation),
     MK_IFACE_ID(AudioSettings),
     MK_IFACE_ID(CallBarring),
@@ -130,6 +140,8 @@ static const std::map<QString, Interface> interface_ids = {
     MK_IFACE_ID(TextTelephony),
     MK_IFACE_ID(VoiceCallManager)
 };
+static constexpr auto interface_ids = make_static_map(interface_entries);
+static_assert(interface_ids.is_perfect(), "Check interface names");
 
 static interfaces_set_type get_interfaces(QStringList const &from)
 {
@@ -138,12 +150,13 @@ static interfaces_set_type get_interfaces(QStringList const &from)
 
     interfaces_set_type res;
     for (auto const &v : from) {
-        if (v.left(prefix_len) != std_prefix)
+        if (!v.startsWith(std_prefix))
             continue;
 
-        auto p = interface_ids.find(v.mid(prefix_len));
-        if (p != interface_ids.end())
-            res.set((size_t)p->second);
+        auto p = interface_ids.find(v.constData() + prefix_len
+                                    , v.size() - prefix_len);
+        if (p)
+            res.set((size_t)*p);
     }
     return res;
 }
@@ -186,46 +199,12 @@ static State get_state_change(interfaces_set_type const &before
             : (to ? State::Set : State::Reset));
 }
 
-template <typename K, typename F, typename ... Args>
-void map_exec(std::map<K, F> const &fns, K const &k, Args&&... args)
+template <typename MapT, typename ... Args>
+void map_exec(MapT const &fns, QString const &k, Args&&... args)
 {
     auto pfn = fns.find(k);
-    if (pfn != fns.end())
-        pfn->second(std::forward<Args>(args)...);
-}
-
-template <typename K, typename F, typename AltFn, typename ... Args>
-void map_exec_or(std::map<K, F> const &fns, AltFn alt_fn, K const &k, Args&&... args)
-{
-    auto pfn = fns.find(k);
-    if (pfn != fns.end())
-        pfn->second(std::forward<Args>(args)...);
-    else
-        alt_fn(k, std::forward<Args>(args)...);
-}
-
-template <typename T, typename K, typename F, typename ... Args>
-void map_member_exec(T *self, std::map<K, F> const &fns, K const &k, Args&&... args)
-{
-    auto pfn = fns.find(k);
-    if (pfn != fns.end()) {
-        auto fn = pfn->second;
-        (self->*fn)(std::forward<Args>(args)...);
-    }
-}
-
-template <typename FnT>
-bool find_process_object(PathPropertiesArray const &src, FnT fn)
-{
-    for (auto it = src.begin(); it != src.end(); ++it) {
-        auto const &info = *it;
-        auto path = std::get<0>(info).path();
-        auto props = std::get<1>(info);
-
-        if (fn(path, props))
-            return true;
-    }
-    return false;
+    if (pfn)
+        (*pfn)(std::forward<Args>(args)...);
 }
 
 typedef Bridge::Status Status;
@@ -243,20 +222,21 @@ QDebug & operator << (QDebug &dst, Status src)
     return dst;
 }
 
-typedef std::map<QString, std::pair<char const *, char const *> > tech_map_type;
-typedef std::map<QString, Status> status_map_type;
+typedef std::pair<char const *, char const *> tech_dtech_type;
 typedef std::array<QString, size_t(Status::EOE)> status_array_type;
 
 
-static const tech_map_type tech_map_ = {
+static constexpr StaticMapEntry<tech_dtech_type> tech_entries[] = {
     {"gsm", {"gsm", "gprs"}}
     , {"edge", {"gsm", "egprs"}}
     , {"hspa", {"umts", "hspa"}}
     , {"umts", {"umts", "umts"}}
     , {"lte", {"lte", "lte"}}
 };
+static constexpr auto tech_map = make_static_map(tech_entries);
+static_assert(tech_map.is_perfect(), "Check technology names");
 
-static const status_map_type status_map_ = {
+static constexpr StaticMapEntry<Status> status_entries[] = {
     {"unregistered", Status::Offline}
     , {"registered", Status::Registered}
     , {"searching", Status::Searching}
@@ -264,11 +244,12 @@ static const status_map_type status_map_ = {
     , {"unknown", Status::Unknown}
     , {"roaming", Status::Roaming}
 };
+static constexpr auto status_map = make_static_map(status_entries);
+static_assert(status_map.is_perfect(), "Check status names");
 
 Status Bridge::map_status(QString const &name)
 {
-    auto it = status_map_.find(name);
-    return (it != status_map_.end()) ? it->second : Status::Offline;
+    return status_map.value(name, Status::Offline);
 }
 
 QString const & Bridge::ckit_status(Status status, SimPresent sim)
@@ -302,71 +283,89 @@ QString const & Bridge::ofono_status(Status status)
 // read in big endian
 static const std::bitset<size_t(Status::EOE)> status_registered_("1000100");
 
-static const std::map<QString, QString> sim_props_map_ = {
-    { "MobileCountryCode", "HomeMCC" }
-    , { "MobileNetworkCode", "HomeMNC" }
-    , { "SubscriberIdentity", "SubscriberIdentity" }
+// properties passed straight through, names are looked up in the
+// precomputed tables, so there is no need in per-property actions
+static const statefs::qt::PropertyRoutes sim_routes = {
+    { "MobileCountryCode", Prop::HomeMCC }
+    , { "MobileNetworkCode", Prop::HomeMNC }
+    , { "SubscriberIdentity", Prop::SubscriberIdentity }
 };
 
-static const std::map<QString, QString> stk_props_map_ = {
-    { "IdleModeText", "StkIdleModeText" }
+static const statefs::qt::PropertyRoutes stk_routes = {
+    { "IdleModeText", Prop::StkIdleModeText }
 };
 
-static Bridge::property_action_type direct_update(QString const &name)
+static const statefs::qt::PropertyRoutes net_routes = {
+    { "MobileCountryCode", Prop::CurrentMCC }
+    , { "MobileNetworkCode", Prop::CurrentMNC }
+    , { "CellId", Prop::CellName }
+};
+
+static const statefs::qt::PropertyRoutes connman_routes = {
+    { "RoamingAllowed", Prop::DataRoamingAllowed }
+};
+
+static void on_net_name(Bridge *self, QVariant const &v)
 {
-    return [name](Bridge *self, QVariant const &v) {
-        self->updateProperty(name, v);
-    };
+    self->set_network_name(v);
 }
 
-static Bridge::property_action_type bind_member
-(void (Bridge::*fn)(QVariant const&))
+static void on_net_strength(Bridge *self, QVariant const &v)
 {
-    using namespace std::placeholders;
-    return [fn](Bridge *self, QVariant const &v) {
-        (self->*fn)(v);
-    };
+    auto strength = v.toUInt();
+    Transaction<PropertiesSource> tx(self);
+    self->updateProperty(Prop::SignalStrength, strength);
+    // 0-5
+    self->updateProperty(Prop::SignalBars, (strength + 19) / 20);
 }
 
-const Bridge::property_map_type Bridge::net_property_actions_ = {
-    { "Name", bind_member(&Bridge::set_network_name)}
-    , { "Strength", [](Bridge *self, QVariant const &v) {
-            auto strength = v.toUInt();
-            self->updateProperty("SignalStrength", strength);
-            // 0-5
-            self->updateProperty("SignalBars", (strength + 19) / 20);
-        } }
-    , { "Status", [](Bridge *self, QVariant const &v) {
-            qDebug() << "Ofono status " << v.toString();
-            self->updateProperty("Status", v);
-            self->set_status(self->map_status(v.toString()));
-        } }
-    , { "MobileCountryCode", direct_update("CurrentMCC") }
-    , { "MobileNetworkCode", direct_update("CurrentMNC") }
-    , { "CellId", direct_update("CellName") }
-    , { "Technology", [](Bridge *self, QVariant const &v) {
-            auto tech = v.toString();
-            auto pt = tech_map_.find(tech);
-            if (pt != tech_map_.end()) {
-                auto tech_dtech = pt->second;
-                self->updateProperty("Technology", tech_dtech.first);
-                self->updateProperty("DataTechnology", tech_dtech.second);
-            }
-        } }
-};
+static void on_net_status(Bridge *self, QVariant const &v)
+{
+    qDebug() << "Ofono status " << v.toString();
+    self->updateProperty(Prop::Status, v);
+    self->set_status(self->map_status(v.toString()));
+}
 
-const Bridge::property_map_type Bridge::operator_property_actions_ = {
-    { "Name", bind_member(&Bridge::set_operator_name)}
+static void on_net_technology(Bridge *self, QVariant const &v)
+{
+    auto pt = tech_map.find(v.toString());
+    if (pt) {
+        Transaction<PropertiesSource> tx(self);
+        self->updateProperty(Prop::Technology, pt->first);
+        self->updateProperty(Prop::DataTechnology, pt->second);
+    }
+}
+
+static void on_operator_name(Bridge *self, QVariant const &v)
+{
+    self->set_operator_name(v);
+}
+
+typedef void (*property_action_type)(Bridge *, QVariant const&);
+
+static constexpr StaticMapEntry<property_action_type> net_actions[] = {
+    { "Name", &on_net_name }
+    , { "Strength", &on_net_strength }
+    , { "Status", &on_net_status }
+    , { "Technology", &on_net_technology }
 };
+static constexpr auto net_property_actions = make_static_map(net_actions);
+static_assert(net_property_actions.is_perfect()
+              , "Check network property names");
 
-const Bridge::property_map_type Bridge::connman_property_actions_ = {
-    { "RoamingAllowed", direct_update("DataRoamingAllowed") }
+static constexpr StaticMapEntry<property_action_type> operator_actions[] = {
+    { "Name", &on_operator_name }
 };
+static constexpr auto operator_property_actions
+= make_static_map(operator_actions);
+static_assert(operator_property_actions.is_perfect()
+              , "Check operator property names");
 
 Bridge::Bridge(MainNs *ns, QDBusConnection &bus)
     : PropertiesSource(ns)
     , bus_(bus)
     , watch_(bus, service_name)
+    , signals_(statefs::qt::SignalDispatcher::get(bus, service_name))
     , sim_present_(SimPresent::Unknown)
     , status_(Status::Unknown)
     , network_name_{"", ""}
@@ -391,8 +390,9 @@ void Bridge::set_name_home()
     auto name = network_name_.first;
     if (!name.size())
         name = network_name_.second;
-    updateProperty("NetworkName", name);
-    updateProperty("ExtendedNetworkName", name);
+    Transaction<PropertiesSource> tx(this);
+    updateProperty(Prop::NetworkName, name);
+    updateProperty(Prop::ExtendedNetworkName, name);
 }
 
 void Bridge::set_name_roaming()
@@ -400,8 +400,9 @@ void Bridge::set_name_roaming()
     auto name = network_name_.first;
     if (!name.size())
         name = network_name_.second;
-    updateProperty("NetworkName", name);
-    updateProperty("ExtendedNetworkName", name);
+    Transaction<PropertiesSource> tx(this);
+    updateProperty(Prop::NetworkName, name);
+    updateProperty(Prop::ExtendedNetworkName, name);
 }
 
 void Bridge::set_status(Status new_status)
@@ -422,7 +423,7 @@ void Bridge::set_status(Status new_status)
     auto was_registered = is_set(status_registered_, status_);
     auto is_changed = (was_registered != is_registered);
 
-    updateProperty("RegistrationStatus", ckit_status(new_status, sim_present_));
+    updateProperty(Prop::RegistrationStatus, ckit_status(new_status, sim_present_));
 
     status_ = new_status;
     if (is_changed) {
@@ -451,13 +452,14 @@ void Bridge::update_mms_context()
             break;
         }
     }
-    updateProperty("MMSContext", mmsContext_);
+    updateProperty(Prop::MMSContext, mmsContext_);
     DBG() << "updated MMS context" << mmsContext_;
 }
 
 void Bridge::reset_props()
 {
     static const auto status = Status::Offline;
+    Transaction<PropertiesSource> tx(this);
     set_status(status);
     static_cast<MainNs*>(target_)->resetProperties(status, sim_present_);
 }
@@ -494,7 +496,7 @@ void Bridge::reset_stk()
     qDebug() << "Reset sim toolkit properties";
     stk_.reset();
     interfaces_.reset((size_t)Interface::SimToolkit);
-    updateProperty("StkIdleModeText", "");
+    updateProperty(Prop::StkIdleModeText, "");
 }
 
 void Bridge::process_interfaces(QStringList const &v)
@@ -566,10 +568,8 @@ bool Bridge::setup_modem(QString const &path, QVariantMap const &props)
     modem_.reset(new Modem(service_name, path, bus_));
     modem_path_ = path;
 
-    connect(modem_.get(), &Modem::PropertyChanged
-            , [update](QString const &n, QDBusVariant const &v) {
-                update(n, v.variant());
-            });
+    signals_->subscribe_property_changed
+        (modem_.get(), path, Modem::staticInterfaceName(), update);
     for (auto it = props.begin(); it != props.end(); ++it)
         update(it.key(), it.value());
     return true;
@@ -581,7 +581,7 @@ void Bridge::set_sim_presence(SimPresent v)
         return;
 
     sim_present_ = v;
-    updateProperty("Sim", sim_presence_name(v));
+    updateProperty(Prop::Sim, sim_presence_name(v));
     if (sim_present_ == SimPresent::No) {
         qDebug() << "Ofono: no sim";
         set_status(Status::Offline);
@@ -609,15 +609,13 @@ bool Bridge::setup_operator(QString const &path, QVariantMap const &props)
         if (sim_present_ == SimPresent::No)
             qDebug() << "No sim, operator property" << n << "->" << v;
 
-        map_exec(operator_property_actions_, n, this, v);
+        map_exec(operator_property_actions, n, this, v);
     };
 
     operator_.reset(new Operator(service_name, path, bus_));
     operator_path_ = path;
-    connect(operator_.get(), &Operator::PropertyChanged
-            , [update](QString const &n, QDBusVariant const &v) {
-                update(n, v.variant());
-            });
+    signals_->subscribe_property_changed
+        (operator_.get(), path, Operator::staticInterfaceName(), update);
     for (auto it = props.begin(); it != props.end(); ++it)
         update(it.key(), it.value());
     return true;
@@ -627,31 +625,44 @@ void Bridge::init()
 {
     qDebug() << "Establish connection with ofono";
 
-    auto process_modems = [this](PathPropertiesArray const &modems) {
+    auto process_modems = [this](QDBusArgument const &modems) {
         if (!manager_) {
             qDebug() << "Manager is reset, do not enumerate modems";
             return;
         }
-        qDebug() << "There is(are) " << modems.size() << " modems";
-        if (!modems.size())
+        static const QStringList keys = {"Type", "Interfaces", "Powered"};
+        size_t count = 0;
+        find_object(modems, keys, [this, &count]
+                    (QString const &path, QVariantMap const &props) {
+                        ++count;
+                        return setup_modem(path, props);
+                    });
+        qDebug() << "Processed" << count << "modem(s)";
+        if (!count)
             return;
 
-        using namespace std::placeholders;
-        connect(manager_.get(), &Manager::ModemAdded
-                , [this](QDBusObjectPath const &n, QVariantMap const&p) {
-                    setup_modem(n.path(), p);
-                });
-        connect(manager_.get(), &Manager::ModemRemoved
-                , [this](QDBusObjectPath const &n) {
-                    if (n.path() == modem_path_)
-                        reset_modem();
-                });
-        find_process_object(modems, std::bind(&Bridge::setup_modem, this, _1, _2));
+        auto ctx = manager_.get();
+        auto interface = Manager::staticInterfaceName();
+        signals_->subscribe<QDBusObjectPath, QVariantMap>
+            (ctx, "/", interface, "ModemAdded"
+             , [this](QDBusObjectPath const &n, QVariantMap const&p) {
+                setup_modem(n.path(), p);
+            });
+        signals_->subscribe<QDBusObjectPath>
+            (ctx, "/", interface, "ModemRemoved"
+             , [this](QDBusObjectPath const &n) {
+                if (n.path() == modem_path_)
+                    reset_modem();
+            });
     };
 
     auto connect_manager = [this, process_modems]() {
-        manager_.reset(new Manager(service_name, "/", bus_));
-        async(this, manager_->GetModems(), process_modems);
+        {
+            ProfilePhase phase(provider_name, "Manager proxy");
+            manager_.reset(new Manager(service_name, "/", bus_));
+        }
+        argument_future(manager_.get(), manager_->GetModems()
+                        , "org.ofono.Manager.GetModems").then(process_modems);
     };
 
     auto reset_manager = [this]() {
@@ -667,6 +678,10 @@ void Bridge::init()
         reset_props();
     };
     watch_.init(connect_manager, reset_manager);
+    // ofono restart should not cause two waves of changes
+    watch_.set_policy(ServiceWatch::hold_values_policy()
+                      , [this]() { beginUpdate(); }
+                      , [this]() { commitUpdate(); });
     connect_manager();
 }
 
@@ -678,16 +693,15 @@ void Bridge::setup_network(QString const &path)
         if (sim_present_ == SimPresent::No)
             qDebug() << "No sim, network prop" << n << "->" << v;
 
-        map_exec(net_property_actions_, n, this, v);
+        if (!updateProperty(net_routes, n, v))
+            map_exec(net_property_actions, n, this, v);
     };
 
     network_.reset(new Network(service_name, path, bus_));
 
     DBG() << "Connect Network::PropertyChanged";
-    connect(network_.get(), &Network::PropertyChanged
-            , [update](QString const &n, QDBusVariant const &v) {
-                update(n, v.variant());
-            });
+    signals_->subscribe_property_changed
+        (network_.get(), path, Network::staticInterfaceName(), update);
 
     auto process_props = [this, update](QVariantMap const &props) {
         if (!network_) {
@@ -698,35 +712,35 @@ void Bridge::setup_network(QString const &path)
             update(it.key(), it.value());
         enumerate_operators();
     };
-    async(this, network_->GetProperties(), process_props);
+    async(this, network_->GetProperties(), process_props
+          , "org.ofono.NetworkRegistration.GetProperties");
 }
 
 void Bridge::setup_stk(QString const &path)
 {
+    if (!hasReaders(Prop::StkIdleModeText)) {
+        qDebug() << "SimToolkit properties are not used";
+        return;
+    }
     qDebug() << "Get SimToolkit properties";
     auto update = [this](QString const &n, QVariant const &v) {
         DBG() << "SimToolkit: prop" << n << "=" << v;
         if (sim_present_ == SimPresent::No)
             DBG() << "No sim, SimToolkit prop" << n << "->" << v;
-        auto it = stk_props_map_.find(n);
-        if (it != stk_props_map_.end())
-            updateProperty(it->second, v);
+        updateProperty(stk_routes, n, v);
     };
 
     stk_.reset(new SimToolkit(service_name, path, bus_));
-    connect(stk_.get(), &SimToolkit::PropertyChanged
-            , [update](QString const &n, QDBusVariant const &v) {
-                update(n, v.variant());
-            });
-    auto res = sync(stk_->GetProperties());
-    if (res.isError()) {
-        qWarning() << "SimToolkit GetProperties error:" << res.error();
-        return;
-    }
-
-    auto props = res.value();
-    for (auto it = props.begin(); it != props.end(); ++it)
-        update(it.key(), it.value());
+    signals_->subscribe_property_changed
+        (stk_.get(), path, SimToolkit::staticInterfaceName(), update);
+    future(stk_.get(), stk_->GetProperties()
+           , "org.ofono.SimToolkit.GetProperties")
+        .then([update](QVariantMap const &props) {
+                for (auto it = props.begin(); it != props.end(); ++it)
+                    update(it.key(), it.value());
+            }).on_error([](QDBusError const &err) {
+                    qWarning() << "SimToolkit GetProperties error:" << err;
+                });
 }
 
 void Bridge::reset_connectionManager()
@@ -734,7 +748,7 @@ void Bridge::reset_connectionManager()
     qDebug() << "Reset connection manager";
     connectionManager_.reset();
     interfaces_.reset((size_t)Interface::ConnectionManager);
-    connectionContexts_.clear();
+    reset_contexts();
     update_mms_context();
 }
 
@@ -744,67 +758,125 @@ void Bridge::setup_connectionManager(QString const &path)
 
     auto update = [this](QString const &n, QVariant const &v) {
         DBG() << "CM prop: " << n << "=" << v;
-        map_exec(connman_property_actions_, n, this, v);
+        updateProperty(connman_routes, n, v);
     };
 
-    auto contextAdded = [this](QDBusObjectPath const &c, QVariantMap const &m) {
-        DBG() << "CM: context added" << c.path() << "=" << m;
-
-        const QString &contextPath = c.path();
-        ConnectionCache &connection = connectionContexts_[contextPath];
-        connection.context.reset(new ConnectionContext(service_name, contextPath, bus_));
+    connectionManager_.reset(new ConnectionManager(service_name, path, bus_));
 
-        connect(connection.context.get(), &ConnectionContext::PropertyChanged
-                , [this,contextPath](QString const &p, QDBusVariant const &v) {
-                    connectionContexts_[contextPath].properties.insert(p, v.variant());
-                    update_mms_context();
-                });
+    signals_->subscribe_property_changed
+        (connectionManager_.get(), path
+         , ConnectionManager::staticInterfaceName(), update);
 
-        connection.properties = m;
-        update_mms_context();
+    auto on_props = [update](QVariantMap const &props) {
+        for (auto it = props.begin(); it != props.end(); ++it)
+            update(it.key(), it.value());
     };
+    auto cm = connectionManager_.get();
+    future(cm, cm->GetProperties(), "org.ofono.ConnectionManager.GetProperties")
+        .then(on_props)
+        .on_error([](QDBusError const &err) {
+                qWarning() << "ConnectionManager GetProperties error:" << err;
+            });
+    setup_contexts(path);
+}
 
-    auto contextRemoved = [this](QDBusObjectPath const &c) {
-        DBG() << "CM: context removed" << c.path();
-        connectionContexts_.erase(c.path());
-        update_mms_context();
-    };
+void Bridge::add_context(QString const &path, QVariantMap const &props)
+{
+    DBG() << "CM: context added" << path << "=" << props;
+
+    ConnectionCache &connection = connectionContexts_[path];
+    connection.signal = signals_->subscribe_property_changed
+        (path, ConnectionContext::staticInterfaceName()
+         , [this, path](QString const &p, QVariant const &v) {
+            connectionContexts_[path].properties.insert(p, v);
+            update_mms_context();
+        });
 
-    connectionManager_.reset(new ConnectionManager(service_name, path, bus_));
+    connection.properties = props;
+}
 
-    connect(connectionManager_.get(), &ConnectionManager::PropertyChanged
-            , [update](QString const &n, QDBusVariant const &v) {
-                update(n, v.variant());
-            });
-    connect(connectionManager_.get(), &ConnectionManager::ContextAdded
-            , [contextAdded](QDBusObjectPath const &c, QVariantMap const &m) {
-                contextAdded(c, m);
-            });
-    connect(connectionManager_.get(), &ConnectionManager::ContextRemoved
-            , [contextRemoved](QDBusObjectPath const &c) {
-                contextRemoved(c);
-            });
+void Bridge::reset_contexts()
+{
+    context_added_.reset();
+    context_removed_.reset();
+    connectionContexts_.clear();
+}
 
-    auto res = sync(connectionManager_->GetProperties());
-    if (res.isError()) {
-        qWarning() << "ConnectionManager GetProperties error:" << res.error();
+// contexts are tracked only to find MMS context, so there are no
+// subscriptions to contexts until somebody reads MMSContext
+void Bridge::setup_contexts(QString const &path)
+{
+    if (!hasReaders(Prop::MMSContext)) {
+        qDebug() << "Connection contexts are not used";
         return;
     }
-    auto props = res.value();
-    for (auto it = props.begin(); it != props.end(); ++it)
-        update(it.key(), it.value());
-
-    auto contexts_res = sync(connectionManager_->GetContexts());
-    if (contexts_res.isError()) {
-        qWarning() << "ConnectionManager GetContexts error:" << contexts_res.error();
+    if (!connectionManager_) {
+        qWarning() << "No connection manager to get contexts from";
         return;
     }
+    qDebug() << "Setup connection contexts" << path;
+
+    auto interface = ConnectionManager::staticInterfaceName();
+    context_added_ = signals_->subscribe<QDBusObjectPath, QVariantMap>
+        (path, interface, "ContextAdded"
+         , [this](QDBusObjectPath const &c, QVariantMap const &m) {
+            add_context(c.path(), m);
+            update_mms_context();
+        });
+    context_removed_ = signals_->subscribe<QDBusObjectPath>
+        (path, interface, "ContextRemoved"
+         , [this](QDBusObjectPath const &c) {
+            DBG() << "CM: context removed" << c.path();
+            connectionContexts_.erase(c.path());
+            update_mms_context();
+        });
 
-    auto contexts = contexts_res.value();
-    DBG() << "Got contexts" << contexts.count();
-    for (auto it = contexts.begin(); it != contexts.end(); ++it) {
-        auto const &info = *it;
-        contextAdded(std::get<0>(info), std::get<1>(info));
+    auto on_contexts = [this](QDBusArgument const &contexts) {
+        if (!context_added_.is_active()) {
+            qDebug() << "Contexts are not tracked anymore";
+            return;
+        }
+        // only properties used to find MMS context are cached
+        static const QStringList keys = {"Type", "MessageCenter"};
+        find_object(contexts, keys, [this](QString const &path
+                                           , QVariantMap const &props) {
+                        add_context(path, props);
+                        return false;
+                    });
+        update_mms_context();
+    };
+    auto cm = connectionManager_.get();
+    argument_future(cm, cm->GetContexts()
+                    , "org.ofono.ConnectionManager.GetContexts")
+        .then(on_contexts)
+        .on_error([](QDBusError const &err) {
+                qWarning() << "ConnectionManager GetContexts error:" << err;
+            });
+}
+
+void Bridge::readersChanged(size_t idx, bool has_readers)
+{
+    switch (static_cast<Prop>(idx)) {
+    case Prop::StkIdleModeText:
+        if (!has_readers) {
+            qDebug() << "Detach from SimToolkit";
+            stk_.reset();
+            resetProperty(Prop::StkIdleModeText);
+        } else if (is_set(interfaces_, Interface::SimToolkit) && !stk_) {
+            setup_stk(modem_path_);
+        }
+        break;
+    case Prop::MMSContext:
+        if (!has_readers) {
+            qDebug() << "Detach from connection contexts";
+            reset_contexts();
+            resetProperty(Prop::MMSContext);
+        } else if (connectionManager_ && !context_added_.is_active()) {
+            setup_contexts(modem_path_);
+        }
+        break;
+    default:
+        break;
     }
 }
 
@@ -814,16 +886,20 @@ void Bridge::enumerate_operators()
         qWarning() << "Can't enumerate operators, network is null";
         return;
     }
-    auto process_operators = [this](PathPropertiesArray const &ops) {
+    auto process_operators = [this](QDBusArgument const &ops) {
         if (!network_) {
             qDebug() << "network is null, skip operators";
             return;
         }
+        // only the current operator is used
+        static const QStringList keys = {"Name", "Status"};
         using namespace std::placeholders;
         auto process = std::bind(&Bridge::setup_operator, this, _1, _2);
-        find_process_object(ops, process);
+        find_object(ops, keys, process);
     };
-    async(this, network_->GetOperators(), process_operators);
+    argument_future(this, network_->GetOperators()
+                    , "org.ofono.NetworkRegistration.GetOperators")
+        .then(process_operators);
 }
 
 void Bridge::setup_sim(QString const &path)
@@ -834,38 +910,63 @@ void Bridge::setup_sim(QString const &path)
         if (n == "Present") {
             set_sim_presence(v.toBool() ? SimPresent::Yes : SimPresent::No);
         } else {
-            auto it = sim_props_map_.find(n);
-            if (it != sim_props_map_.end())
-                updateProperty(it->second, v);
+            updateProperty(sim_routes, n, v);
         }
     };
     sim_.reset(new SimManager(service_name, path, bus_));
-    connect(sim_.get(), &SimManager::PropertyChanged
-            , [update](QString const &n, QDBusVariant const &v) {
-                update(n, v.variant());
-            });
+    signals_->subscribe_property_changed
+        (sim_.get(), path, SimManager::staticInterfaceName(), update);
 
-    auto res = sync(sim_->GetProperties());
-    if (res.isError()) {
-        qWarning() << "Sim GetProperties error:" << res.error();
-        return;
-    }
-    auto props = res.value();
-    for (auto it = props.begin(); it != props.end(); ++it)
-        update(it.key(), it.value());
+    auto on_props = [this, update](QVariantMap const &props) {
+        for (auto it = props.begin(); it != props.end(); ++it)
+            update(it.key(), it.value());
 
-    if (is_set(interfaces_, Interface::SimToolkit))
-        setup_stk(modem_path_);
+        // toolkit can be already set up by process_interfaces()
+        if (is_set(interfaces_, Interface::SimToolkit) && !stk_)
+            setup_stk(modem_path_);
+    };
+    future(sim_.get(), sim_->GetProperties()
+           , "org.ofono.SimManager.GetProperties")
+        .then(on_props)
+        .on_error([](QDBusError const &err) {
+                qWarning() << "Sim GetProperties error:" << err;
+            });
 }
 
 void MainNs::resetProperties(Bridge::Status status, SimPresent sim)
 {
     qDebug() << "Reset properties";
-    setProperties(defaults_);
-    updateProperty("RegistrationStatus", Bridge::ckit_status(status, sim));
-    updateProperty("Sim", sim_presence_name(sim));
+    Transaction<Namespace> tx(this);
+    setDefaults();
+    updateProperty(Prop::RegistrationStatus, Bridge::ckit_status(status, sim));
+    updateProperty(Prop::Sim, sim_presence_name(sim));
 }
 
+static constexpr statefs::qt::PropertyInfo cellular_schema[] = {
+    // contextkit props, defaults are for the offline status and
+    // unknown sim presence
+    { "RegistrationStatus", "no-sim" }
+    , { "Sim", "" }
+    , { "SignalStrength", "0"}
+    , { "DataTechnology", "unknown"}
+    , { "Status", "unregistered"} // ofono
+    , { "Technology", "unknown"}
+    , { "SignalBars", "0"}
+    , { "CellName", ""}
+    , { "NetworkName", ""}
+    , { "ExtendedNetworkName", "" }
+    , { "SubscriberIdentity", "" }
+    , { "CurrentMCC", "0"}
+    , { "CurrentMNC", "0"}
+    , { "HomeMCC", "0"}
+    , { "HomeMNC", "0"}
+    , { "StkIdleModeText", ""}
+    , { "MMSContext", ""}
+    , { "DataRoamingAllowed", "0"}
+};
+static_assert(statefs::qt::is_valid_schema<Prop>(cellular_schema)
+              , "Check Cellular properties schema");
+
 // TODO 2 contexkit properties are not supported yet:
 // Phone.Call and Phone.Muted
 // There is no components using it so the question
@@ -874,35 +975,8 @@ void MainNs::resetProperties(Bridge::Status status, SimPresent sim)
 MainNs::MainNs(QDBusConnection &bus)
     : Namespace("Cellular", std::unique_ptr<PropertiesSource>
                 (new Bridge(this, bus)))
-    , defaults_({
-            { "SignalStrength", "0"}
-            , { "DataTechnology", "unknown"}
-            // "RegistrationStatus" is set separately
-            , { "Status", "unregistered"} // ofono
-            , { "Technology", "unknown"}
-            , { "SignalBars", "0"}
-            , { "CellName", ""}
-            , { "NetworkName", ""}
-            , { "ExtendedNetworkName", "" }
-            , { "SubscriberIdentity", "" }
-            , { "CurrentMCC", "0"}
-            , { "CurrentMNC", "0"}
-            , { "HomeMCC", "0"}
-            , { "HomeMNC", "0"}
-            , { "StkIdleModeText", ""}
-            , { "MMSContext", ""}
-            , { "DataRoamingAllowed", "0"}
-        })
-{
-    // contextkit prop
-    static auto const sim = SimPresent::Unknown;
-    auto status = Bridge::ckit_status(Status::Offline, sim);
-    addProperty("RegistrationStatus", status.toUtf8());
-    addProperty("Sim", sim_presence_name(sim));
-
-    for (auto v : defaults_)
-        addProperty(v.first, v.second);
-    src_->init();
+{
+    addProperties(cellular_schema);
 }
 
 class Provider;
@@ -912,11 +986,13 @@ class Provider : public statefs::AProvider
 {
 public:
     Provider(statefs_server *server)
-        : AProvider("ofono", server)
+        : AProvider(provider_name, server)
         , bus_(QDBusConnection::systemBus())
     {
         auto ns = std::make_shared<MainNs>(bus_);
         insert(std::static_pointer_cast<statefs::ANode>(ns));
+        statefs::qt::insert_diagnostics
+            (*this, *ns, provider_name, service_name);
     }
     virtual ~Provider() {}
 
@@ -933,7 +1009,11 @@ private:
 
 static inline Provider *init_provider(statefs_server *server)
 {
-    registerDataTypes();
+    ProfilePhase phase(provider_name, "load");
+    {
+        ProfilePhase types_phase(provider_name, "registerDataTypes");
+        registerDataTypes();
+    }
     if (provider)
         throw std::logic_error("provider ptr is already set");
     provider = new Provider(server);
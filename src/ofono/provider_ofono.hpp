@@ -18,6 +18,7 @@
 #include <statefs/property.hpp>
 #include <statefs/qt/ns.hpp>
 #include <statefs/qt/dbus.hpp>
+#include <statefs/qt/dispatcher.hpp>
 
 #include <QDBusConnection>
 #include <QString>
@@ -38,6 +39,8 @@ typedef OrgOfonoSimToolkitInterface SimToolkit;
 typedef OrgOfonoConnectionManagerInterface ConnectionManager;
 typedef OrgOfonoConnectionContextInterface ConnectionContext;
 using statefs::qt::ServiceWatch;
+using statefs::qt::SignalDispatcher;
+using statefs::qt::Subscription;
 
 enum class Interface {
     AssistedSatelliteNavigation,
@@ -69,9 +72,33 @@ enum class Interface {
 
 enum class SimPresent { Unknown, No, Yes, EOE };
 
+// Cellular namespace properties, see the schema in provider_ofono.cpp
+enum class Prop {
+    RegistrationStatus,
+    Sim,
+    SignalStrength,
+    DataTechnology,
+    Status,
+    Technology,
+    SignalBars,
+    CellName,
+    NetworkName,
+    ExtendedNetworkName,
+    SubscriberIdentity,
+    CurrentMCC,
+    CurrentMNC,
+    HomeMCC,
+    HomeMNC,
+    StkIdleModeText,
+    MMSContext,
+    DataRoamingAllowed,
+
+    EOE
+};
+
 struct ConnectionCache
 {
-    std::unique_ptr<ConnectionContext> context;
+    Subscription signal;
     QVariantMap properties;
 };
 
@@ -88,9 +115,7 @@ public:
     virtual ~Bridge() {}
 
     virtual void init();
-
-    typedef std::function<void(Bridge*, QVariant const&)> property_action_type;
-    typedef std::map<QString, property_action_type> property_map_type;
+    virtual void readersChanged(size_t, bool);
 
     enum class Status {
         Offline, Registered, Searching, Denied, Unknown, Roaming
@@ -116,11 +141,14 @@ private:
     void setup_network(QString const &);
     void setup_stk(QString const &);
     void setup_connectionManager(QString const &);
+    void setup_contexts(QString const &);
+    void add_context(QString const &, QVariantMap const &);
     void reset_sim();
     void reset_network();
     void reset_modem();
     void reset_stk();
     void reset_connectionManager();
+    void reset_contexts();
     void reset_props();
     void process_interfaces(QStringList const&);
     void enumerate_operators();
@@ -136,7 +164,10 @@ private:
     std::unique_ptr<SimToolkit> stk_;
     std::unique_ptr<ConnectionManager> connectionManager_;
     std::map<QString,ConnectionCache> connectionContexts_;
+    Subscription context_added_;
+    Subscription context_removed_;
     ServiceWatch watch_;
+    std::shared_ptr<SignalDispatcher> signals_;
 
     SimPresent sim_present_;
     bool supports_stk_;
@@ -147,10 +178,6 @@ private:
     QString modem_path_;
     QString operator_path_;
     QString mmsContext_;
-
-    static const property_map_type net_property_actions_;
-    static const property_map_type operator_property_actions_;
-    static const property_map_type connman_property_actions_;
 };
 
 class MainNs : public statefs::qt::Namespace
@@ -161,8 +188,6 @@ public:
 private:
     friend class Bridge;
     void resetProperties(Bridge::Status, SimPresent);
-
-    statefs::qt::DefaultProperties defaults_;
 };
 
 }}
@@ -26,32 +26,36 @@
 #include <math.h>
 #include <iostream>
 #include <statefs/qt/dbus.hpp>
+#include <statefs/qt/profile.hpp>
 
 namespace statefs { namespace profile {
 
 using statefs::qt::Namespace;
 using statefs::qt::PropertiesSource;
-using statefs::qt::sync;
+using statefs::qt::ProfilePhase;
+using statefs::qt::future;
 
 static char const *service_name = "com.nokia.profiled";
+static char const *provider_name = "profile";
 static char const *root_path = "/com/nokia/profiled";
 
 Bridge::Bridge(ProfileNs *ns, QDBusConnection &bus)
     : PropertiesSource(ns)
     , bus_(bus)
     , watch_(new ServiceWatch(bus, service_name))
+    , signals_(SignalDispatcher::get(bus, service_name))
 {
 }
 
 void Bridge::init_conn()
 {
     auto set_profile = [this](QString const &v) {
-        updateProperty("Name", v);
+        updateProperty(Prop::Name, v);
     };
 
+    // profile values are not used, so they are not demarshalled
     auto on_changed = [set_profile]
-        (bool changed, bool active, const QString &profile
-         , ProfileDataList values) {
+        (bool changed, bool active, const QString &profile) {
         if (active) {
             qDebug() << "Active profile is " << profile;
             set_profile(profile);
@@ -60,9 +64,11 @@ void Bridge::init_conn()
         }
     };
     profiled_.reset(new Profile(service_name, root_path, bus_));
-    sync(profiled_->get_profile(), set_profile);
-    connect(profiled_.get(), &Profile::profile_changed
-            , on_changed);
+    future(profiled_.get(), profiled_->get_profile()
+           , "com.nokia.profiled.get_profile").then(set_profile);
+    signals_->subscribe<bool, bool, QString>
+        (profiled_.get(), root_path, Profile::staticInterfaceName()
+         , "profile_changed", on_changed);
 }
 
 void Bridge::init()
@@ -76,19 +82,22 @@ void Bridge::init()
 }
 
 
+static constexpr statefs::qt::PropertyInfo profile_schema[] = {
+    { "Name", "" }
+};
+static_assert(statefs::qt::is_valid_schema<Prop>(profile_schema)
+              , "Check Profile properties schema");
+
 ProfileNs::ProfileNs(QDBusConnection &bus)
     : Namespace("Profile", std::unique_ptr<PropertiesSource>
                 (new Bridge(this, bus)))
-    , defaults_({{"Name", ""}})
 {
-    for (auto v : defaults_)
-        addProperty(v.first, v.second);
-    src_->init();
+    addProperties(profile_schema);
 }
 
 void ProfileNs::reset_properties()
 {
-    setProperties(defaults_);
+    setDefaults();
 }
 
 class Provider;
@@ -98,11 +107,13 @@ class Provider : public statefs::AProvider
 {
 public:
     Provider(statefs_server *server)
-        : AProvider("profile", server)
+        : AProvider(provider_name, server)
         , bus_(QDBusConnection::sessionBus())
     {
         auto ns = std::make_shared<ProfileNs>(bus_);
         insert(std::static_pointer_cast<statefs::ANode>(ns));
+        statefs::qt::insert_diagnostics
+            (*this, *ns, provider_name, service_name);
     }
     virtual ~Provider() {}
 
@@ -119,7 +130,11 @@ private:
 
 static inline Provider *init_provider(statefs_server *server)
 {
-    registerDataTypes();
+    ProfilePhase phase(provider_name, "load");
+    {
+        ProfilePhase types_phase(provider_name, "registerDataTypes");
+        registerDataTypes();
+    }
     if (provider)
         throw std::logic_error("provider ptr is already set");
     provider = new Provider(server);
@@ -7,6 +7,7 @@
 #include <statefs/property.hpp>
 #include <statefs/qt/ns.hpp>
 #include <statefs/qt/dbus.hpp>
+#include <statefs/qt/dispatcher.hpp>
 
 #include <map>
 #include <QDBusConnection>
@@ -18,9 +19,13 @@ namespace statefs { namespace profile {
 
 typedef ComNokiaProfiledInterface Profile;
 using statefs::qt::ServiceWatch;
+using statefs::qt::SignalDispatcher;
 
 class ProfileNs;
 
+// Profile namespace properties, see the schema in provider_profile.cpp
+enum class Prop { Name, EOE };
+
 class Bridge : public QObject, public statefs::qt::PropertiesSource
 {
     Q_OBJECT;
@@ -36,6 +41,7 @@ private:
 
     QDBusConnection &bus_;
     std::unique_ptr<ServiceWatch> watch_;
+    std::shared_ptr<SignalDispatcher> signals_;
     std::unique_ptr<Profile> profiled_;
 };
 
@@ -47,8 +53,6 @@ public:
 private:
     friend class Bridge;
     void reset_properties();
-
-    statefs::qt::DefaultProperties defaults_;
 };
 
 
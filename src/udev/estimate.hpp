@@ -0,0 +1,261 @@
+#ifndef _STATEFS_PRIVATE_UDEV_ESTIMATE_HPP_
+#define _STATEFS_PRIVATE_UDEV_ESTIMATE_HPP_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <stdlib.h>
+
+namespace statefs { namespace udev {
+
+/**
+ * Ring buffer keeping last capacity() values, storage is allocated
+ * once by the constructor, the oldest value is overwritten by push()
+ * when the buffer is full.
+ */
+template <typename T>
+class Ring
+{
+public:
+    Ring(size_t capacity)
+        : data_(capacity ? capacity : 1), head_(0), size_(0)
+    {}
+
+    size_t capacity() const { return data_.size(); }
+    size_t size() const { return size_; }
+    bool empty() const { return !size_; }
+    bool is_full() const { return size_ == data_.size(); }
+
+    void clear()
+    {
+        head_ = 0;
+        size_ = 0;
+    }
+
+    void push(T const &v)
+    {
+        data_[(head_ + size_) % data_.size()] = v;
+        if (is_full())
+            head_ = (head_ + 1) % data_.size();
+        else
+            ++size_;
+    }
+
+    /// i-th value starting from the oldest one
+    T const & operator[](size_t i) const
+    {
+        return data_[(head_ + i) % data_.size()];
+    }
+
+    T const & front() const { return (*this)[0]; }
+    T const & back() const { return (*this)[size_ - 1]; }
+
+private:
+    std::vector<T> data_;
+    size_t head_;
+    size_t size_;
+};
+
+/**
+ * Estimates the rate of the battery energy change (energy units per
+ * second) from energy_now samples. Samples are pushed only if energy
+ * is changed, time is in seconds.
+ */
+class Estimator
+{
+public:
+    virtual ~Estimator() {}
+
+    virtual void push(long t, long energy) = 0;
+    /// @return 0 if there is not enough samples
+    virtual double rate() const = 0;
+    /// called on charger state change, history is useless after it
+    virtual void clear() = 0;
+};
+
+/// rate between the previous and the current sample
+class IntervalEstimator : public Estimator
+{
+public:
+    IntervalEstimator() : has_last_(false), last_t_(0), last_energy_(0) {}
+
+    virtual void push(long t, long energy)
+    {
+        if (has_last_) {
+            // the same second: rate is undefined, the next interval
+            // covers this change
+            if (t <= last_t_)
+                return;
+            on_rate(static_cast<double>(energy - last_energy_)
+                    / (t - last_t_));
+        }
+        last_t_ = t;
+        last_energy_ = energy;
+        has_last_ = true;
+    }
+
+    virtual void clear()
+    {
+        has_last_ = false;
+        on_clear();
+    }
+
+protected:
+    virtual void on_rate(double) = 0;
+    virtual void on_clear() = 0;
+
+private:
+    bool has_last_;
+    long last_t_;
+    long last_energy_;
+};
+
+/// average rate over last window intervals
+class MovingAverage : public IntervalEstimator
+{
+public:
+    MovingAverage(size_t window) : rates_(window), sum_(0) {}
+
+    virtual double rate() const
+    {
+        return rates_.empty() ? 0 : sum_ / rates_.size();
+    }
+
+protected:
+    virtual void on_rate(double v)
+    {
+        if (rates_.is_full())
+            sum_ -= rates_.front();
+        rates_.push(v);
+        sum_ += v;
+    }
+
+    virtual void on_clear()
+    {
+        rates_.clear();
+        sum_ = 0;
+    }
+
+private:
+    Ring<double> rates_;
+    double sum_;
+};
+
+/// exponentially weighted moving average of interval rates, alpha
+/// is the weight of the last interval
+class Ewma : public IntervalEstimator
+{
+public:
+    Ewma(double alpha) : alpha_(alpha), rate_(0), has_rate_(false) {}
+
+    virtual double rate() const { return rate_; }
+
+protected:
+    virtual void on_rate(double v)
+    {
+        rate_ = has_rate_ ? rate_ + alpha_ * (v - rate_) : v;
+        has_rate_ = true;
+    }
+
+    virtual void on_clear()
+    {
+        rate_ = 0;
+        has_rate_ = false;
+    }
+
+private:
+    double alpha_;
+    double rate_;
+    bool has_rate_;
+};
+
+/**
+ * Least-squares slope of energy(t) over last window samples. Unlike
+ * averaging of interval rates it is not biased by the irregular
+ * sampling and quantization of energy_now.
+ */
+class LeastSquares : public Estimator
+{
+public:
+    LeastSquares(size_t window) : samples_(window < 2 ? 2 : window) {}
+
+    virtual void push(long t, long energy)
+    {
+        samples_.push(Sample{t, energy});
+    }
+
+    virtual double rate() const
+    {
+        auto n = samples_.size();
+        if (n < 2)
+            return 0;
+        // relative to the first sample to keep precision
+        auto const &first = samples_.front();
+        double st = 0, se = 0;
+        for (size_t i = 0; i < n; ++i) {
+            st += samples_[i].t - first.t;
+            se += samples_[i].energy - first.energy;
+        }
+        auto mt = st / n, me = se / n;
+        double cov = 0, var = 0;
+        for (size_t i = 0; i < n; ++i) {
+            auto dt = samples_[i].t - first.t - mt;
+            cov += dt * (samples_[i].energy - first.energy - me);
+            var += dt * dt;
+        }
+        return var > 0 ? cov / var : 0;
+    }
+
+    virtual void clear()
+    {
+        samples_.clear();
+    }
+
+private:
+    struct Sample
+    {
+        long t;
+        long energy;
+    };
+    Ring<Sample> samples_;
+};
+
+/**
+ * Estimator specification is "<name>[:<parameter>]":
+ *
+ * - average[:window] - moving average of interval rates (default, 6)
+ * - ewma[:alpha] - exponentially weighted average (0.3)
+ * - slope[:window] - least-squares slope over samples (8)
+ *
+ * @return nullptr if specification is invalid
+ */
+inline std::unique_ptr<Estimator> create_estimator(std::string const &spec)
+{
+    auto pos = spec.find(':');
+    auto name = spec.substr(0, pos);
+    auto param = (pos == std::string::npos)
+        ? std::string() : spec.substr(pos + 1);
+    auto number = [&param](double defval) {
+        return param.empty() ? defval : ::atof(param.c_str());
+    };
+    std::unique_ptr<Estimator> res;
+    if (name == "average" || name.empty()) {
+        auto window = number(6);
+        if (window >= 1)
+            res.reset(new MovingAverage(static_cast<size_t>(window)));
+    } else if (name == "ewma") {
+        auto alpha = number(0.3);
+        if (alpha > 0 && alpha <= 1)
+            res.reset(new Ewma(alpha));
+    } else if (name == "slope") {
+        auto window = number(8);
+        if (window >= 2)
+            res.reset(new LeastSquares(static_cast<size_t>(window)));
+    }
+    return res;
+}
+
+}}
+
+#endif // _STATEFS_PRIVATE_UDEV_ESTIMATE_HPP_
@@ -0,0 +1,243 @@
+#ifndef _STATEFS_PRIVATE_UDEV_POWER_SUPPLY_HPP_
+#define _STATEFS_PRIVATE_UDEV_POWER_SUPPLY_HPP_
+
+#include <string>
+#include <vector>
+
+#include <string.h>
+
+namespace statefs { namespace udev {
+
+/// parse decimal integer w/o allocations, @return false if
+/// [begin, end) is not an integer
+inline bool parse_long(char const *begin, char const *end, long &res)
+{
+    auto p = begin;
+    bool is_negative = (p != end && *p == '-');
+    if (p != end && (*p == '-' || *p == '+'))
+        ++p;
+    if (p == end)
+        return false;
+    long v = 0;
+    for (; p != end; ++p) {
+        if (*p < '0' || *p > '9')
+            return false;
+        v = v * 10 + (*p - '0');
+    }
+    res = is_negative ? -v : v;
+    return true;
+}
+
+/**
+ * Power supply properties carried by the udev event
+ * (POWER_SUPPLY_<NAME>), <NAME> is the upper-cased sysfs attribute
+ * name. They are taken from the event w/o sysfs access and converted
+ * w/o allocations.
+ */
+class PowerSupplyInfo
+{
+public:
+    enum Id { Online, EnergyNow, EnergyFull, Capacity, IdCount };
+
+    /// sysfs attribute name
+    static char const *name(Id id)
+    {
+        static char const *names[] = {
+            "online", "energy_now", "energy_full", "capacity"
+        };
+        static_assert(sizeof(names) / sizeof(names[0]) == IdCount
+                      , "Each property should be named");
+        return names[id];
+    }
+
+    /// udev event property name
+    static char const *key(Id id)
+    {
+        static char const *keys[] = {
+            "POWER_SUPPLY_ONLINE", "POWER_SUPPLY_ENERGY_NOW"
+            , "POWER_SUPPLY_ENERGY_FULL", "POWER_SUPPLY_CAPACITY"
+        };
+        static_assert(sizeof(keys) / sizeof(keys[0]) == IdCount
+                      , "Each property should have a key");
+        return keys[id];
+    }
+
+    PowerSupplyInfo() : has_type_(false), present_(0) { type_[0] = 0; }
+
+    /// get(key) returns the event property value or nullptr if
+    /// there is no such property
+    template <typename FnT>
+    void load(FnT const &get)
+    {
+        has_type_ = false;
+        present_ = 0;
+        if (auto t = get("POWER_SUPPLY_TYPE")) {
+            auto len = strlen(t);
+            if (len < sizeof(type_)) {
+                memcpy(type_, t, len + 1);
+                has_type_ = true;
+            }
+        }
+        for (int i = 0; i < IdCount; ++i) {
+            auto id = static_cast<Id>(i);
+            auto v = get(key(id));
+            if (v && parse_long(v, v + strlen(v), values_[id]))
+                present_ |= (1u << id);
+        }
+    }
+
+    bool has(Id id) const { return present_ & (1u << id); }
+    long value(Id id) const { return values_[id]; }
+
+    /// nullptr if there is no type in the event
+    char const *type() const { return has_type_ ? type_ : nullptr; }
+
+private:
+    char type_[16];
+    bool has_type_;
+    unsigned present_;
+    long values_[IdCount];
+};
+
+/// typed state of the power_supply device
+struct PowerDevice
+{
+    enum class Kind { Other, Battery, Charger };
+
+    Kind kind;
+    bool is_online;
+    long energy_now;
+    long energy_full;
+    long capacity;
+};
+
+/**
+ * Flat table of power supply devices keyed by syspath. Aggregated
+ * values are updated incrementally: contribution of the device
+ * previous state is replaced by the new one.
+ */
+class PowerTable
+{
+public:
+    PowerTable() { clear(); }
+
+    size_t size() const { return devices_.size(); }
+
+    PowerDevice const * find(std::string const &path) const
+    {
+        auto p = find_(path);
+        return p ? &p->state : nullptr;
+    }
+
+    void update(std::string const &path, PowerDevice const &state)
+    {
+        auto p = find_(path);
+        if (p) {
+            account(p->state, -1);
+            p->state = state;
+        } else {
+            devices_.push_back(Entry{path, state});
+        }
+        account(state, 1);
+    }
+
+    void remove(std::string const &path)
+    {
+        for (auto p = devices_.begin(); p != devices_.end(); ++p) {
+            if (p->path == path) {
+                account(p->state, -1);
+                devices_.erase(p);
+                return;
+            }
+        }
+    }
+
+    void clear()
+    {
+        devices_.clear();
+        batteries_ = 0;
+        chargers_online_ = 0;
+        energy_now_ = 0;
+        energy_full_ = 0;
+        capacity_sum_ = 0;
+        weighted_capacity_ = 0;
+    }
+
+    size_t batteries() const { return static_cast<size_t>(batteries_); }
+    bool is_online() const { return chargers_online_ > 0; }
+    long energy_now() const { return energy_now_; }
+    long energy_full() const { return energy_full_; }
+
+    /// percentage of all batteries weighted by their full energy
+    long capacity() const
+    {
+        if (energy_full_ > 0)
+            return static_cast<long>(weighted_capacity_ / energy_full_);
+        return batteries_ ? capacity_sum_ / static_cast<long>(batteries_) : 0;
+    }
+
+    /// @return path of the battery with the largest full energy or
+    /// nullptr if there are no batteries
+    char const * main_battery() const
+    {
+        Entry const *res = nullptr;
+        for (auto const &e : devices_) {
+            if (e.state.kind == PowerDevice::Kind::Battery
+                && (!res || e.state.energy_full > res->state.energy_full))
+                res = &e;
+        }
+        return res ? res->path.c_str() : nullptr;
+    }
+
+private:
+    struct Entry
+    {
+        std::string path;
+        PowerDevice state;
+    };
+
+    Entry * find_(std::string const &path)
+    {
+        for (auto &e : devices_)
+            if (e.path == path)
+                return &e;
+        return nullptr;
+    }
+
+    Entry const * find_(std::string const &path) const
+    {
+        return const_cast<PowerTable*>(this)->find_(path);
+    }
+
+    void account(PowerDevice const &d, int sign)
+    {
+        switch (d.kind) {
+        case PowerDevice::Kind::Battery:
+            batteries_ += sign;
+            energy_now_ += sign * d.energy_now;
+            energy_full_ += sign * d.energy_full;
+            capacity_sum_ += sign * d.capacity;
+            weighted_capacity_ += sign * static_cast<long long>(d.capacity)
+                * d.energy_full;
+            break;
+        case PowerDevice::Kind::Charger:
+            if (d.is_online)
+                chargers_online_ += sign;
+            break;
+        default:
+            break;
+        }
+    }
+
+    std::vector<Entry> devices_;
+    long batteries_;
+    long chargers_online_;
+    long energy_now_;
+    long energy_full_;
+    long capacity_sum_;
+    long long weighted_capacity_;
+};
+
+}}
+
+#endif // _STATEFS_PRIVATE_UDEV_POWER_SUPPLY_HPP_
@@ -1,8 +1,16 @@
 #include <thread>
 #include <memory>
+#include <atomic>
 #include <array>
 #include <functional>
+#include <cmath>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
 #include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
 
 #include <boost/asio.hpp>
 #include <boost/asio/posix/basic_descriptor.hpp>
@@ -10,15 +18,31 @@
 
 #include <statefs/property.hpp>
 #include <statefs/consumer.hpp>
+#include <statefs/qt/readiness.hpp>
+#include <statefs/qt/stats.hpp>
+#include <statefs/qt/trace.hpp>
 #include <cor/util.hpp>
 #include <cor/udev.hpp>
 #include <cor/error.hpp>
 
+#include "estimate.hpp"
+#include "power_supply.hpp"
+#include "schedule.hpp"
+
+#ifndef CLOCK_BOOTTIME
+#define CLOCK_BOOTTIME 7
+#endif
+
 namespace asio = boost::asio;
 namespace udevpp = cor::udevpp;
 
 namespace statefs { namespace udev {
 
+using statefs::qt::ProfilePhase;
+namespace trace = statefs::qt::trace;
+
+static char const *provider_name = "udev";
+
 static std::string str_or_default(char const *v, char const *defval)
 {
     return v ? v : defval;
@@ -36,7 +60,8 @@ std::string attr<std::string>(char const *v)
 template <>
 long attr<long>(char const *v)
 {
-    return atoi(str_or_default(v, "0").c_str());
+    // the same as atoi() but w/o temporary string
+    return v ? ::strtol(v, nullptr, 10) : 0;
 }
 
 template <>
@@ -45,59 +70,264 @@ bool attr<bool>(char const *v)
     return attr<long>(v);
 }
 
-template <typename T>
-static inline std::string statefs_attr(T const &v)
+/// udev event, enumeration or refresh of known devices (source is
+/// "monitor", "enumerate" or "refresh")
+static void record_trigger(char const *source, char const *syspath)
 {
-    return std::to_string(v);
+    auto writer = trace::writer(provider_name);
+    if (!writer)
+        return;
+    writer->write(trace::Kind::UdevEvent, [=](trace::Encoder &e) {
+            e.put(source, strlen(source));
+            e.put(str_or_default(syspath, ""));
+        });
 }
 
-static inline std::string statefs_attr(bool v)
+/// sysfs attribute read, it is recorded to replay udev inputs
+template <typename DeviceT>
+char const *read_attr(DeviceT const &dev, char const *name)
 {
-    return std::to_string(v ? 1 : 0);
+    auto v = dev.attr(name);
+    if (auto writer = trace::writer(provider_name)) {
+        writer->write(trace::Kind::SysfsRead, [&](trace::Encoder &e) {
+                e.put(str_or_default(dev.path(), ""));
+                e.put(name, strlen(name));
+                e.put(str_or_default(v, ""));
+            });
+    }
+    return v;
 }
 
-template <typename T>
-struct LastN
+/// udev event property, it is recorded like attributes
+template <typename DeviceT>
+char const *read_value(DeviceT const &dev, char const *name)
+{
+    auto v = dev.value(name);
+    if (auto writer = trace::writer(provider_name)) {
+        writer->write(trace::Kind::UdevProperty, [&](trace::Encoder &e) {
+                e.put(str_or_default(dev.path(), ""));
+                e.put(name, strlen(name));
+                e.put(str_or_default(v, ""));
+            });
+    }
+    return v;
+}
+
+/**
+ * Device attributes and event properties recorded to the trace, it
+ * is used instead of udevpp::Device while replaying. Absent value is
+ * recorded as the empty one, it is treated by attr<T>() like missing
+ * one. Attributes and properties (POWER_SUPPLY_*) are kept in the
+ * same map, their names do not intersect.
+ */
+class TraceDevice
 {
-    LastN(size_t max_size, T precision)
-        : max_size_(max_size_)
-        , sum_(0)
-        , precision_(precision)
+public:
+    typedef std::map<std::string, std::string> attrs_type;
+
+    TraceDevice(std::string const &path, attrs_type const &attrs)
+        : path_(path), attrs_(attrs)
     {}
 
-    void clear()
+    char const *path() const { return path_.c_str(); }
+
+    char const *attr(char const *name) const
+    {
+        auto p = attrs_.find(name);
+        return (p != attrs_.end() && !p->second.empty())
+            ? p->second.c_str() : nullptr;
+    }
+
+    char const *value(char const *name) const
+    {
+        return attr(name);
+    }
+
+private:
+    std::string path_;
+    attrs_type const &attrs_;
+};
+
+/**
+ * Power supply device with sysfs attribute files kept open, so
+ * periodic refresh is a pread() per attribute instead of the
+ * enumeration of the subsystem and udev device construction. It has
+ * the same interface as udevpp::Device. Attribute files are opened
+ * on the first access, missing attribute is reported as nullptr like
+ * udev does.
+ */
+class CachedDevice
+{
+public:
+    CachedDevice(std::string const &path) : path_(path), is_gone_(false) {}
+
+    CachedDevice(CachedDevice const&) = delete;
+    CachedDevice & operator =(CachedDevice const&) = delete;
+
+    char const *path() const { return path_.c_str(); }
+
+    char const *attr(char const *name) const
     {
-        values_.clear();
-        sum_ = 0;
+        auto res = file(name).read();
+        // attribute can be absent, device is gone if its directory
+        // is removed
+        if (!res && ::access(path_.c_str(), F_OK))
+            is_gone_ = true;
+        return res;
     }
 
-    void push(T v)
+    /// cached device is not reported by udev event, so there are no
+    /// event properties
+    char const *value(char const *) const { return nullptr; }
+
+    /// set if some attribute read failed because device is removed
+    bool is_gone() const { return is_gone_; }
+
+private:
+    class AttrFile
     {
-        values_.push_back(v);
-        if (values_.size() > max_size_) {
-            sum_ -= values_.front();
-            values_.pop_front();
+    public:
+        AttrFile(char const *name, std::string const &path)
+            : name_(name)
+            , fd_(::open(path.c_str(), O_RDONLY | O_CLOEXEC))
+        {}
+
+        std::string const & name() const { return name_; }
+
+        ~AttrFile()
+        {
+            if (fd_ >= 0)
+                ::close(fd_);
         }
-        sum_ += v;
+
+        /// @return value w/o trailing newline, it is valid until the
+        /// next read
+        char const *read()
+        {
+            if (fd_ < 0)
+                return nullptr;
+            ssize_t len;
+            while ((len = ::pread(fd_, buf_, sizeof(buf_) - 1, 0)) < 0
+                   && errno == EINTR) {}
+            if (len < 0)
+                return nullptr;
+            while (len && (buf_[len - 1] == '\n' || buf_[len - 1] == ' '))
+                --len;
+            buf_[len] = 0;
+            return buf_;
+        }
+
+    private:
+        AttrFile(AttrFile const&);
+        AttrFile & operator =(AttrFile const&);
+
+        std::string name_;
+        int fd_;
+        // sysfs attribute is not longer than the page, uevent is
+        // the longest one
+        char buf_[4096];
+    };
+
+    AttrFile & file(char const *name) const
+    {
+        // there are only few attributes, names are compared w/o
+        // allocations
+        for (auto const &f : attrs_)
+            if (f->name() == name)
+                return *f;
+        attrs_.emplace_back(new AttrFile(name, path_ + "/" + name));
+        return *attrs_.back();
+    }
+
+    std::string path_;
+    mutable std::vector<std::unique_ptr<AttrFile> > attrs_;
+    mutable bool is_gone_;
+};
+
+/**
+ * Power supply device state. On udev event POWER_SUPPLY_* properties
+ * are taken from the event itself, only attributes missing from it
+ * are read from sysfs. Refresh and enumeration read only needed
+ * attributes: sysfs uevent is not used because the driver queries
+ * all supported properties to produce it (often a fuel gauge bus
+ * transaction per property).
+ */
+template <typename DeviceT>
+class PowerSupply
+{
+public:
+    typedef PowerSupplyInfo::Id Id;
+
+    PowerSupply(DeviceT const &dev, bool is_event)
+        : dev_(dev), kind_(PowerDevice::Kind::Other)
+    {
+        if (is_event)
+            info_.load([&dev](char const *key) {
+                    return read_value(dev, key);
+                });
+        // type is read once, it is checked against several names
+        auto t = info_.type();
+        if (!t)
+            t = read_attr(dev_, "type");
+        if (!t)
+            return;
+        if (!strcmp(t, "Battery"))
+            kind_ = PowerDevice::Kind::Battery;
+        else if (!strcmp(t, "Mains") || !strcmp(t, "USB"))
+            kind_ = PowerDevice::Kind::Charger;
     }
 
-    T average() const
+    DeviceT const & device() const { return dev_; }
+
+    /// property is provided by the event
+    bool has(Id id) const { return info_.has(id); }
+
+    PowerDevice::Kind kind() const { return kind_; }
+
+    long get(Id id) const
     {
-        T sz = values_.size();
-        if (!sz)
-            return 0;
-        std::cerr << "??" << sum_ << ","
-                  << precision_ << "," << sz << "," <<
-            (((sum_ * precision_) / sz) / precision_) << std::endl;
-        return sz ? (((sum_ * precision_) / sz) / precision_) : sum_;
-    }
-
-    size_t max_size_;
-    T sum_;
-    T precision_;
-    std::list<T> values_;
+        return info_.has(id)
+            ? info_.value(id)
+            : attr<long>(read_attr(dev_, PowerSupplyInfo::name(id)));
+    }
+
+private:
+    DeviceT const &dev_;
+    PowerSupplyInfo info_;
+    PowerDevice::Kind kind_;
 };
 
+template <typename DeviceT>
+PowerSupply<DeviceT> power_supply(DeviceT const &dev, bool is_event = false)
+{
+    return PowerSupply<DeviceT>(dev, is_event);
+}
+
+template <typename T>
+static inline std::string statefs_attr(T const &v)
+{
+    return std::to_string(v);
+}
+
+static inline std::string statefs_attr(bool v)
+{
+    return std::to_string(v ? 1 : 0);
+}
+
+/// STATEFS_PROVIDER_UDEV_ESTIMATOR selects the energy rate
+/// estimator, see create_estimator()
+static std::unique_ptr<Estimator> configured_estimator()
+{
+    auto spec = str_or_default(::getenv("STATEFS_PROVIDER_UDEV_ESTIMATOR"), "");
+    auto res = create_estimator(spec);
+    if (!res) {
+        std::cerr << "Invalid estimator '" << spec << "', using average"
+                  << std::endl;
+        res = create_estimator("average");
+    }
+    return res;
+}
+
 class BasicSource : public PropertySource
 {
 public:
@@ -130,8 +360,98 @@ private:
 using statefs::consumer::try_open_in_property;
 
 
+/// Charger.Online is set if any charger is online
+class ChargerNs : public statefs::Namespace
+{
+public:
+    ChargerNs();
+
+    virtual void release() { }
+
+    void set_online(bool);
+
+private:
+    statefs::setter_type online_;
+    int last_;
+};
+
+/// PowerSupply.<slot>.* properties of the single power supply,
+/// Name is the power supply name, empty if the slot is free
+class DeviceNs : public statefs::Namespace
+{
+public:
+    enum class Prop {
+        Name, Type, Online, ChargePercentage, Energy, EnergyFull
+            , EOE // end of enum
+    };
+
+    DeviceNs(std::string const &name);
+
+    virtual void release() { }
+
+    void set(std::string const &name, PowerDevice const &);
+    /// set default values, the slot is free after that
+    void reset();
+
+private:
+    static const size_t prop_count = static_cast<size_t>(Prop::EOE);
+    typedef std::array<std::string, prop_count> values_type;
+
+    void publish(values_type &);
+
+    std::array<statefs::setter_type, prop_count> setters_;
+    values_type last_;
+};
+
+/**
+ * PowerSupply namespace with slot_count slots (PowerSupply.0 etc.)
+ * for power supply devices. Statefs namespaces can't be added after
+ * the provider is loaded, so devices are not enumerated at load:
+ * slots are assigned by the monitor thread when the device is seen
+ * first time and released when it disappears. If there are more
+ * devices than slots, the rest is aggregated into Battery and
+ * Charger properties but not published separately.
+ *
+ * Slots are accessed only from the monitor thread.
+ */
+class PowerSupplyNs : public statefs::Namespace
+{
+public:
+    static const size_t slot_count = 8;
+
+    PowerSupplyNs();
+
+    virtual void release() { }
+
+    void set(std::string const &path, PowerDevice const &);
+
+    /// release slots of devices absent in the table
+    void sync(PowerTable const &);
+
+private:
+    struct Slot
+    {
+        // empty if the slot is free
+        std::string path;
+        std::shared_ptr<DeviceNs> ns;
+    };
+
+    std::array<Slot, slot_count> slots_;
+    bool is_overflow_reported_;
+};
+
 class Monitor;
 
+/// Diagnostic namespace ProviderStats.udev with the battery poll
+/// interval and the number of poll timer wakeups
+class PollStatsNs : public statefs::Namespace
+{
+public:
+    PollStatsNs(Monitor const &);
+
+    virtual void release() { }
+};
+
 class BatteryNs : public statefs::Namespace
 {
 public:
@@ -152,7 +472,7 @@ public:
 
     typedef std::map<Prop, BasicSource::source_type> analog_info_type;
 
-    BatteryNs();
+    BatteryNs(statefs::qt::readiness_ptr const &);
 
     virtual ~BatteryNs() {
         io_.stop();
@@ -164,6 +484,24 @@ public:
 
     void set(Prop, std::string const &);
 
+    void set_charger_online(bool v) { charger_ns_->set_online(v); }
+
+    void set_device(std::string const &path, PowerDevice const &state)
+    {
+        devices_ns_->set(path, state);
+    }
+
+    void sync_devices(PowerTable const &devices)
+    {
+        devices_ns_->sync(devices);
+    }
+
+    std::shared_ptr<ChargerNs> charger_ns() const { return charger_ns_; }
+
+    std::shared_ptr<PowerSupplyNs> devices_ns() const { return devices_ns_; }
+
+    std::shared_ptr<PollStatsNs> poll_stats_ns() const { return poll_stats_ns_; }
+
 private:
 
     template <typename T>
@@ -179,6 +517,9 @@ private:
     analog_info_type analog_info_;
     std::array<statefs::setter_type, prop_count> setters_;
     std::unique_ptr<std::thread> monitor_thread_;
+    std::shared_ptr<ChargerNs> charger_ns_;
+    std::shared_ptr<PowerSupplyNs> devices_ns_;
+    std::shared_ptr<PollStatsNs> poll_stats_ns_;
 };
 
 class Monitor
@@ -201,9 +542,13 @@ public:
     Monitor(asio::io_service &io, BatteryNs *);
     void run();
 
+    /// process recorded udev events and attribute values instead of
+    /// the real ones, it is executed instead of run() and io_service
+    void replay(char const *path);
+
+    /// temperature of the main battery
     BasicSource::source_type temperature_source() const
     {
-        // TODO
         return [this]() {
             std::string res("-1");
             if (battery_)
@@ -212,6 +557,17 @@ public:
         };
     }
 
+    /// the last chosen poll interval, seconds
+    BasicSource::source_type poll_interval_source() const
+    {
+        return [this]() { return statefs_attr(poll_interval_.load()); };
+    }
+
+    BasicSource::source_type wakeups_source() const
+    {
+        return [this]() { return statefs_attr(wakeups_.load()); };
+    }
+
 private:
 
     template <BatteryNs::Prop Id, typename T>
@@ -227,11 +583,6 @@ private:
         return std::bind(&Monitor::set_battery_prop<Id, T>, this, _1);
     }
 
-    void calc_limits()
-    {
-        sec_per_percent_max_ = std::max(mw_per_percent_ / denergy_max_, (long)1);
-    }
-
     template <Prop i, typename T>
     void set(T v)
     {
@@ -248,44 +599,83 @@ private:
     template <typename FnT>
     void for_each_power_device(FnT const &fn)
     {
+        record_trigger("enumerate", nullptr);
         before_enumeration();
         udevpp::Enumerate e(root_);
         e.subsystem_add("power_supply");
         auto devs = e.devices();
+        devices_.clear();
+        power_.clear();
         devs.for_each([this, &fn](udevpp::DeviceInfo const &info) {
+                devices_.emplace_back(new CachedDevice(info.path()));
                 fn(udevpp::Device{root_, info.path()});
             });
+        // slots of removed devices are released
+        bat_ns_->sync_devices(power_);
         after_enumeration();
     }
 
+    time_type now() const
+    {
+        return replay_time_ ? replay_time_ : ::time(nullptr);
+    }
+
+    template <typename DeviceT>
+    void on_initial_device(DeviceT &&dev);
+
     void monitor_events();
     void before_enumeration();
-    void on_device(udevpp::Device &&dev);
-    void on_charger(udevpp::Device const &dev);
-    void on_battery(udevpp::Device const &dev);
+    template <typename DeviceT>
+    void on_device(DeviceT &&dev);
+    template <typename DeviceT>
+    void on_event_device(DeviceT &&dev);
+    template <typename PowerSupplyT, typename DeviceT>
+    void on_power_supply(PowerSupplyT const &, DeviceT &&dev);
+    template <typename PowerSupplyT>
+    void on_charger(PowerSupplyT const &);
+    template <typename PowerSupplyT>
+    void on_battery(PowerSupplyT const &);
+    void update_device(std::string const &path, PowerDevice const &);
+    void set_battery(udevpp::Device &&dev);
+    void set_battery(TraceDevice &&) {}
+    void set_battery(CachedDevice &&) {}
     void after_enumeration();
     void notify();
+    bool is_added_or_removed(char const *path);
+    bool refresh();
     void update_info();
+    long poll_interval() const;
     void monitor_timer();
     void monitor_screen(TimerAction);
 
     BatteryNs *bat_ns_;
     asio::io_service &io_;
-    size_t dtimer_sec_;
     long energy_full_;
-    long denergy_max_;
-    long mw_per_percent_;
-    long sec_per_percent_max_;
     udevpp::Root root_;
     udevpp::Monitor mon_;
     asio::posix::stream_descriptor udev_stream_;
     asio::posix::stream_descriptor blanked_stream_;
-    asio::deadline_timer timer_;
+    // CLOCK_BOOTTIME if it is supported by timerfd
+    clockid_t timer_clock_;
+    asio::posix::stream_descriptor timer_;
     state_type last_;
     state_type current_;
-    LastN<long> denergy_;
+    std::unique_ptr<Estimator> denergy_;
+    PollSchedule schedule_;
+    // charging state is changed since the last poll
+    bool is_settling_;
+    bool is_blanked_;
+    // diagnostics, they are read from statefs threads
+    std::atomic<long> poll_interval_;
+    std::atomic<unsigned long> wakeups_;
     std::unique_ptr<udevpp::Device> battery_;
-    std::map<std::string, bool> charger_state_;
+    // all power supplies, battery properties are aggregated over them
+    PowerTable power_;
+    // devices found by the last enumeration, they are refreshed
+    // instead of enumeration until some device is added or removed
+    std::vector<std::unique_ptr<CachedDevice> > devices_;
+    // recorded time while replaying, 0 otherwise
+    time_type replay_time_;
 };
 
 using std::make_tuple;
@@ -317,10 +707,18 @@ class Provider : public statefs::AProvider
 {
 public:
     Provider(statefs_server *server)
-        : AProvider("udev", server)
+        : AProvider(provider_name, server)
     {
-        auto ns = std::make_shared<BatteryNs>();
+        auto state = std::make_shared<statefs::qt::ReadinessNamespace>
+            (provider_name);
+        auto ns = std::make_shared<BatteryNs>(state);
         insert(std::static_pointer_cast<statefs::ANode>(ns));
+        insert(std::static_pointer_cast<statefs::ANode>(ns->charger_ns()));
+        insert(std::static_pointer_cast<statefs::ANode>(ns->devices_ns()));
+        if (statefs::qt::is_stats_enabled())
+            insert(std::static_pointer_cast<statefs::ANode>
+                   (ns->poll_stats_ns()));
+        insert(std::static_pointer_cast<statefs::ANode>(state));
     }
     virtual ~Provider() {}
 
@@ -336,12 +734,144 @@ private:
 
 // ----------------------------------------------------------------------------
 
-BatteryNs::BatteryNs()
+ChargerNs::ChargerNs()
+    : Namespace("Charger")
+    , last_(-1)
+{
+    auto prop = statefs::create(statefs::Discrete{"Online", "0"});
+    online_ = setter(prop);
+    *this << prop;
+}
+
+void ChargerNs::set_online(bool v)
+{
+    if (last_ == (v ? 1 : 0))
+        return;
+    last_ = v ? 1 : 0;
+    online_(statefs_attr(v));
+}
+
+static const std::array<char const*, 6> device_defaults = {{
+        "", "", "0", "0", "0", "0"
+    }};
+
+DeviceNs::DeviceNs(std::string const &name)
+    : Namespace(name.c_str())
+{
+    static const std::array<char const*, prop_count> names = {{
+            "Name", "Type", "Online", "ChargePercentage", "Energy"
+            , "EnergyFull"
+        }};
+    static_assert(device_defaults.size() == prop_count
+                  , "Each property should have default value");
+    for (size_t i = 0; i < prop_count; ++i) {
+        auto prop = statefs::create
+            (statefs::Discrete{names[i], device_defaults[i]});
+        setters_[i] = setter(prop);
+        last_[i] = device_defaults[i];
+        *this << prop;
+    }
+}
+
+void DeviceNs::set(std::string const &name, PowerDevice const &state)
+{
+    typedef PowerDevice::Kind K;
+    auto type = (state.kind == K::Battery
+                 ? "Battery"
+                 : (state.kind == K::Charger ? "Charger" : ""));
+    values_type values = {{
+            name, type, statefs_attr(state.is_online)
+            , statefs_attr(state.capacity), statefs_attr(state.energy_now)
+            , statefs_attr(state.energy_full)
+        }};
+    publish(values);
+}
+
+void DeviceNs::reset()
+{
+    values_type values;
+    std::copy(device_defaults.begin(), device_defaults.end(), values.begin());
+    publish(values);
+}
+
+void DeviceNs::publish(values_type &values)
+{
+    for (size_t i = 0; i < prop_count; ++i) {
+        if (values[i] != last_[i]) {
+            setters_[i](values[i]);
+            last_[i] = std::move(values[i]);
+        }
+    }
+}
+
+const size_t PowerSupplyNs::slot_count;
+
+PowerSupplyNs::PowerSupplyNs()
+    : Namespace("PowerSupply")
+    , is_overflow_reported_(false)
+{
+    for (size_t i = 0; i < slot_count; ++i) {
+        auto &slot = slots_[i];
+        slot.ns = std::make_shared<DeviceNs>(std::to_string(i));
+        insert(std::static_pointer_cast<statefs::ANode>(slot.ns));
+    }
+}
+
+void PowerSupplyNs::set(std::string const &path, PowerDevice const &state)
+{
+    Slot *free_slot = nullptr;
+    for (auto &slot : slots_) {
+        if (slot.path == path) {
+            free_slot = &slot;
+            break;
+        }
+        if (!free_slot && slot.path.empty())
+            free_slot = &slot;
+    }
+    if (!free_slot) {
+        if (!is_overflow_reported_) {
+            std::cerr << "No free PowerSupply slot for " << path << std::endl;
+            is_overflow_reported_ = true;
+        }
+        return;
+    }
+    free_slot->path = path;
+    // syspath basename is the power supply name
+    auto pos = path.rfind('/');
+    free_slot->ns->set(pos == std::string::npos ? path : path.substr(pos + 1)
+                       , state);
+}
+
+void PowerSupplyNs::sync(PowerTable const &devices)
+{
+    for (auto &slot : slots_) {
+        if (!slot.path.empty() && !devices.find(slot.path)) {
+            slot.path.clear();
+            slot.ns->reset();
+        }
+    }
+}
+
+PollStatsNs::PollStatsNs(Monitor const &mon)
+    : Namespace("ProviderStats.udev")
+{
+    auto interval = BasicSource::create(mon.poll_interval_source());
+    *this << statefs::create
+        (statefs::Analog{"PollInterval", "0"}, std::move(interval));
+    auto wakeups = BasicSource::create(mon.wakeups_source());
+    *this << statefs::create
+        (statefs::Analog{"Wakeups", "0"}, std::move(wakeups));
+}
+
+BatteryNs::BatteryNs(statefs::qt::readiness_ptr const &state)
     : Namespace("Battery")
     , mon_(new Monitor(io_, this))
     , analog_info_{{
         BatteryNs::Prop::Temperature, mon_->temperature_source()
             }}
+    , charger_ns_(std::make_shared<ChargerNs>())
+    , devices_ns_(std::make_shared<PowerSupplyNs>())
+    , poll_stats_ns_(std::make_shared<PollStatsNs>(*mon_))
 {
     auto analog_setter = [](std::string const &v) {
         throw cor::Error("Analog property can't be set");
@@ -365,8 +895,33 @@ BatteryNs::BatteryNs()
             *this << prop;
         }
     }
-    mon_->run();
-    monitor_thread_ = cor::make_unique<std::thread>([&io_]() { io_.run(); });
+    if (auto path = statefs::qt::replay_path()) {
+        monitor_thread_ = cor::make_unique<std::thread>([this, state, path]() {
+                state->set_ready();
+                mon_->replay(path);
+            });
+        return;
+    }
+    if (!statefs::qt::is_lazy_init_enabled()) {
+        mon_->run();
+        monitor_thread_ = cor::make_unique<std::thread>([this]() {
+                io_.run();
+            });
+        return;
+    }
+    // devices are enumerated in the monitor thread, so statefs does
+    // not wait for it
+    monitor_thread_ = cor::make_unique<std::thread>([this, state]() {
+            try {
+                mon_->run();
+            } catch (std::exception const &e) {
+                std::cerr << "Battery monitor error: " << e.what()
+                          << std::endl;
+                return;
+            }
+            state->set_ready();
+            io_.run();
+        });
 }
 
 void BatteryNs::set(Prop id, std::string const &v)
@@ -377,9 +932,7 @@ void BatteryNs::set(Prop id, std::string const &v)
 Monitor::Monitor(asio::io_service &io, BatteryNs *bat_ns)
     : bat_ns_(bat_ns)
     , io_(io)
-    , dtimer_sec_(2)
     , energy_full_(800000)
-    , denergy_max_(10000)
     , root_()
     , mon_([this]() {
             if (!root_)
@@ -393,10 +946,26 @@ Monitor::Monitor(asio::io_service &io, BatteryNs *bat_ns)
             return fd;
         }())
     , blanked_stream_(io)
-    , timer_(io)
+    , timer_clock_(CLOCK_BOOTTIME)
+    , timer_(io, [this]() {
+            auto fd = ::timerfd_create(timer_clock_, TFD_NONBLOCK | TFD_CLOEXEC);
+            // CLOCK_BOOTTIME is supported by timerfd since Linux 3.15
+            if (fd < 0 && errno == EINVAL) {
+                timer_clock_ = CLOCK_MONOTONIC;
+                fd = ::timerfd_create(timer_clock_, TFD_NONBLOCK | TFD_CLOEXEC);
+            }
+            if (fd < 0)
+                throw cor::Error("Can't create timerfd");
+            return fd;
+        }())
     , last_{::time(nullptr), false, energy_full_, 0, 100, 36000, 0}
     , current_(last_)
-    , denergy_(6, 10)
+    , denergy_(configured_estimator())
+    , is_settling_(false)
+    , is_blanked_(false)
+    , poll_interval_(0)
+    , wakeups_(0)
+    , replay_time_(0)
     {}
 
 void Monitor::run()
@@ -406,22 +975,104 @@ void Monitor::run()
         blanked_stream_.assign(blanked_fd.release());
     auto on_device_initial = [this](udevpp::Device &&dev)
         {
-            auto t = str_or_default(dev.attr("type"), "");
-            if (t == "Battery") {
-                energy_full_ = attr<long>(dev.attr("energy_full"));
-                std::cerr << "FULL:" << energy_full_ << std::endl;
-            }
-            on_device(std::move(dev));
-            mw_per_percent_ = energy_full_ / 100;
-            calc_limits();
+            on_initial_device(std::move(dev));
         };
 
-    for_each_power_device(on_device_initial);
+    {
+        ProfilePhase phase(provider_name, "enumeration");
+        for_each_power_device(on_device_initial);
+    }
     notify();
     monitor_events();
     monitor_screen(NoTimerAction);
 }
 
+template <typename DeviceT>
+void Monitor::on_initial_device(DeviceT &&dev)
+{
+    on_power_supply(power_supply(dev), std::move(dev));
+    if (power_.energy_full() > 0) {
+        energy_full_ = power_.energy_full();
+        std::cerr << "FULL:" << energy_full_ << std::endl;
+    }
+}
+
+void Monitor::replay(char const *path)
+{
+    trace::Reader reader(path);
+    if (!reader.is_valid()) {
+        std::cerr << "Can't read trace " << path << std::endl;
+        return;
+    }
+
+    // syspath -> attributes
+    std::map<std::string, TraceDevice::attrs_type> devices;
+    // devices in the order of the first read after the trigger
+    std::vector<std::string> paths;
+    trace::Record trigger, rec;
+    bool has_trigger = false, is_initial = true;
+    trace::Pacer pacer;
+    auto start_time = ::time(nullptr);
+
+    // attributes are read after the trigger is recorded, so they
+    // are collected until the next one
+    auto process = [&]() {
+        if (!has_trigger)
+            return;
+        // io_service is stopped by BatteryNs destructor
+        for (auto ms = pacer.delay_ms(trigger.ns); ms
+                 ; ms = pacer.delay_ms(trigger.ns)) {
+            if (io_.stopped())
+                return;
+            ::usleep(std::min(ms, 100) * 1000);
+        }
+        replay_time_ = start_time + trigger.ns / 1000000000ull;
+
+        trace::Decoder d(trigger.data);
+        std::string source, syspath;
+        d.get(source);
+        d.get(syspath);
+        auto device = [&devices](std::string const &p) {
+            return TraceDevice(p, devices[p]);
+        };
+        if (source == "monitor") {
+            before_enumeration();
+            on_event_device(device(syspath));
+            after_enumeration();
+        } else {
+            before_enumeration();
+            for (auto const &p : paths) {
+                if (is_initial && source == "enumerate")
+                    on_initial_device(device(p));
+                else
+                    on_device(device(p));
+            }
+            after_enumeration();
+            is_initial = false;
+        }
+        notify();
+    };
+
+    while (reader.next(rec) && !io_.stopped()) {
+        if (rec.kind == trace::Kind::SysfsRead
+            || rec.kind == trace::Kind::UdevProperty) {
+            trace::Decoder d(rec.data);
+            std::string syspath, name, value;
+            if (!(d.get(syspath) && d.get(name) && d.get(value)))
+                continue;
+            if (std::find(paths.begin(), paths.end(), syspath) == paths.end())
+                paths.push_back(syspath);
+            devices[syspath][name] = value;
+        } else if (rec.kind == trace::Kind::UdevEvent) {
+            process();
+            trigger = std::move(rec);
+            has_trigger = true;
+            paths.clear();
+        }
+    }
+    process();
+}
+
 void Monitor::monitor_events()
 {
     using boost::system::error_code;
@@ -434,10 +1085,18 @@ void Monitor::monitor_events()
             io_.stop();
             return;
         }
-        before_enumeration();
-        on_device(mon_.device(root_));
-        after_enumeration();
-        notify();
+        auto dev = mon_.device(root_);
+        record_trigger("monitor", dev.path());
+        if (is_added_or_removed(dev.path())) {
+            power_.remove(str_or_default(dev.path(), ""));
+            devices_.clear();
+            update_info();
+        } else {
+            before_enumeration();
+            on_event_device(std::move(dev));
+            after_enumeration();
+            notify();
+        }
         monitor_events();
     };
 
@@ -466,8 +1125,13 @@ void Monitor::monitor_screen(TimerAction timer_action)
         auto len = blanked_stream_.read_some(asio::buffer(buf, sizeof(buf)));
         if (len && len < sizeof(buf)) {
             buf[len] = 0;
-            if (::atoi(buf))
+            // values are polled rarely while the screen is blanked,
+            // so they are refreshed also on unblanking
+            auto is_blanked = (::atoi(buf) != 0);
+            if (is_blanked != is_blanked_) {
+                is_blanked_ = is_blanked;
                 update_info();
+            }
         }
         monitor_screen(RestartTimer);
     };
@@ -487,45 +1151,90 @@ void Monitor::monitor_screen(TimerAction timer_action)
 
 void Monitor::before_enumeration()
 {
-    //charger_state_.clear();
+    //power_.clear();
 }
 
 void Monitor::after_enumeration()
 {
-    auto v = std::any_of(charger_state_.begin(), charger_state_.end()
-                          , [](std::pair<std::string, bool> const &nv) {
-                              return nv.second;
-                          });
+    auto v = power_.is_online();
     set<Prop::IsOnline>(v);
+    bat_ns_->set_charger_online(v);
+}
+
+template <typename DeviceT>
+void Monitor::on_device(DeviceT &&dev)
+{
+    on_power_supply(power_supply(dev), std::move(dev));
+}
+
+/// device reported by udev event, its properties are taken from uevent
+template <typename DeviceT>
+void Monitor::on_event_device(DeviceT &&dev)
+{
+    on_power_supply(power_supply(dev, true), std::move(dev));
 }
 
-void Monitor::on_device(udevpp::Device &&dev)
+/// ps refers to dev, so it is not used after dev is moved
+template <typename PowerSupplyT, typename DeviceT>
+void Monitor::on_power_supply(PowerSupplyT const &ps, DeviceT &&dev)
 {
-    auto t = str_or_default(dev.attr("type"), "");
-    if (t == "Mains" || t == "USB") {
-        on_charger(dev);
+    auto kind = ps.kind();
+    if (kind == PowerDevice::Kind::Charger) {
+        on_charger(ps);
         // if (!charger_ || *charger_ != dev)
         //     charger_ = cor::make_unique<udevpp::Device>(std::move(dev));
-    } else if (t == "Battery") {
-        on_battery(dev);
-        // TODO there can be several batteris including also backup battery
-        if (!battery_ || *battery_ != dev)
-            battery_ = cor::make_unique<udevpp::Device>(std::move(dev));
+    } else if (kind == PowerDevice::Kind::Battery) {
+        on_battery(ps);
+        // temperature is taken from the largest battery, not from
+        // the backup one
+        auto main = power_.main_battery();
+        auto path = ps.device().path();
+        if (main && path && !strcmp(main, path))
+            set_battery(std::move(dev));
     }
 }
 
-void Monitor::on_charger(udevpp::Device const &dev)
+void Monitor::set_battery(udevpp::Device &&dev)
 {
-    auto path = attr<std::string>(dev.path());
-    auto is_online = attr<bool>(dev.attr("online"));
-    charger_state_.insert({path, is_online});
+    if (!battery_ || *battery_ != dev)
+        battery_ = cor::make_unique<udevpp::Device>(std::move(dev));
 }
 
-void Monitor::on_battery(udevpp::Device const &dev)
+template <typename PowerSupplyT>
+void Monitor::on_charger(PowerSupplyT const &ps)
 {
-    set<Prop::BatTime>(::time(nullptr));
-    set<Prop::EnergyNow>(attr<long>(dev.attr("energy_now")));
-    set<Prop::Capacity>(attr<long>(dev.attr("capacity")));
+    auto path = attr<std::string>(ps.device().path());
+    auto is_online = ps.get(PowerSupplyInfo::Online) != 0;
+    update_device(path, PowerDevice{
+            PowerDevice::Kind::Charger, is_online, 0, 0, 0});
+}
+
+/// battery properties are the sum (energy) or the weighted average
+/// (capacity) over all batteries
+template <typename PowerSupplyT>
+void Monitor::on_battery(PowerSupplyT const &ps)
+{
+    typedef PowerSupplyInfo I;
+    auto path = attr<std::string>(ps.device().path());
+    // full energy is changed rarely, it is not read separately if
+    // uevent does not contain it
+    auto prev = power_.find(path);
+    auto energy_full = (prev && !ps.has(I::EnergyFull))
+        ? prev->energy_full : ps.get(I::EnergyFull);
+    update_device(path, PowerDevice{
+            PowerDevice::Kind::Battery, false, ps.get(I::EnergyNow)
+                , energy_full, ps.get(I::Capacity)});
+    if (power_.energy_full() > 0)
+        energy_full_ = power_.energy_full();
+    set<Prop::BatTime>(now());
+    set<Prop::EnergyNow>(power_.energy_now());
+    set<Prop::Capacity>(power_.capacity());
+}
+
+void Monitor::update_device(std::string const &path, PowerDevice const &state)
+{
+    power_.update(path, state);
+    bat_ns_->set_device(path, state);
 }
 
 void Monitor::notify()
@@ -548,20 +1257,19 @@ void Monitor::notify()
         std::cerr << "dE=" << de << std::endl;
         if (!de)
             return;
-        denergy_.push(de);
+        denergy_->push(get<Prop::BatTime>(current_), enow);
+        auto rate = std::lround(denergy_->rate());
+        // there are not enough samples yet or the last interval
+        // changed the direction
+        if (!rate || (rate < 0) != (de < 0))
+            rate = de;
+        de = rate;
         if (de < 0) {
-            if (-de > denergy_max_) {
-                denergy_max_ = -de;
-                calc_limits();
-            }
-            de = denergy_.average();
-            std::cerr << "avg=" << de << std::endl;
             auto et = - enow / de;
             set<Prop::TimeToLow>(et);
             set<Prop::TimeToFull>(0);
         } else {
-            de = denergy_.average();
-            auto et = de ? (energy_full_ - enow) / de : 0;
+            auto et = (energy_full_ - enow) / de;
             set<Prop::TimeToLow>(0);
             set<Prop::TimeToFull>(et);
         }
@@ -601,58 +1309,117 @@ void Monitor::notify()
     }
 
     if (is_charging_changed) {
-        denergy_.clear();
-        dtimer_sec_ = 5;
+        denergy_->clear();
+        is_settling_ = true;
         return;
     }
-
     std::cerr << "Changed " << count << std::endl;
-    auto o = get<Prop::IsOnline>(current_);
-    if (o) {
-        std::cerr << "Online" << std::endl;
-        dtimer_sec_ = 4;
-    } else {
-        auto p = get<Prop::Power>(current_);
-        // auto c = get<Prop::Capacity>(current_);
-        dtimer_sec_ = p ? std::max(sec_per_percent_max_ / 2, (long)1) : 5;
-        std::cerr << "dTcalc=" << dtimer_sec_ << std::endl;
-    }
 }
     
+/// udevpp does not provide event action, so device is treated as
+/// added if it is unknown and as removed if its sysfs directory is
+/// absent
+bool Monitor::is_added_or_removed(char const *path)
+{
+    if (!path)
+        return false;
+    auto is_known = std::any_of
+        (devices_.begin(), devices_.end()
+         , [path](std::unique_ptr<CachedDevice> const &d) {
+            return !strcmp(d->path(), path);
+        });
+    return !is_known || ::access(path, F_OK);
+}
+
+/// re-read attributes of known devices, @return false if there are
+/// no known devices or some device is gone
+bool Monitor::refresh()
+{
+    if (devices_.empty())
+        return false;
+
+    record_trigger("refresh", nullptr);
+    before_enumeration();
+    bool is_gone = false;
+    for (auto &dev : devices_) {
+        on_device(*dev);
+        is_gone = is_gone || dev->is_gone();
+    }
+    after_enumeration();
+    if (is_gone)
+        devices_.clear();
+    return !is_gone;
+}
+
 void Monitor::update_info()
 {
-    // if (!(charger_ && battery_)) {
-    using namespace std::placeholders;
-    for_each_power_device(std::bind(&Monitor::on_device, this, _1));
-    // } else {
-    //     on_charger(*charger_);
-    //     on_battery(*battery_);
-    // }
+    if (!refresh()) {
+        for_each_power_device([this](udevpp::Device &&dev) {
+                on_device(std::move(dev));
+            });
+    }
     notify();
 }
 
+/// poll twice per predicted percent change, see PollSchedule
+long Monitor::poll_interval() const
+{
+    return schedule_.interval
+        (energy_full_ / 100, get<Prop::Power>(current_)
+         , is_settling_, is_blanked_);
+}
+
 void Monitor::monitor_timer()
 {
     std::cerr << "Mon Timer\n";
-    auto handler = [this](boost::system::error_code ec) {
+    auto handler = [this](boost::system::error_code ec, std::size_t) {
         std::cerr << "Timer Handler\n";
         if (ec == asio::error::operation_aborted) {
             std::cerr << "Timer is cancelled\n";
             return;
         }
+        // completion could be queued before the timer was cancelled
+        // and re-armed: then the timer is not expired yet (EAGAIN)
+        // and the wait for the new expiration is already pending
+        uint64_t expirations = 0;
+        ssize_t len;
+        while ((len = ::read(timer_.native_handle(), &expirations
+                             , sizeof(expirations))) < 0 && errno == EINTR) {}
+        if (len != sizeof(expirations) || !expirations)
+            return;
+        ++wakeups_;
+        // one poll after the charger change is enough to restart
+        // estimation
+        is_settling_ = false;
         update_info();
         monitor_timer();
     };
-    auto wrapper = [handler](boost::system::error_code ec) {
+    auto wrapper = [handler](boost::system::error_code ec, std::size_t len) {
         try {
-            handler(ec);
+            handler(ec, len);
         } catch(std::exception const &e) {
             std::cerr << "Caught exception: " << e.what() << std::endl;
         }
     };
-        
-    timer_.expires_from_now(boost::posix_time::seconds(dtimer_sec_));
-    timer_.async_wait(wrapper);
+
+    auto interval = poll_interval();
+    poll_interval_ = interval;
+    std::cerr << "dTcalc=" << interval << std::endl;
+
+    // CLOCK_BOOTTIME is running during suspend, so the timer
+    // expires right after resume if the interval is passed
+    timespec now;
+    ::clock_gettime(timer_clock_, &now);
+    uint64_t now_ns = now.tv_sec * 1000000000ull + now.tv_nsec;
+    auto expire_ns = PollSchedule::coalesce
+        (now_ns + interval * 1000000000ull, PollSchedule::slack_ns(interval));
+    itimerspec spec = {};
+    spec.it_value.tv_sec = expire_ns / 1000000000ull;
+    spec.it_value.tv_nsec = expire_ns % 1000000000ull;
+    if (::timerfd_settime(timer_.native_handle(), TFD_TIMER_ABSTIME
+                          , &spec, nullptr) < 0)
+        throw cor::Error("Can't set timerfd");
+    timer_.async_read_some(asio::null_buffers(), wrapper);
 }
 
 
@@ -660,6 +1427,7 @@ static inline Provider *init_provider(statefs_server *server)
 {
     if (provider)
         throw std::logic_error("provider ptr is already set");
+    ProfilePhase phase(provider_name, "load");
     provider = new Provider(server);
     return provider;
 }
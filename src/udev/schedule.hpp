@@ -0,0 +1,97 @@
+#ifndef _STATEFS_PRIVATE_UDEV_SCHEDULE_HPP_
+#define _STATEFS_PRIVATE_UDEV_SCHEDULE_HPP_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+namespace statefs { namespace udev {
+
+/**
+ * Battery poll interval. Most fuel gauges report changes by udev
+ * events, so polling only catches changes missed by the driver and
+ * it is enough to poll twice per predicted 1% capacity change. While
+ * the screen is blanked nobody looks at values, so the interval is
+ * extended further. Intervals are in seconds.
+ */
+class PollSchedule
+{
+public:
+    struct Config
+    {
+        long min_sec;
+        long max_sec;
+        // energy rate is unknown (no samples or energy_now is absent)
+        long unknown_sec;
+        // charging state is changed, rate is estimated from scratch
+        long settle_sec;
+        long blanked_factor;
+        long blanked_max_sec;
+    };
+
+    static Config default_config()
+    {
+        return Config{2, 300, 20, 5, 4, 1200};
+    }
+
+    PollSchedule(Config const &config = default_config())
+        : config_(config)
+    {}
+
+    /**
+     * @param energy_per_percent energy of 1% of the full capacity
+     * @param rate energy change per second, 0 if it is unknown
+     * @param is_settling charger is just (dis)connected
+     */
+    long interval(long energy_per_percent, double rate
+                  , bool is_settling, bool is_blanked) const
+    {
+        long res;
+        if (is_settling) {
+            res = config_.settle_sec;
+        } else if (rate != 0 && energy_per_percent > 0) {
+            auto sec_per_percent = energy_per_percent / std::fabs(rate);
+            // avoid overflow on very low rates
+            res = sec_per_percent < 2.0 * config_.max_sec
+                ? std::lround(sec_per_percent / 2) : config_.max_sec;
+        } else {
+            res = config_.unknown_sec;
+        }
+        res = std::min(std::max(res, config_.min_sec), config_.max_sec);
+        if (is_blanked)
+            res = std::min(res * config_.blanked_factor
+                           , std::max(config_.blanked_max_sec, res));
+        return res;
+    }
+
+    /// timer can be delayed by this amount to be coalesced with other
+    /// wakeups, 1/8 of the interval
+    static uint64_t slack_ns(long interval_sec)
+    {
+        return static_cast<uint64_t>(interval_sec) * 1000000000ull / 8;
+    }
+
+    /**
+     * Expiration time rounded up to the multiple of the slack, so
+     * timers of processes using the same rule expire together.
+     * Timerfd does not use the thread timer slack, so the wakeup is
+     * aligned explicitly. Result is in [expire, expire + slack).
+     */
+    static uint64_t coalesce(uint64_t expire_ns, uint64_t slack_ns)
+    {
+        // align to the second at least: 1/8 of the interval is not
+        // the same for different intervals
+        static const uint64_t sec_ns = 1000000000ull;
+        if (slack_ns < sec_ns)
+            return expire_ns;
+        auto grid = slack_ns / sec_ns * sec_ns;
+        return (expire_ns + grid - 1) / grid * grid;
+    }
+
+private:
+    Config config_;
+};
+
+}}
+
+#endif // _STATEFS_PRIVATE_UDEV_SCHEDULE_HPP_
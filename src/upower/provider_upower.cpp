@@ -27,6 +27,8 @@
 #include <cor/util.hpp>
 #include <cor/error.hpp>
 #include <statefs/qt/dbus.hpp>
+#include <statefs/qt/static_map.hpp>
+#include <statefs/qt/profile.hpp>
 
 #include <math.h>
 #include <iostream>
@@ -36,16 +38,23 @@ namespace statefs { namespace upower {
 
 using statefs::qt::Namespace;
 using statefs::qt::PropertiesSource;
-using statefs::qt::sync;
+using statefs::qt::ProfilePhase;
+using statefs::qt::StaticMapEntry;
+using statefs::qt::Transaction;
+using statefs::qt::make_static_map;
 
 static char const *service_name = "org.freedesktop.UPower";
+static char const *provider_name = "upower";
 
 typedef Bridge::Prop Prop;
 
-const QMap<QString, Prop> Bridge::state_ids_{
+static constexpr StaticMapEntry<Prop> state_entries[] = {
     {"Percentage", Prop::Percentage}, {"OnBattery", Prop::OnBattery}
     , {"OnLowBattery", Prop::LowBattery}, {"TimeToEmpty", Prop::TimeToEmpty}
-    , {"TimeToFull", Prop::TimeToFull}, {"State", Prop::State}};
+    , {"TimeToFull", Prop::TimeToFull}, {"State", Prop::State}
+};
+static constexpr auto state_ids = make_static_map(state_entries);
+static_assert(state_ids.is_perfect(), "Check UPower property names");
 
 const Bridge::state_type Bridge::default_state_{
     {87.0, true, false, 878787, 0, UnknownState}};
@@ -54,6 +63,7 @@ Bridge::Bridge(PowerNs *ns, QDBusConnection &bus)
     : PropertiesSource(ns)
     , bus_(bus)
     , watch_(bus, service_name)
+    , signals_(SignalDispatcher::get(bus, service_name))
     , last_state_(default_state_)
     , new_state_(default_state_)
     , actions_(construct_actions())
@@ -65,79 +75,57 @@ Bridge::actions_type Bridge::construct_actions()
 {
     actions_type res = {{
             [this](Prop, QVariant const &v) {
-                updateProperty("ChargePercentage", round(v.toDouble()));
-                updateProperty("Capacity", v);
+                updateProperty(BatteryProp::ChargePercentage
+                               , round(v.toDouble()));
+                updateProperty(BatteryProp::Capacity, v);
             }, [this](Prop, QVariant const &v) {
-                    updateProperty("OnBattery", v);
+                    updateProperty(BatteryProp::OnBattery, v);
                     if (v.toBool())
-                        updateProperty("TimeUntilFull", 0);
-            }, [this](Prop, QVariant const &v) { updateProperty("LowBattery", v);
-            }, [this](Prop, QVariant const &v) { updateProperty("TimeUntilLow", v);
-            }, [this](Prop, QVariant const &v) { updateProperty("TimeUntilFull", v);
+                        updateProperty(BatteryProp::TimeUntilFull, 0);
+            }, [this](Prop, QVariant const &v) {
+                updateProperty(BatteryProp::LowBattery, v);
+            }, [this](Prop, QVariant const &v) {
+                updateProperty(BatteryProp::TimeUntilLow, v);
+            }, [this](Prop, QVariant const &v) {
+                updateProperty(BatteryProp::TimeUntilFull, v);
             }, [this](Prop, QVariant const &v) {
                 bool is_charging = (v == Charging || v == FullyCharged);
-                updateProperty("IsCharging", is_charging);
+                updateProperty(BatteryProp::IsCharging, is_charging);
                 if (!is_charging || v == FullyCharged)
-                    updateProperty("TimeUntilFull", 0);
+                    updateProperty(BatteryProp::TimeUntilFull, 0);
                 }
         }};
         return res;
 }
 
-void Bridge::update_all_props()
+void Bridge::update_props()
 {
-    auto update = [this]() {
-        auto changed_count = 0;
-        for (size_t i = 0; i != propCount; ++i) {
-            auto const &now = new_state_[i];
-            if (now.isValid() && (now != last_state_[i])) {
-                ++changed_count;
-                actions_[i](static_cast<Prop>(i), now);
-            }
+    // several actions are updating the same properties,
+    // publish only the final values
+    Transaction<PropertiesSource> tx(this);
+    auto changed_count = 0;
+    for (size_t i = 0; i != propCount; ++i) {
+        auto const &now = new_state_[i];
+        if (now.isValid() && (now != last_state_[i])) {
+            ++changed_count;
+            actions_[i](static_cast<Prop>(i), now);
         }
-        if (changed_count)
-            std::copy(new_state_.begin(), new_state_.end(), last_state_.begin());
-    };
-
-    auto setProp = [this](QString const &n, QVariant const &v) {
-        auto it = state_ids_.find(n);
-        if (it == state_ids_.end()) {
-            qWarning() << "Unknown property" << n << v;
-            return;
-        }
-        new_state_[static_cast<size_t>(*it)] = v;
-    };
-
-    auto onDevProps = [setProp, update](QVariantMap const &kv) {
-        for (QString name : {"Percentage", "TimeToEmpty", "TimeToFull", "State"})
-            setProp(name, kv[name]);
-
-        update();
-    };
-
-    auto onMgrProps = [setProp, this, update, onDevProps](QVariantMap const &kv) {
-        for (QString name : {"OnBattery", "OnLowBattery"})
-            setProp(name, kv[name]);
-
-        if (device_props_)
-            async(this, device_props_->GetAll(Device::staticInterfaceName())
-                  , onDevProps);
-        else
-            update();
-    };
-
-    auto getAll = [this, update, onMgrProps, onDevProps]() {
-        if (manager_props_)
-            async(this, manager_props_->GetAll(Manager::staticInterfaceName())
-                  , onMgrProps);
-        else if (device_props_)
-            async(this, device_props_->GetAll(Device::staticInterfaceName())
-                  , onDevProps);
-        else
-            update();
-    };
+    }
+    if (changed_count)
+        std::copy(new_state_.begin(), new_state_.end(), last_state_.begin());
+}
 
-    cor::error_trace_msg_nothrow("Updating upower props", getAll);
+void Bridge::on_props_changed(PropertiesMirror const &src
+                              , QStringList const &names)
+{
+    // mirror reports all interface properties, only known ones are
+    // used
+    for (auto const &name : names) {
+        auto p = state_ids.find(name);
+        if (p)
+            new_state_[static_cast<size_t>(*p)] = src.value(name);
+    }
+    update_props();
 }
 
 bool Bridge::try_get_battery(QString const &path)
@@ -154,24 +142,43 @@ bool Bridge::try_get_battery(QString const &path)
         device_ = std::move(device);
         device_path_ = path;
         if (device_) {
-            device_props_.reset(new Properties(service_name, path, bus_));
-            connect(device_.get(), &Device::Changed
-                    , this, &Bridge::update_all_props);
+            device_props_.reset(new PropertiesMirror
+                                (bus_, service_name, path
+                                 , Device::staticInterfaceName()));
+            // legacy UPower emits only Changed w/o values
+            auto props = device_props_.get();
+            signals_->subscribe<>
+                (device_.get(), path, Device::staticInterfaceName()
+                 , "Changed", [props]() { props->refresh(); });
             found = true;
         } else {
             qWarning() << "No battery found";
         }
     };
     cor::error_trace_msg_nothrow("Checking is device battery", getBattery);
-    if (found)
-        update_all_props();
+    if (found) {
+        auto props = device_props_.get();
+        props->init([this, props](QStringList const &names) {
+                on_props_changed(*props, names);
+            });
+    }
     return found;
 }
 
 void Bridge::init_manager()
 {
-    manager_.reset(new Manager(service_name, "/org/freedesktop/UPower", bus_));
-    manager_props_.reset(new Properties(service_name, "/org/freedesktop/UPower", bus_));
+    static char const *manager_path = "/org/freedesktop/UPower";
+    {
+        ProfilePhase phase(provider_name, "Manager proxy");
+        manager_.reset(new Manager(service_name, manager_path, bus_));
+    }
+    manager_props_.reset(new PropertiesMirror
+                         (bus_, service_name, manager_path
+                          , Manager::staticInterfaceName()));
+    auto props = manager_props_.get();
+    props->init([this, props](QStringList const &names) {
+            on_props_changed(*props, names);
+        });
     auto find_battery = [this](QList<QDBusObjectPath> const &devices) {
         qDebug() << "found " << devices.size() << " upower device(s)";
         std::find_if(devices.begin(), devices.end()
@@ -181,53 +188,64 @@ void Bridge::init_manager()
     };
 
     qDebug() << "Enumerating upower devices";
-    async(this, manager_->EnumerateDevices(), find_battery);
-    connect(manager_.get(), &Manager::Changed
-            , this, &Bridge::update_all_props);
-    using namespace std::placeholders;
-    connect(manager_.get(), &Manager::DeviceAdded
-            , this, &Bridge::try_get_battery);
-    connect(manager_.get(), &Manager::DeviceRemoved
-            , [this](QString const &path) {
-                if (path == device_path_) {
-                    reset_device();
-                }
-            });
+    async(this, manager_->EnumerateDevices(), find_battery
+          , "org.freedesktop.UPower.EnumerateDevices");
+    auto ctx = manager_.get();
+    auto interface = Manager::staticInterfaceName();
+    signals_->subscribe<>
+        (ctx, manager_path, interface, "Changed"
+         , [props]() { props->refresh(); });
+    signals_->subscribe<QString>
+        (ctx, manager_path, interface, "DeviceAdded"
+         , [this](QString const &path) { try_get_battery(path); });
+    signals_->subscribe<QString>
+        (ctx, manager_path, interface, "DeviceRemoved"
+         , [this](QString const &path) {
+            if (path == device_path_) {
+                reset_device();
+            }
+        });
 }
 
 void Bridge::reset_device()
 {
+    device_props_.reset();
     device_.reset();
     device_path_ = "";
-    update_all_props();
 }
 
 void Bridge::init()
 {
     auto reset_manager = [this]() {
         reset_device();
+        manager_props_.reset();
         manager_.reset();
-        update_all_props();
     };
     watch_.init([this]() { init_manager(); }, reset_manager);
+    // upower restart should not cause two waves of changes
+    watch_.set_policy(statefs::qt::ServiceWatch::hold_values_policy()
+                      , [this]() { beginUpdate(); }
+                      , [this]() { commitUpdate(); });
     init_manager();
 }
 
-PowerNs::PowerNs(QDBusConnection &bus)
-    : Namespace("Battery", std::unique_ptr<PropertiesSource>
-                (new Bridge(this, bus)))
-    , defaults_{
+static constexpr statefs::qt::PropertyInfo battery_schema[] = {
     { "ChargePercentage", "87" }
     , { "Capacity", "87" }
     , { "OnBattery", "1" }
     , { "LowBattery", "0" }
     , { "TimeUntilLow", "878787" }
     , { "TimeUntilFull", "0" }
-    , { "IsCharging", "0" }}
+    , { "IsCharging", "0" }
+};
+static_assert(statefs::qt::is_valid_schema<BatteryProp>(battery_schema)
+              , "Check Battery properties schema");
+
+PowerNs::PowerNs(QDBusConnection &bus)
+    : Namespace("Battery", std::unique_ptr<PropertiesSource>
+                (new Bridge(this, bus)))
 {
-    for (auto v : defaults_)
-        addProperty(v.first, v.second);
-    src_->init();
+    addProperties(battery_schema);
 }
 
 class Provider;
@@ -237,11 +255,13 @@ class Provider : public statefs::AProvider
 {
 public:
     Provider(statefs_server *server)
-        : AProvider("upower", server)
+        : AProvider(provider_name, server)
         , bus_(QDBusConnection::systemBus())
     {
         auto ns = std::make_shared<PowerNs>(bus_);
         insert(std::static_pointer_cast<statefs::ANode>(ns));
+        statefs::qt::insert_diagnostics
+            (*this, *ns, provider_name, service_name);
     }
     virtual ~Provider() {}
 
@@ -258,6 +278,7 @@ private:
 
 static inline Provider *init_provider(statefs_server *server)
 {
+    ProfilePhase phase(provider_name, "load");
     if (provider)
         throw std::logic_error("provider ptr is already set");
     provider = new Provider(server);
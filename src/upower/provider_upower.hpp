@@ -3,12 +3,13 @@
 
 #include "manager_interface.h"
 #include "device_interface.h"
-#include "prop_interface.h"
 
 #include <statefs/provider.hpp>
 #include <statefs/property.hpp>
 #include <statefs/qt/ns.hpp>
 #include <statefs/qt/dbus.hpp>
+#include <statefs/qt/dispatcher.hpp>
+#include <statefs/qt/properties.hpp>
 
 #include <QObject>
 
@@ -16,10 +17,24 @@ namespace statefs { namespace upower {
 
 typedef OrgFreedesktopUPowerInterface Manager;
 typedef OrgFreedesktopUPowerDeviceInterface Device;
-typedef OrgFreedesktopDBusPropertiesInterface Properties;
+using statefs::qt::PropertiesMirror;
+using statefs::qt::SignalDispatcher;
 
 class PowerNs;
 
+// Battery namespace properties, see the schema in provider_upower.cpp
+enum class BatteryProp {
+    ChargePercentage,
+    Capacity,
+    OnBattery,
+    LowBattery,
+    TimeUntilLow,
+    TimeUntilFull,
+    IsCharging,
+
+    EOE
+};
+
 class Bridge : public QObject, public statefs::qt::PropertiesSource
 {
     Q_OBJECT;
@@ -58,29 +73,30 @@ public:
     virtual void init();
 
 private slots:
-    void update_all_props();
     bool try_get_battery(QString const &);
 
 private:
 
     void init_manager();
     void reset_device();
+    void on_props_changed(PropertiesMirror const &, QStringList const &);
+    void update_props();
 
     QDBusConnection &bus_;
     QDBusObjectPath defaultAdapter_;
 
     std::unique_ptr<Manager> manager_;
-    std::unique_ptr<Properties> manager_props_;
+    std::unique_ptr<PropertiesMirror> manager_props_;
 
     std::unique_ptr<Device> device_;
-    std::unique_ptr<Properties> device_props_;
+    std::unique_ptr<PropertiesMirror> device_props_;
 
     QString device_path_;
     statefs::qt::ServiceWatch watch_;
+    std::shared_ptr<SignalDispatcher> signals_;
 
     static const size_t propCount = static_cast<size_t>(Prop::EOE);
     typedef std::array<QVariant, propCount> state_type;
-    static const QMap<QString, Prop> state_ids_;
     static const state_type default_state_;
     state_type last_state_;
     state_type new_state_;
@@ -99,8 +115,6 @@ class PowerNs : public statefs::qt::Namespace
 public:
 
     PowerNs(QDBusConnection &bus);
-private:
-    statefs::qt::DefaultProperties defaults_;
 };
 
 }}
@@ -0,0 +1,126 @@
+#include <statefs/qt/dbus.hpp>
+
+#include <algorithm>
+
+namespace statefs { namespace qt {
+
+ServiceWatch::ServiceWatch(QDBusConnection &bus, QString const &service)
+    : bus_(bus)
+    , service_(service)
+    , is_lost_(false)
+    , is_resyncing_(false)
+    , restarts_(0)
+{
+    grace_timer_.setSingleShot(true);
+    register_timer_.setSingleShot(true);
+    settle_timer_.setSingleShot(true);
+    connect(&grace_timer_, &QTimer::timeout
+            , this, &ServiceWatch::grace_expired);
+    connect(&register_timer_, &QTimer::timeout
+            , this, &ServiceWatch::registered);
+    connect(&settle_timer_, &QTimer::timeout
+            , this, &ServiceWatch::end_resync);
+}
+
+void ServiceWatch::set_policy(Policy const &policy
+                              , handler_type const &begin_resync
+                              , handler_type const &end_resync)
+{
+    policy_ = policy;
+    begin_resync_ = begin_resync;
+    end_resync_ = end_resync;
+}
+
+void ServiceWatch::call(handler_type const &fn, char const *what)
+{
+    if (!fn)
+        return;
+    try {
+        fn();
+    } catch(std::exception const &e) {
+        qWarning() << "Exception " << e.what() << " handling "
+                   << service_ << " " << what;
+    }
+}
+
+void ServiceWatch::owner_changed(QString const &serviceName
+                                 , QString const &
+                                 , QString const &newOwner)
+{
+    if (newOwner == "") {
+        qDebug() << serviceName << " is unregistered";
+        unregistered();
+        return;
+    }
+
+    qDebug() << serviceName << " is registered";
+    uptime_.start();
+    if (restarts_ && policy_.backoff_ms > 0) {
+        auto shift = std::min(restarts_ - 1, 16u);
+        auto delay = std::min(policy_.backoff_ms << shift
+                              , policy_.max_backoff_ms);
+        qDebug() << serviceName << " is restarting, delay "
+                 << delay << "ms";
+        register_timer_.start(delay);
+    } else {
+        registered();
+    }
+}
+
+void ServiceWatch::unregistered()
+{
+    // service was not re-initialized yet if it is died during backoff
+    register_timer_.stop();
+    if (uptime_.isValid() && uptime_.elapsed() < policy_.stable_ms)
+        ++restarts_;
+    else
+        restarts_ = 0;
+    uptime_.invalidate();
+
+    end_resync();
+    if (policy_.grace_ms <= 0) {
+        call(on_unregister_, "unregistration");
+        return;
+    }
+    if (!is_lost_) {
+        is_lost_ = true;
+        grace_timer_.start(policy_.grace_ms);
+    }
+}
+
+void ServiceWatch::grace_expired()
+{
+    if (!is_lost_)
+        return;
+    // service is not back or is still waiting for backoff, held
+    // values are not actual anymore
+    is_lost_ = false;
+    call(on_unregister_, "unregistration");
+}
+
+void ServiceWatch::registered()
+{
+    if (!is_lost_) {
+        call(on_register_, "registration");
+        return;
+    }
+
+    grace_timer_.stop();
+    is_lost_ = false;
+    is_resyncing_ = true;
+    call(begin_resync_, "resync");
+    call(on_unregister_, "unregistration");
+    call(on_register_, "registration");
+    settle_timer_.start(std::max(policy_.settle_ms, 0));
+}
+
+void ServiceWatch::end_resync()
+{
+    if (!is_resyncing_)
+        return;
+    settle_timer_.stop();
+    is_resyncing_ = false;
+    call(end_resync_, "resync");
+}
+
+}}
@@ -0,0 +1,213 @@
+#include <statefs/qt/dispatcher.hpp>
+#include <statefs/qt/record.hpp>
+
+#include <QDBusVariant>
+
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+
+namespace statefs { namespace qt {
+
+Subscription::Subscription(std::shared_ptr<SignalDispatcher> const &dispatcher
+                           , QString const &path, unsigned id)
+    : dispatcher_(dispatcher), path_(path), id_(id)
+{}
+
+Subscription::Subscription(Subscription &&from)
+    : dispatcher_(std::move(from.dispatcher_))
+    , path_(from.path_)
+    , id_(from.id_)
+{
+    from.id_ = 0;
+}
+
+Subscription & Subscription::operator =(Subscription &&from)
+{
+    if (this != &from) {
+        reset();
+        dispatcher_ = std::move(from.dispatcher_);
+        path_ = from.path_;
+        id_ = from.id_;
+        from.id_ = 0;
+    }
+    return *this;
+}
+
+void Subscription::reset()
+{
+    if (dispatcher_ && id_)
+        dispatcher_->unsubscribe(path_, id_);
+    dispatcher_.reset();
+    id_ = 0;
+}
+
+SignalDispatcher::SignalDispatcher(QDBusConnection const &bus
+                                   , QString const &service)
+    : bus_(bus)
+    , service_(service)
+    , last_id_(0)
+    , dispatch_depth_(0)
+    , has_garbage_(false)
+{
+    trace::record_service(service);
+}
+
+SignalDispatcher::~SignalDispatcher()
+{
+    for (auto const &interface : interfaces_)
+        bus_.disconnect(service_, QString(), interface, QString()
+                        , this, SLOT(handle(QDBusMessage)));
+}
+
+std::shared_ptr<SignalDispatcher> SignalDispatcher::get
+(QDBusConnection const &bus, QString const &service)
+{
+    typedef std::pair<QString, QString> key_type;
+    static std::map<key_type, std::weak_ptr<SignalDispatcher> > dispatchers;
+
+    auto &p = dispatchers[key_type(bus.name(), service)];
+    auto res = p.lock();
+    if (!res) {
+        res = std::make_shared<SignalDispatcher>(bus, service);
+        p = res;
+    }
+    return res;
+}
+
+Subscription SignalDispatcher::subscribe_raw
+(QString const &path, QString const &interface
+ , QString const &member, handler_type const &fn)
+{
+    if (interface.isEmpty())
+        throw std::logic_error("Signal interface should be set");
+
+    if (!interfaces_.contains(interface)) {
+        if (bus_.connect(service_, QString(), interface, QString()
+                         , this, SLOT(handle(QDBusMessage))))
+            interfaces_.insert(interface);
+        else
+            qWarning() << "Can't subscribe to" << service_ << interface
+                       << "signals";
+    }
+
+    Handler h{++last_id_, interface, member, fn};
+    if (dispatch_depth_)
+        added_.push_back(std::make_pair(path, std::move(h)));
+    else
+        handlers_[path].push_back(std::move(h));
+    return Subscription(shared_from_this(), path, last_id_);
+}
+
+Subscription SignalDispatcher::subscribe_property_changed
+(QString const &path, QString const &interface
+ , property_changed_type const &fn)
+{
+    static const int variant_type = qMetaTypeId<QDBusVariant>();
+    auto on_signal = [fn](QDBusMessage const &msg) {
+        auto const args = msg.arguments();
+        if (args.size() < 2
+            || args[0].userType() != QMetaType::QString
+            || args[1].userType() != variant_type) {
+            qWarning() << "Unexpected PropertyChanged signature"
+                       << msg.signature() << "from" << msg.path();
+            return;
+        }
+        auto const &name = *reinterpret_cast<QString const*>
+            (args[0].constData());
+        auto const &boxed = *reinterpret_cast<QDBusVariant const*>
+            (args[1].constData());
+        fn(name, boxed.variant());
+    };
+    return subscribe_raw(path, interface, "PropertyChanged", on_signal);
+}
+
+void SignalDispatcher::bind(QObject *context, Subscription &&src)
+{
+    auto sub = new Subscription(std::move(src));
+    connect(context, &QObject::destroyed, [sub]() { delete sub; });
+}
+
+void SignalDispatcher::unsubscribe(QString const &path, unsigned id)
+{
+    auto is_match = [id](Handler const &h) { return h.id == id; };
+    for (auto it = added_.begin(); it != added_.end(); ++it) {
+        if (it->second.id == id) {
+            added_.erase(it);
+            return;
+        }
+    }
+
+    auto pitems = handlers_.find(path);
+    if (pitems == handlers_.end())
+        return;
+    auto &items = pitems.value();
+    auto pitem = std::find_if(items.begin(), items.end(), is_match);
+    if (pitem == items.end())
+        return;
+
+    if (dispatch_depth_) {
+        pitem->id = 0;
+        has_garbage_ = true;
+    } else {
+        items.erase(pitem);
+        if (items.empty())
+            handlers_.erase(pitems);
+    }
+}
+
+void SignalDispatcher::handle(QDBusMessage const &msg)
+{
+    // last subscription can be released by the handler
+    auto self = shared_from_this();
+    trace::record_signal(service_, msg);
+    ++dispatch_depth_;
+    dispatch(msg.path(), msg);
+    dispatch(QString(), msg);
+    if (!--dispatch_depth_)
+        collect_garbage();
+}
+
+void SignalDispatcher::dispatch(QString const &path, QDBusMessage const &msg)
+{
+    auto pitems = handlers_.constFind(path);
+    if (pitems == handlers_.constEnd())
+        return;
+
+    auto const interface = msg.interface();
+    auto const member = msg.member();
+    for (auto const &h : pitems.value()) {
+        if (!h.id || h.interface != interface
+            || (!h.member.isEmpty() && h.member != member))
+            continue;
+        try {
+            h.fn(msg);
+        } catch (std::exception const &e) {
+            qWarning() << "Exception " << e.what() << " handling "
+                       << interface << "." << member;
+        }
+    }
+}
+
+void SignalDispatcher::collect_garbage()
+{
+    if (has_garbage_) {
+        has_garbage_ = false;
+        for (auto it = handlers_.begin(); it != handlers_.end();) {
+            auto &items = it.value();
+            items.erase(std::remove_if(items.begin(), items.end()
+                                       , [](Handler const &h) {
+                                           return !h.id;
+                                       }), items.end());
+            if (items.empty())
+                it = handlers_.erase(it);
+            else
+                ++it;
+        }
+    }
+    for (auto &v : added_)
+        handlers_[v.first].push_back(std::move(v.second));
+    added_.clear();
+}
+
+}}
@@ -1,83 +1,474 @@
 #include <cor/trace.hpp>
 #include <statefs/qt/ns.hpp>
+#include <statefs/qt/stats.hpp>
+#include <statefs/qt/value.hpp>
+#include <QCoreApplication>
 #include <QDebug>
+#include <QEvent>
+#include <QTimer>
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
 
 namespace statefs { namespace qt {
 
+namespace {
+
+class ReadersEvent : public QEvent
+{
+public:
+    ReadersEvent(size_t idx, bool is_connected)
+        : QEvent(event_type()), index(idx), is_connected(is_connected)
+    {}
+
+    static QEvent::Type event_type()
+    {
+        static const auto id = static_cast<QEvent::Type>
+            (QEvent::registerEventType());
+        return id;
+    }
+
+    size_t index;
+    bool is_connected;
+};
+
+}
+
+/**
+ * statefs connects and disconnects property slots from its own
+ * thread, so notifications are posted to the namespace thread as
+ * events. Monitor is shared with property handlers and it is
+ * detached when the namespace is destroyed.
+ */
+class ReadersMonitor : public QObject
+{
+public:
+    ReadersMonitor(Namespace *ns) : ns_(ns) {}
+
+    void post(size_t idx, bool is_connected)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (ns_)
+            QCoreApplication::postEvent
+                (this, new ReadersEvent(idx, is_connected));
+    }
+
+    void detach()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ns_ = nullptr;
+    }
+
+protected:
+    virtual bool event(QEvent *e)
+    {
+        if (e->type() != ReadersEvent::event_type())
+            return QObject::event(e);
+
+        auto ev = static_cast<ReadersEvent*>(e);
+        // namespace is destroyed in this thread, so it is not
+        // detached while the event is processed
+        if (ns_)
+            ns_->readersChanged(ev->index, ev->is_connected);
+        return true;
+    }
+
+private:
+    std::mutex mutex_;
+    Namespace *ns_;
+};
+
+namespace {
+
+// value of the discrete property shared by the statefs property
+// handler and the setter
+struct DiscreteValue
+{
+    DiscreteValue(char const *def_val
+                  , std::shared_ptr<ReadersMonitor> const &monitor
+                  , size_t idx)
+        : value(def_val), slot(nullptr), parent(nullptr)
+        , monitor(monitor), index(idx)
+    {}
+
+    int update(std::string const &);
+
+    std::mutex mutex;
+    std::string value;
+    statefs_slot *slot;
+    statefs::AProperty *parent;
+    std::shared_ptr<ReadersMonitor> monitor;
+    size_t index;
+};
+
+int DiscreteValue::update(std::string const &v)
+{
+    statefs_slot *s;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (v == value)
+            return statefs::PropertyUnchanged;
+        value = v;
+        s = slot;
+    }
+    if (s)
+        s->on_changed(s, parent);
+    return statefs::PropertyChanged;
+}
+
+/**
+ * Discrete property handler, it behaves as the statefs::Discrete
+ * property and also reports connection of readers to the namespace
+ */
+class DiscreteMonitor
+{
+public:
+    DiscreteMonitor(statefs::AProperty *parent
+                    , std::shared_ptr<DiscreteValue> const &value)
+        : v_(value)
+    {
+        v_->parent = parent;
+    }
+
+    int getattr() const
+    {
+        return STATEFS_ATTR_READ | STATEFS_ATTR_DISCRETE;
+    }
+
+    ssize_t size() const
+    {
+        std::lock_guard<std::mutex> lock(v_->mutex);
+        return v_->value.size();
+    }
+
+    bool connect(statefs_slot *slot)
+    {
+        {
+            std::lock_guard<std::mutex> lock(v_->mutex);
+            v_->slot = slot;
+        }
+        v_->monitor->post(v_->index, true);
+        return true;
+    }
+
+    void disconnect()
+    {
+        {
+            std::lock_guard<std::mutex> lock(v_->mutex);
+            v_->slot = nullptr;
+        }
+        v_->monitor->post(v_->index, false);
+    }
+
+    // value snapshot is taken on the read from the beginning
+    int read(std::string *h, char *dst, size_t len, off_t off)
+    {
+        if (!off) {
+            std::lock_guard<std::mutex> lock(v_->mutex);
+            *h = v_->value;
+        }
+        auto size = h->size();
+        auto pos = static_cast<size_t>(off);
+        if (off < 0 || pos >= size)
+            return 0;
+
+        auto count = std::min(len, size - pos);
+        memcpy(dst, h->data() + off, count);
+        return count;
+    }
+
+    int write(std::string *, char const *, size_t, off_t)
+    {
+        return -1;
+    }
+
+    void release() {}
+
+private:
+    std::shared_ptr<DiscreteValue> v_;
+};
+
+}
+
+const size_t Namespace::npos;
+
 Namespace::Namespace(char const *name
                      , std::unique_ptr<PropertiesSource> &&src)
     : statefs::Namespace(name)
     , src_(std::move(src))
+    , schema_(nullptr)
+    , schema_size_(0)
+    , transaction_depth_(0)
+    , readers_(new ReadersMonitor(this), [](ReadersMonitor *p) {
+            // the last reference can be released by the property
+            // handler in the statefs thread
+            p->deleteLater();
+        })
+    , is_started_(false)
+{
+}
+
+Namespace::~Namespace()
+{
+    readers_->detach();
+}
+
+bool Namespace::hasReaders(size_t idx) const
+{
+    return idx < props_.size() && props_[idx].readers;
+}
+
+void Namespace::readersChanged(size_t idx, bool is_connected)
+{
+    if (idx >= props_.size())
+        return;
+
+    auto &prop = props_[idx];
+    auto had_readers = (prop.readers != 0);
+    if (is_connected)
+        ++prop.readers;
+    else if (prop.readers)
+        --prop.readers;
+
+    auto has_readers = (prop.readers != 0);
+    if (has_readers == had_readers)
+        return;
+
+    qDebug() << prop.name << (has_readers ? "is opened" : "is closed");
+    // somebody is waiting for the value, no reason to postpone
+    if (has_readers && init_timer_ && !is_started_)
+        startSource();
+    if (has_readers) {
+        if (auto owner = source_owner_.lock())
+            owner->startSource();
+    }
+    if (src_)
+        src_->readersChanged(idx, has_readers);
+}
+
+void Namespace::initSource(readiness_ptr const &state)
+{
+    readiness_ = state;
+    if (!is_lazy_init_enabled()) {
+        startSource();
+        return;
+    }
+
+    init_timer_.reset(new QTimer());
+    init_timer_->setSingleShot(true);
+    QObject::connect(init_timer_.get(), &QTimer::timeout
+                     , [this]() { startSource(); });
+    init_timer_->start(lazy_init_delay());
+}
+
+void Namespace::followSource(std::weak_ptr<Namespace> const &owner)
 {
+    source_owner_ = owner;
+}
+
+void Namespace::startSource()
+{
+    if (is_started_)
+        return;
+
+    is_started_ = true;
+    if (init_timer_)
+        init_timer_->stop();
+    if (src_) {
+        ProfilePhase phase(readiness_ ? readiness_->provider().c_str() : ""
+                           , "init");
+        src_->init();
+    }
+    if (readiness_)
+        readiness_->set_ready();
+}
+
+size_t Namespace::propertyIndex(QString const &src_name) const
+{
+    auto it = src_index_.find(src_name);
+    return (it != src_index_.end()) ? it.value() : npos;
 }
 
 void Namespace::setProperties(QVariantMap const &src)
 {
-    for (auto kv : setters_for_props_) {
-        auto name = kv.first;
-        auto psrc = src.find(name);
-        if (psrc != src.end()) {
-            auto set = kv.second;
-            set(valueEncode(psrc.value()).toStdString());
+    Transaction<Namespace> tx(this);
+    for (auto it = src.begin(); it != src.end(); ++it) {
+        auto pidx = src_index_.find(it.key());
+        if (pidx != src_index_.end()) {
+            encode(it.value(), buffer_);
+            publish(pidx.value(), buffer_);
         }
     }
 }
 
 void Namespace::setProperties(std::map<QString, QVariant> const &src)
 {
-    for (auto kv : setters_for_props_) {
-        auto name = kv.first;
-        auto psrc = src.find(name);
-        if (psrc != src.end()) {
-            auto set = kv.second;
-            set(valueEncode(psrc->second).toStdString());
+    Transaction<Namespace> tx(this);
+    for (auto const &kv : src) {
+        auto pidx = src_index_.find(kv.first);
+        if (pidx != src_index_.end()) {
+            encode(kv.second, buffer_);
+            publish(pidx.value(), buffer_);
         }
     }
 }
 
 void Namespace::setProperties(DefaultProperties const &src)
 {
+    Transaction<Namespace> tx(this);
     for (auto const &nv : src) {
         if (!nv.second)
             continue;
 
-        auto p = setters_for_props_.find(nv.first);
-        if (p != setters_for_props_.end()) {
-            auto set = p->second;
-            set(std::string(nv.second));
+        auto pidx = name_index_.find(QLatin1String(nv.first));
+        if (pidx != name_index_.end()) {
+            buffer_.assign(nv.second);
+            publish(pidx.value(), buffer_);
         }
     }
 }
 
-
 void Namespace::updateProperty(const QString &name, const QVariant &value)
 {
-    auto it = setters_for_props_.find(name);
-    if (it != setters_for_props_.end()) {
-        auto &set = it->second;
-        auto encoded = valueEncode(value);
-        trace() << name << "=" << value << "->" << encoded;
-        set(encoded.toStdString());
-    } else {
+    auto pidx = src_index_.find(name);
+    if (pidx != src_index_.end())
+        updateProperty(pidx.value(), value);
+    else
         qWarning() << "No setter for " << name;
+}
+
+void Namespace::updateProperty(size_t idx, const QVariant &value)
+{
+    if (idx >= props_.size()) {
+        qWarning() << "No property with index " << idx;
+        return;
     }
+    trace() << props_[idx].name << "=" << value;
+    encode(value, buffer_);
+    publish(idx, buffer_);
 }
 
-void Namespace::addProperty(char const *name
-                            , char const *def_val
-                            , char const *src_name)
+void Namespace::beginUpdate()
 {
-    using statefs::Discrete;
-    auto d = Discrete(name, def_val);
-    auto prop = statefs::create(d);
+    ++transaction_depth_;
+}
+
+void Namespace::commitUpdate()
+{
+    if (!transaction_depth_) {
+        qWarning() << "commitUpdate() w/o beginUpdate()";
+        return;
+    }
+    if (--transaction_depth_)
+        return;
+
+    for (auto idx : staged_) {
+        auto &prop = props_[idx];
+        prop.is_staged = false;
+        apply(prop, prop.pending);
+    }
+    staged_.clear();
+}
+
+bool Namespace::publish(size_t idx, std::string &value)
+{
+    auto &prop = props_[idx];
+    ++counters_.updates;
+    if (!transaction_depth_)
+        return apply(prop, value);
+
+    if (prop.is_staged) {
+        // intermediate value is overwritten and never published
+        ++counters_.suppressed;
+    } else {
+        prop.is_staged = true;
+        staged_.push_back(idx);
+    }
+    prop.pending.swap(value);
+    return true;
+}
+
+bool Namespace::apply(Property &prop, std::string &value)
+{
+    if (value == prop.last) {
+        ++counters_.suppressed;
+        return false;
+    }
+    prop.last.swap(value);
+    prop.set(prop.last);
+    return true;
+}
+
+size_t Namespace::addProperty(char const *name
+                              , char const *def_val
+                              , char const *src_name)
+{
+    typedef statefs::BasicPropertyOwner<DiscreteMonitor, std::string>
+        property_type;
+    auto idx = props_.size();
+    auto value = std::make_shared<DiscreteValue>(def_val, readers_, idx);
+    auto prop = std::make_shared<property_type>(name, value);
     *this << prop;
-    setters_for_props_[src_name] = setter(prop);
+
+    auto set = [value](std::string const &v) {
+        return value->update(v);
+    };
+    props_.push_back(Property{QString(src_name), set
+                , std::string(def_val), std::string(), false, 0});
+    src_index_[props_.back().name] = idx;
+    name_index_[QLatin1String(name)] = idx;
+    return idx;
 }
 
-void Namespace::addProperty(char const *name
-                            , char const *def_val)
+size_t Namespace::addProperty(char const *name
+                              , char const *def_val)
 {
-    addProperty(name, def_val, name);
+    return addProperty(name, def_val, name);
+}
+
+void Namespace::addProperties(PropertyInfo const *info, size_t count)
+{
+    if (!props_.empty() || schema_)
+        throw std::logic_error("Schema should be added to the empty namespace");
+
+    props_.reserve(count);
+    for (size_t i = 0; i < count; ++i)
+        addProperty(info[i].name, info[i].default_value, info[i].source);
+    schema_ = info;
+    schema_size_ = count;
+}
+
+void Namespace::setDefaults()
+{
+    Transaction<Namespace> tx(this);
+    for (size_t i = 0; i < schema_size_; ++i) {
+        buffer_.assign(schema_[i].default_value);
+        publish(i, buffer_);
+    }
+}
+
+void Namespace::resetProperty(size_t idx)
+{
+    if (idx >= schema_size_) {
+        qWarning() << "No schema property with index " << idx;
+        return;
+    }
+    buffer_.assign(schema_[idx].default_value);
+    publish(idx, buffer_);
+}
+
+PropertyRoutes::PropertyRoutes(std::initializer_list<Route> routes)
+{
+    for (auto const &r : routes)
+        index_.insert(QString(r.name), r.index);
+}
+
+size_t PropertyRoutes::find(QString const &name) const
+{
+    auto it = index_.constFind(name);
+    return (it != index_.constEnd()) ? it.value() : Namespace::npos;
 }
 
 void PropertiesSource::setProperties(QVariantMap const &src)
@@ -96,4 +487,53 @@ void PropertiesSource::updateProperty
     target_->updateProperty(name, value);
 }
 
+void PropertiesSource::updateProperty(size_t idx, const QVariant &value)
+{
+    target_->updateProperty(idx, value);
+}
+
+void PropertiesSource::resetProperty(size_t idx)
+{
+    target_->resetProperty(idx);
+}
+
+bool PropertiesSource::updateProperty
+(PropertyRoutes const &routes, const QString &name, const QVariant &value)
+{
+    auto idx = routes.find(name);
+    if (idx == Namespace::npos)
+        return false;
+    target_->updateProperty(idx, value);
+    return true;
+}
+
+bool PropertiesSource::hasReaders(size_t idx) const
+{
+    return target_->hasReaders(idx);
+}
+
+void PropertiesSource::beginUpdate()
+{
+    target_->beginUpdate();
+}
+
+void PropertiesSource::commitUpdate()
+{
+    target_->commitUpdate();
+}
+
+void insert_diagnostics(statefs::AProvider &provider, Namespace &ns
+                        , char const *provider_name
+                        , char const *service_name)
+{
+    auto state = std::make_shared<ReadinessNamespace>(provider_name);
+    provider.insert(std::static_pointer_cast<statefs::ANode>(state));
+    ns.initSource(state);
+    if (is_stats_enabled()) {
+        auto stats = std::make_shared<StatsNamespace>
+            (provider_name, service_name);
+        provider.insert(std::static_pointer_cast<statefs::ANode>(stats));
+    }
+}
+
 }}
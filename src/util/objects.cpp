@@ -0,0 +1,43 @@
+#include <statefs/qt/objects.hpp>
+
+#include <QDBusObjectPath>
+#include <QDBusVariant>
+
+namespace statefs { namespace qt {
+
+bool find_object(QDBusArgument const &src, QStringList const &keys
+                 , object_handler_type const &fn)
+{
+    QVariantMap props;
+    QDBusObjectPath path;
+    QString key;
+    QDBusVariant value;
+    bool is_found = false;
+
+    src.beginArray();
+    while (!is_found && !src.atEnd()) {
+        src.beginStructure();
+        src >> path;
+        props.clear();
+        src.beginMap();
+        while (!src.atEnd()) {
+            src.beginMapEntry();
+            src >> key;
+            // value should be read anyway to advance to the next entry
+            src >> value;
+            if (keys.isEmpty() || keys.contains(key))
+                props.insert(key, value.variant());
+            src.endMapEntry();
+        }
+        src.endMap();
+        src.endStructure();
+        is_found = fn(path.path(), props);
+    }
+    // array is not finished if stopped, it is not needed because
+    // argument is consumed and closing it would mean reading the rest
+    if (!is_found)
+        src.endArray();
+    return is_found;
+}
+
+}}
@@ -0,0 +1,93 @@
+#include <statefs/qt/properties.hpp>
+#include <statefs/qt/dbus.hpp>
+#include <statefs/qt/dispatcher.hpp>
+
+#include <QDBusMessage>
+#include <QDebug>
+
+namespace statefs { namespace qt {
+
+static char const *properties_interface = "org.freedesktop.DBus.Properties";
+
+PropertiesMirror::PropertiesMirror(QDBusConnection const &bus
+                                   , QString const &service
+                                   , QString const &path
+                                   , QString const &interface
+                                   , QObject *parent)
+    : QObject(parent)
+    , bus_(bus)
+    , service_(service)
+    , path_(path)
+    , interface_(interface)
+    , stats_name_((interface + ".GetAll").toLatin1())
+    , is_ready_(false)
+    , generation_(0)
+{
+}
+
+PropertiesMirror::~PropertiesMirror()
+{
+}
+
+void PropertiesMirror::init(handler_type const &on_changed)
+{
+    on_changed_ = on_changed;
+    if (!signal_.is_active()) {
+        auto dispatcher = SignalDispatcher::get(bus_, service_);
+        signal_ = dispatcher->subscribe<QString, QVariantMap, QStringList>
+            (path_, properties_interface, "PropertiesChanged"
+             , [this](QString const &interface, QVariantMap const &changed
+                      , QStringList const &invalidated) {
+                properties_changed(interface, changed, invalidated);
+            });
+    }
+    refresh();
+}
+
+void PropertiesMirror::refresh()
+{
+    auto msg = QDBusMessage::createMethodCall
+        (service_, path_, properties_interface, "GetAll");
+    msg << interface_;
+    QDBusPendingReply<QVariantMap> reply = bus_.asyncCall(msg);
+    // only the reply to the latest request is used
+    auto generation = ++generation_;
+    future(this, reply, stats_name_.constData()).then([this, generation](QVariantMap const &props) {
+            if (generation != generation_)
+                return;
+            is_ready_ = true;
+            merge(props);
+        });
+}
+
+void PropertiesMirror::properties_changed(QString const &interface
+                                          , QVariantMap const &changed
+                                          , QStringList const &invalidated)
+{
+    if (interface != interface_)
+        return;
+
+    merge(changed);
+    if (!invalidated.isEmpty()) {
+        // values are not sent, so they should be requested
+        for (auto const &name : invalidated)
+            values_.remove(name);
+        refresh();
+    }
+}
+
+void PropertiesMirror::merge(QVariantMap const &props)
+{
+    QStringList changed;
+    for (auto it = props.begin(); it != props.end(); ++it) {
+        auto pcached = values_.constFind(it.key());
+        if (pcached != values_.constEnd() && pcached.value() == it.value())
+            continue;
+        values_.insert(it.key(), it.value());
+        changed.push_back(it.key());
+    }
+    if (!changed.isEmpty() && on_changed_)
+        on_changed_(changed);
+}
+
+}}
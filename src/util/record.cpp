@@ -0,0 +1,524 @@
+#include <statefs/qt/record.hpp>
+
+#include <QDBusArgument>
+#include <QDBusMetaType>
+#include <QDBusObjectPath>
+#include <QDBusSignature>
+#include <QDBusVariant>
+#include <QHash>
+#include <QStringList>
+
+#include <mutex>
+
+#include <string.h>
+
+namespace statefs { namespace qt { namespace trace {
+
+Writer * dbus_writer()
+{
+    static Writer *writer = trace::writer("dbus");
+    return writer;
+}
+
+namespace {
+
+// skip single complete type, @return pointer to the next one
+char const * skip_type(char const *sig)
+{
+    switch (*sig) {
+    case 'a':
+        return skip_type(sig + 1);
+    case '(':
+    case '{': {
+        auto close = (*sig == '(') ? ')' : '}';
+        ++sig;
+        while (*sig && *sig != close)
+            sig = skip_type(sig);
+        return *sig ? sig + 1 : sig;
+    }
+    case '\0':
+        return sig;
+    default:
+        return sig + 1;
+    }
+}
+
+std::string utf8(QString const &s)
+{
+    auto bytes = s.toUtf8();
+    return std::string(bytes.constData(), bytes.size());
+}
+
+bool encode_value(Encoder &, QVariant const &);
+
+bool encode_basic(Encoder &e, char type, QVariant const &v)
+{
+    switch (type) {
+    case 'y': case 'q': case 'u': case 't':
+        e.put(static_cast<uint64_t>(v.toULongLong()));
+        return true;
+    case 'n': case 'i': case 'x':
+        e.put_signed(v.toLongLong());
+        return true;
+    case 'b':
+        e.put(static_cast<uint64_t>(v.toBool() ? 1 : 0));
+        return true;
+    case 'd': {
+        auto d = v.toDouble();
+        uint64_t bits;
+        ::memcpy(&bits, &d, sizeof(bits));
+        e.put(bits);
+        return true;
+    }
+    case 's':
+        e.put(utf8(v.toString()));
+        return true;
+    case 'o':
+        e.put(utf8(qvariant_cast<QDBusObjectPath>(v).path()));
+        return true;
+    case 'g':
+        e.put(utf8(qvariant_cast<QDBusSignature>(v).signature()));
+        return true;
+    default:
+        // unix fds can't be replayed
+        return false;
+    }
+}
+
+// encode value of complete type sig from the demarshalled argument,
+// container elements are counted and written after the count
+bool encode_argument(Encoder &e, char const *sig, QDBusArgument const &arg)
+{
+    std::string body;
+    Encoder be(body);
+    uint64_t count = 0;
+    bool is_ok = true;
+
+    switch (*sig) {
+    case 'v': {
+        auto v = qvariant_cast<QDBusVariant>(arg.asVariant());
+        return encode_value(e, v.variant());
+    }
+    case 'a':
+        if (sig[1] == '{') {
+            auto key = sig + 2;
+            auto value = skip_type(key);
+            arg.beginMap();
+            for (; is_ok && !arg.atEnd(); ++count) {
+                arg.beginMapEntry();
+                is_ok = encode_argument(be, key, arg)
+                    && encode_argument(be, value, arg);
+                arg.endMapEntry();
+            }
+            arg.endMap();
+        } else {
+            arg.beginArray();
+            for (; is_ok && !arg.atEnd(); ++count)
+                is_ok = encode_argument(be, sig + 1, arg);
+            arg.endArray();
+        }
+        e.put(count);
+        e.put_raw(body.data(), body.size());
+        return is_ok;
+    case '(': {
+        auto end = skip_type(sig) - 1;
+        arg.beginStructure();
+        for (auto p = sig + 1; is_ok && p < end; p = skip_type(p))
+            is_ok = encode_argument(e, p, arg);
+        arg.endStructure();
+        return is_ok;
+    }
+    default:
+        return encode_basic(e, *sig, arg.asVariant());
+    }
+}
+
+template <typename ListT>
+bool encode_items(Encoder &e, char type, ListT const &items)
+{
+    e.put(static_cast<uint64_t>(items.size()));
+    for (auto const &item : items)
+        if (!encode_basic(e, type, QVariant::fromValue(item)))
+            return false;
+    return true;
+}
+
+template <typename T>
+bool encode_list(Encoder &e, char type, QVariant const &v)
+{
+    return encode_items(e, type, qvariant_cast<QList<T> >(v));
+}
+
+// value of natural Qt type (basic types, QStringList, QVariantMap
+// etc.)
+bool encode_natural(Encoder &e, char const *sig, QVariant const &v)
+{
+    switch (*sig) {
+    case 'v':
+        return encode_value(e, qvariant_cast<QDBusVariant>(v).variant());
+    case 'a': {
+        if (sig[1] == 'y') {
+            auto bytes = v.toByteArray();
+            e.put(static_cast<uint64_t>(bytes.size()));
+            for (auto c : bytes)
+                e.put(static_cast<uint64_t>(static_cast<uchar>(c)));
+            return true;
+        }
+        if (sig[1] == '{') {
+            // only a{sv} has natural representation
+            if (::strncmp(sig, "a{sv}", 5))
+                return false;
+            auto m = v.toMap();
+            e.put(static_cast<uint64_t>(m.size()));
+            for (auto it = m.begin(); it != m.end(); ++it) {
+                e.put(utf8(it.key()));
+                if (!encode_value(e, it.value()))
+                    return false;
+            }
+            return true;
+        }
+        switch (sig[1]) {
+        case 's': return encode_items(e, sig[1], v.toStringList());
+        case 'o': return encode_list<QDBusObjectPath>(e, sig[1], v);
+        case 'b': return encode_list<bool>(e, sig[1], v);
+        case 'n': return encode_list<short>(e, sig[1], v);
+        case 'q': return encode_list<ushort>(e, sig[1], v);
+        case 'i': return encode_list<int>(e, sig[1], v);
+        case 'u': return encode_list<uint>(e, sig[1], v);
+        case 'x': return encode_list<qlonglong>(e, sig[1], v);
+        case 't': return encode_list<qulonglong>(e, sig[1], v);
+        case 'd': return encode_list<double>(e, sig[1], v);
+        case 'v': {
+            // QVariantList items are not wrapped into QDBusVariant
+            auto items = v.toList();
+            e.put(static_cast<uint64_t>(items.size()));
+            for (auto const &item : items)
+                if (!encode_value(e, item))
+                    return false;
+            return true;
+        }
+        default:
+            return false;
+        }
+    }
+    case '(':
+        return false;
+    default:
+        return encode_basic(e, *sig, v);
+    }
+}
+
+bool encode_value(Encoder &e, QVariant const &v)
+{
+    static const int argument_type = qMetaTypeId<QDBusArgument>();
+    if (v.userType() == argument_type) {
+        auto arg = qvariant_cast<QDBusArgument>(v);
+        auto sig = arg.currentSignature().toLatin1();
+        e.put(std::string(sig.constData(), sig.size()));
+        return encode_argument(e, sig.constData(), arg);
+    }
+    auto sig = QDBusMetaType::typeToSignature(v.userType());
+    if (!sig)
+        return false;
+    e.put(std::string(sig));
+    return encode_natural(e, sig, v);
+}
+
+typedef QHash<QString, converter_type> converters_type;
+
+converters_type & converters()
+{
+    static converters_type res;
+    return res;
+}
+
+std::mutex & converters_mutex()
+{
+    static std::mutex res;
+    return res;
+}
+
+template <typename T>
+QVariant basic_list(QVariantList const &src)
+{
+    QList<T> res;
+    for (auto const &v : src)
+        res.append(v.value<T>());
+    return QVariant::fromValue(res);
+}
+
+bool decode_value(Decoder &, QVariant &);
+
+bool decode_basic(Decoder &d, char type, QVariant &dst)
+{
+    uint64_t u = 0;
+    int64_t i = 0;
+    std::string s;
+    switch (type) {
+    case 'y':
+        if (!d.get(u))
+            return false;
+        dst = QVariant::fromValue(static_cast<uchar>(u));
+        return true;
+    case 'q':
+        if (!d.get(u))
+            return false;
+        dst = QVariant::fromValue(static_cast<ushort>(u));
+        return true;
+    case 'u':
+        if (!d.get(u))
+            return false;
+        dst = QVariant::fromValue(static_cast<uint>(u));
+        return true;
+    case 't':
+        if (!d.get(u))
+            return false;
+        dst = QVariant::fromValue(static_cast<qulonglong>(u));
+        return true;
+    case 'n':
+        if (!d.get_signed(i))
+            return false;
+        dst = QVariant::fromValue(static_cast<short>(i));
+        return true;
+    case 'i':
+        if (!d.get_signed(i))
+            return false;
+        dst = QVariant::fromValue(static_cast<int>(i));
+        return true;
+    case 'x':
+        if (!d.get_signed(i))
+            return false;
+        dst = QVariant::fromValue(static_cast<qlonglong>(i));
+        return true;
+    case 'b':
+        if (!d.get(u))
+            return false;
+        dst = QVariant(u != 0);
+        return true;
+    case 'd': {
+        if (!d.get(u))
+            return false;
+        double v;
+        ::memcpy(&v, &u, sizeof(v));
+        dst = QVariant(v);
+        return true;
+    }
+    case 's':
+    case 'o':
+    case 'g': {
+        if (!d.get(s))
+            return false;
+        auto str = QString::fromUtf8(s.data(), s.size());
+        if (type == 'o')
+            dst = QVariant::fromValue(QDBusObjectPath(str));
+        else if (type == 'g')
+            dst = QVariant::fromValue(QDBusSignature(str));
+        else
+            dst = QVariant(str);
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+QString key_string(QVariant const &key)
+{
+    static const int path_type = qMetaTypeId<QDBusObjectPath>();
+    return key.userType() == path_type
+        ? qvariant_cast<QDBusObjectPath>(key).path() : key.toString();
+}
+
+// variants are unwrapped inside of containers: QVariantMap and
+// QVariantList wrap items into QDBusVariant while marshalling
+bool decode_item(Decoder &d, char const *sig, QVariant &dst);
+
+bool decode_typed(Decoder &d, char const *sig, QVariant &dst)
+{
+    uint64_t count = 0;
+    switch (*sig) {
+    case 'v': {
+        QVariant v;
+        if (!decode_value(d, v))
+            return false;
+        dst = QVariant::fromValue(QDBusVariant(v));
+        return true;
+    }
+    case 'a':
+        if (!d.get(count) || count > d.left())
+            return false;
+        if (sig[1] == '{') {
+            auto key_sig = sig + 2;
+            auto value_sig = skip_type(key_sig);
+            QVariantMap m;
+            for (uint64_t i = 0; i < count; ++i) {
+                QVariant k, v;
+                if (!(decode_typed(d, key_sig, k)
+                      && decode_item(d, value_sig, v)))
+                    return false;
+                m.insert(key_string(k), v);
+            }
+            dst = m;
+        } else {
+            QVariantList items;
+            for (uint64_t i = 0; i < count; ++i) {
+                QVariant v;
+                if (!decode_item(d, sig + 1, v))
+                    return false;
+                items.append(v);
+            }
+            switch (sig[1]) {
+            case 's': {
+                QStringList res;
+                for (auto const &v : items)
+                    res.append(v.toString());
+                dst = res;
+                break;
+            }
+            case 'y': {
+                QByteArray res;
+                for (auto const &v : items)
+                    res.append(static_cast<char>(v.value<uchar>()));
+                dst = res;
+                break;
+            }
+            case 'o': dst = basic_list<QDBusObjectPath>(items); break;
+            case 'b': dst = basic_list<bool>(items); break;
+            case 'n': dst = basic_list<short>(items); break;
+            case 'q': dst = basic_list<ushort>(items); break;
+            case 'i': dst = basic_list<int>(items); break;
+            case 'u': dst = basic_list<uint>(items); break;
+            case 'x': dst = basic_list<qlonglong>(items); break;
+            case 't': dst = basic_list<qulonglong>(items); break;
+            case 'd': dst = basic_list<double>(items); break;
+            default: dst = items; break;
+            }
+        }
+        break;
+    case '(': {
+        auto end = skip_type(sig) - 1;
+        QVariantList fields;
+        for (auto p = sig + 1; p < end; p = skip_type(p)) {
+            QVariant v;
+            if (!decode_typed(d, p, v))
+                return false;
+            fields.append(v);
+        }
+        dst = fields;
+        break;
+    }
+    default:
+        return decode_basic(d, *sig, dst);
+    }
+
+    std::lock_guard<std::mutex> lock(converters_mutex());
+    auto const &conv = converters();
+    if (!conv.isEmpty()) {
+        auto p = conv.find(QString::fromLatin1(sig, skip_type(sig) - sig));
+        if (p != conv.end())
+            dst = p.value()(dst);
+    }
+    return true;
+}
+
+bool decode_item(Decoder &d, char const *sig, QVariant &dst)
+{
+    if (*sig != 'v')
+        return decode_typed(d, sig, dst);
+    return decode_value(d, dst);
+}
+
+bool decode_value(Decoder &d, QVariant &dst)
+{
+    std::string sig;
+    return d.get(sig) && !sig.empty() && decode_typed(d, sig.c_str(), dst);
+}
+
+}
+
+bool encode(Encoder &e, QVariantList const &args)
+{
+    e.put(static_cast<uint64_t>(args.size()));
+    for (auto const &v : args)
+        if (!encode_value(e, v))
+            return false;
+    return true;
+}
+
+bool decode(Decoder &d, QVariantList &args)
+{
+    uint64_t count;
+    if (!d.get(count) || count > d.left())
+        return false;
+    args.clear();
+    for (uint64_t i = 0; i < count; ++i) {
+        QVariant v;
+        if (!decode_value(d, v))
+            return false;
+        args.append(v);
+    }
+    return true;
+}
+
+void set_converter(QString const &signature, converter_type const &fn)
+{
+    std::lock_guard<std::mutex> lock(converters_mutex());
+    converters()[signature] = fn;
+}
+
+void record_service(QString const &service)
+{
+    auto w = dbus_writer();
+    if (!w)
+        return;
+    auto name = utf8(service);
+    w->write(Kind::DBusService, [&name](Encoder &e) { e.put(name); });
+}
+
+void record_signal(QString const &service, QDBusMessage const &msg)
+{
+    auto w = dbus_writer();
+    if (!w)
+        return;
+    std::string args;
+    Encoder args_encoder(args);
+    if (!encode(args_encoder, msg.arguments())) {
+        qWarning() << "Can't record" << msg.interface() << msg.member()
+                   << "arguments" << msg.signature();
+        return;
+    }
+    w->write(Kind::DBusSignal, [&](Encoder &e) {
+            e.put(utf8(service));
+            e.put(utf8(msg.path()));
+            e.put(utf8(msg.interface()));
+            e.put(utf8(msg.member()));
+            e.put_raw(args.data(), args.size());
+        });
+}
+
+void record_reply(char const *method, QDBusMessage const &msg)
+{
+    auto w = dbus_writer();
+    if (!w)
+        return;
+    if (msg.type() == QDBusMessage::ErrorMessage) {
+        w->write(Kind::DBusError, [&](Encoder &e) {
+                e.put(method, ::strlen(method));
+                e.put(utf8(msg.errorName()));
+                e.put(utf8(msg.errorMessage()));
+            });
+        return;
+    }
+    std::string args;
+    Encoder args_encoder(args);
+    if (!encode(args_encoder, msg.arguments())) {
+        qWarning() << "Can't record" << method << "reply" << msg.signature();
+        return;
+    }
+    w->write(Kind::DBusReply, [&](Encoder &e) {
+            e.put(method, ::strlen(method));
+            e.put_raw(args.data(), args.size());
+        });
+}
+
+}}}
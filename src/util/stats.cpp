@@ -0,0 +1,235 @@
+#include <statefs/qt/stats.hpp>
+
+#include <cor/util.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <time.h>
+
+namespace statefs { namespace qt {
+
+namespace {
+
+enum { registry_capacity = 256 };
+
+enum EntryState { EntryFree = 0, EntryClaimed, EntryReady };
+
+struct Entry
+{
+    std::atomic<unsigned> state;
+    std::atomic<uint32_t> hash;
+    MethodStats stats;
+};
+
+// open addressing table, zero-initialized, entries are never removed
+Entry registry[registry_capacity];
+
+uint32_t name_hash(char const *s)
+{
+    uint32_t h = 2166136261u;
+    for (; *s; ++s)
+        h = (h ^ static_cast<unsigned char>(*s)) * 16777619u;
+    return h;
+}
+
+inline uint64_t monotonic_ns()
+{
+    timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+template <typename T>
+void store_max(std::atomic<T> &dst, T v)
+{
+    auto cur = dst.load(std::memory_order_relaxed);
+    while (cur < v && !dst.compare_exchange_weak
+           (cur, v, std::memory_order_relaxed))
+        ;
+}
+
+class StatsSource : public PropertySource
+{
+public:
+    StatsSource(StatsNamespace const *ns) : ns_(ns) {}
+
+    // formatting the table is not cheap, so the upper bound is
+    // reported and the table is made only on read
+    virtual statefs_ssize_t size() const
+    {
+        return ns_->dump_size_max();
+    }
+
+    virtual std::string read() const
+    {
+        return ns_->dump();
+    }
+
+private:
+    StatsNamespace const *ns_;
+};
+
+}
+
+size_t MethodStats::bucket(uint64_t us)
+{
+    if (us < linear_buckets)
+        return us;
+    // position of the highest bit, it is >= 3 here
+    size_t power = 63 - __builtin_clzll(us);
+    size_t sub = (us >> (power - 2)) & (buckets_per_power - 1);
+    size_t res = linear_buckets + (power - 3) * buckets_per_power + sub;
+    return res < bucket_count ? res : bucket_count - 1;
+}
+
+uint64_t MethodStats::bucket_max(size_t i)
+{
+    if (i < linear_buckets)
+        return i;
+    i -= linear_buckets;
+    size_t power = 3 + i / buckets_per_power;
+    uint64_t step = 1ull << (power - 2);
+    return (buckets_per_power + i % buckets_per_power + 1) * step - 1;
+}
+
+void MethodStats::record(uint64_t latency_ns, bool is_error)
+{
+    auto us = latency_ns / 1000;
+    calls_.fetch_add(1, std::memory_order_relaxed);
+    if (is_error)
+        errors_.fetch_add(1, std::memory_order_relaxed);
+    buckets_[bucket(us)].fetch_add(1, std::memory_order_relaxed);
+    store_max(max_us_, us);
+}
+
+MethodStats::Summary MethodStats::summary() const
+{
+    Summary res;
+    uint64_t counts[bucket_count];
+    uint64_t total = 0;
+    // snapshot is not atomic as a whole, counters can be updated
+    // concurrently, so percentiles are calculated from the bucket
+    // counts sum
+    for (size_t i = 0; i < bucket_count; ++i) {
+        counts[i] = buckets_[i].load(std::memory_order_relaxed);
+        total += counts[i];
+    }
+    res.calls = calls_.load(std::memory_order_relaxed);
+    res.errors = errors_.load(std::memory_order_relaxed);
+    res.max = max_us_.load(std::memory_order_relaxed);
+
+    uint64_t *targets[] = { &res.p50, &res.p90, &res.p99 };
+    uint64_t const percents[] = { 50, 90, 99 };
+    uint64_t seen = 0;
+    size_t t = 0, i = 0;
+    for (; i < bucket_count && t < 3; ++i) {
+        seen += counts[i];
+        for (; t < 3 && seen * 100 >= total * percents[t] && total; ++t)
+            *targets[t] = std::min(bucket_max(i), res.max);
+    }
+    for (; t < 3; ++t)
+        *targets[t] = res.max;
+    return res;
+}
+
+MethodStats *method_stats(char const *name)
+{
+    if (!name || !is_stats_enabled())
+        return nullptr;
+
+    auto h = name_hash(name);
+    for (size_t i = 0; i < registry_capacity; ++i) {
+        auto &e = registry[(h + i) % registry_capacity];
+        auto state = e.state.load(std::memory_order_acquire);
+        if (state == EntryFree) {
+            unsigned expected = EntryFree;
+            if (e.state.compare_exchange_strong(expected, EntryClaimed)) {
+                e.hash.store(h, std::memory_order_relaxed);
+                ::strncpy(e.stats.name_, name, MethodStats::name_capacity - 1);
+                e.state.store(EntryReady, std::memory_order_release);
+                return &e.stats;
+            }
+            state = expected;
+        }
+        // other thread is filling the entry just now, it takes a
+        // couple of stores
+        while (state == EntryClaimed)
+            state = e.state.load(std::memory_order_acquire);
+
+        if (e.hash.load(std::memory_order_relaxed) == h
+            && !::strncmp(e.stats.name(), name, MethodStats::name_capacity - 1))
+            return &e.stats;
+    }
+    return nullptr;
+}
+
+void for_each_method_stats(char const *prefix
+                           , std::function<void (MethodStats const&)> const &fn)
+{
+    auto len = ::strlen(prefix);
+    for (size_t i = 0; i < registry_capacity; ++i) {
+        auto &e = registry[i];
+        if (e.state.load(std::memory_order_acquire) != EntryReady)
+            continue;
+        if (!::strncmp(e.stats.name(), prefix, len))
+            fn(e.stats);
+    }
+}
+
+CallTimer::CallTimer(char const *method)
+    : stats_(method_stats(method))
+    , start_(stats_ ? monotonic_ns() : 0)
+{
+}
+
+void CallTimer::done(bool is_error) const
+{
+    if (stats_)
+        stats_->record(monotonic_ns() - start_, is_error);
+}
+
+StatsNamespace::StatsNamespace(std::string const &provider
+                               , std::string const &prefix)
+    : statefs::Namespace(("ProviderStats." + provider).c_str())
+    , prefix_(prefix)
+{
+    auto src = cor::make_unique<StatsSource>(this);
+    *this << statefs::create(statefs::Analog{"Methods", ""}, std::move(src));
+}
+
+// name, 6 64-bit numbers and the text around them
+static const size_t line_size_max = MethodStats::name_capacity + 6 * 20
+    + sizeof(" calls= errors= p50=us p90=us p99=us max=us\n");
+
+size_t StatsNamespace::dump_size_max() const
+{
+    size_t res = 0;
+    for_each_method_stats(prefix_.c_str(), [&res](MethodStats const &) {
+            res += line_size_max;
+        });
+    return res;
+}
+
+std::string StatsNamespace::dump() const
+{
+    std::string res;
+    char line[line_size_max];
+    for_each_method_stats(prefix_.c_str(), [&res, &line](MethodStats const &s) {
+            auto v = s.summary();
+            ::snprintf(line, sizeof(line)
+                       , "%s calls=%llu errors=%llu p50=%lluus p90=%lluus"
+                       " p99=%lluus max=%lluus\n", s.name()
+                       , (unsigned long long)v.calls
+                       , (unsigned long long)v.errors
+                       , (unsigned long long)v.p50
+                       , (unsigned long long)v.p90
+                       , (unsigned long long)v.p99
+                       , (unsigned long long)v.max);
+            res += line;
+        });
+    return res;
+}
+
+}}
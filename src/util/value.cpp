@@ -0,0 +1,126 @@
+#include <statefs/qt/value.hpp>
+#include <statefs/qt/util.hpp>
+
+#include <cmath>
+
+namespace statefs { namespace qt {
+
+namespace {
+
+template <typename T>
+void encode_unsigned(T v, std::string &dst, bool is_negative = false)
+{
+    char buf[24];
+    auto end = buf + sizeof(buf);
+    auto p = end;
+    do {
+        *--p = '0' + static_cast<char>(v % 10);
+        v /= 10;
+    } while (v);
+    if (is_negative)
+        *--p = '-';
+    dst.assign(p, end);
+}
+
+template <typename T, typename UT>
+void encode_signed(T v, std::string &dst)
+{
+    if (v >= 0) {
+        encode_unsigned(static_cast<UT>(v), dst);
+    } else {
+        // -(v + 1) + 1 to avoid overflow on the minimal value
+        encode_unsigned(static_cast<UT>(-(v + 1)) + 1, dst, true);
+    }
+}
+
+// QString and QByteArray are converted through UTF-8, ASCII is
+// copied as is, all other strings are left to valueEncode()
+bool encode_ascii(QString const &v, std::string &dst)
+{
+    auto len = v.size();
+    auto src = v.constData();
+    for (int i = 0; i < len; ++i)
+        if (src[i].unicode() >= 0x80)
+            return false;
+
+    dst.resize(len);
+    for (int i = 0; i < len; ++i)
+        dst[i] = static_cast<char>(src[i].unicode());
+    return true;
+}
+
+// valueEncode() takes QByteArray data as C string, so it is cut at
+// the first NUL
+bool encode_ascii(QByteArray const &v, std::string &dst)
+{
+    auto len = v.size();
+    auto src = v.constData();
+    int i = 0;
+    for (; i < len && src[i]; ++i)
+        if (static_cast<unsigned char>(src[i]) >= 0x80)
+            return false;
+
+    dst.assign(src, i);
+    return true;
+}
+
+}
+
+bool encodeDirect(QVariant const &src, std::string &dst)
+{
+    switch (static_cast<int>(src.type())) {
+    case QMetaType::Bool:
+        dst.assign(src.toBool() ? "1" : "0", 1);
+        return true;
+    case QMetaType::UChar: {
+        // valueEncode() makes a Latin-1 character from D-Bus byte,
+        // properties expecting a number convert it explicitly
+        auto c = *reinterpret_cast<uchar const*>(src.constData());
+        if (!c || c >= 0x80)
+            return false;
+        dst.assign(1, static_cast<char>(c));
+        return true;
+    }
+    case QMetaType::Short:
+    case QMetaType::Int:
+        encode_signed<int, unsigned>(src.toInt(), dst);
+        return true;
+    case QMetaType::UShort:
+    case QMetaType::UInt:
+        encode_unsigned(src.toUInt(), dst);
+        return true;
+    case QMetaType::LongLong:
+        encode_signed<qlonglong, qulonglong>(src.toLongLong(), dst);
+        return true;
+    case QMetaType::ULongLong:
+        encode_unsigned(src.toULongLong(), dst);
+        return true;
+    case QMetaType::Double: {
+        // only integral values have unambiguous representation, it
+        // is the most common case (e.g. percentage is rounded). Qt
+        // formats doubles using the shortest form, so 1e6 is "1e+06"
+        auto v = src.toDouble();
+        if (v != std::floor(v) || std::fabs(v) >= 1e6
+            || (v == 0 && std::signbit(v)))
+            return false;
+        encode_signed<qlonglong, qulonglong>(static_cast<qlonglong>(v), dst);
+        return true;
+    }
+    case QMetaType::QString:
+        return encode_ascii(*reinterpret_cast<QString const*>(src.constData())
+                            , dst);
+    case QMetaType::QByteArray:
+        return encode_ascii
+            (*reinterpret_cast<QByteArray const*>(src.constData()), dst);
+    default:
+        return false;
+    }
+}
+
+void encode(QVariant const &src, std::string &dst)
+{
+    if (!encodeDirect(src, dst))
+        dst = valueEncode(src).toStdString();
+}
+
+}}
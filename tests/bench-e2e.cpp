@@ -0,0 +1,345 @@
+#include "host.hpp"
+#include "mock-services.hpp"
+
+#include <QCoreApplication>
+#include <QEventLoop>
+#include <QSocketNotifier>
+#include <QTimer>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+using statefs::host::ProviderHost;
+using statefs::host::cpu_ns;
+using statefs::host::monotonic_ns;
+using mock::start_bus;
+using mock::stop_process;
+using mock::wait_for;
+using mock::wait_readable;
+
+namespace {
+
+enum { max_events = 100000 };
+
+// signal send times, written by the mock process and read by the
+// harness, it is placed into the shared memory
+struct SendLog
+{
+    std::atomic<uint64_t> sent_ns[max_events];
+};
+
+// harness -> mock process
+struct Command
+{
+    uint32_t scenario;
+    uint32_t count;
+    uint32_t rate;
+};
+
+struct Options
+{
+    Options() : count(1000), is_verbose(false) {}
+
+    unsigned count;
+    std::vector<unsigned> rates;
+    std::vector<std::string> libs;
+    bool is_verbose;
+};
+
+// mock services are running in the separate process, so their CPU
+// time is not accounted to the provider
+int run_mocks(std::string const &address, int cmd_fd, int ready_fd
+              , SendLog *log)
+{
+    int argc = 1;
+    char name[] = "bench-e2e-mock";
+    char *argv[] = {name, nullptr};
+    QCoreApplication app(argc, argv);
+    mock::registerDataTypes();
+
+    auto const &scenarios = mock::scenarios();
+    std::vector<std::unique_ptr<mock::Service> > services;
+    for (auto const &s : scenarios) {
+        services.emplace_back(new mock::Service
+                              (QString::fromStdString(address), s.service));
+        s.setup(*services.back());
+        if (!services.back()->start()) {
+            std::cerr << "Can't start mock " << s.service << std::endl;
+            return 1;
+        }
+    }
+    char ready = 1;
+    if (::write(ready_fd, &ready, 1) != 1)
+        return 1;
+
+    mock::Service *service = nullptr;
+    Command cmd = {0, 0, 0};
+    size_t sent = 0;
+    uint64_t begin = 0;
+
+    // signals are sent in bursts on each tick to keep the average
+    // rate higher than the timer resolution
+    QTimer tick;
+    tick.setInterval(1);
+    QObject::connect(&tick, &QTimer::timeout, [&]() {
+            auto elapsed = monotonic_ns() - begin;
+            auto due = std::min<uint64_t>
+                (cmd.count, elapsed * cmd.rate / 1000000000ull + 1);
+            for (; sent < due; ++sent) {
+                log->sent_ns[sent].store(monotonic_ns());
+                service->send(sent);
+            }
+            if (sent == cmd.count)
+                tick.stop();
+        });
+
+    QSocketNotifier notifier(cmd_fd, QSocketNotifier::Read);
+    QObject::connect(&notifier, &QSocketNotifier::activated, [&]() {
+            auto len = ::read(cmd_fd, &cmd, sizeof(cmd));
+            // harness is finished
+            if (len != sizeof(cmd) || cmd.scenario >= services.size()) {
+                app.quit();
+                return;
+            }
+            service = services[cmd.scenario].get();
+            sent = 0;
+            begin = monotonic_ns();
+            tick.start();
+        });
+    return app.exec();
+}
+
+double percentile(std::vector<uint64_t> const &sorted, double p)
+{
+    if (sorted.empty())
+        return 0;
+    auto pos = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+    return sorted[pos] / 1000.0;
+}
+
+class Harness
+{
+public:
+    Harness(Options const &opts, int cmd_fd, SendLog *log)
+        : opts_(opts), cmd_fd_(cmd_fd), log_(log)
+    {}
+
+    /// @return number of failures
+    int run(std::string const &lib);
+
+private:
+    int run_rate(ProviderHost &, size_t scenario, size_t idx, unsigned rate);
+
+    Options const &opts_;
+    int cmd_fd_;
+    SendLog *log_;
+    size_t received_;
+    std::vector<uint64_t> latencies_;
+};
+
+int Harness::run(std::string const &lib)
+{
+    auto scenario = mock::find_scenario(lib);
+    if (!scenario) {
+        std::cerr << "No scenario for " << lib << std::endl;
+        return 1;
+    }
+    auto scenario_idx = scenario - &mock::scenarios()[0];
+
+    std::unique_ptr<ProviderHost> host;
+    try {
+        host.reset(new ProviderHost(lib));
+    } catch (std::exception const &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    auto idx = host->find(scenario->property);
+    if (idx == ProviderHost::npos || !host->connect(idx)) {
+        std::cerr << "Can't connect to " << scenario->property << std::endl;
+        return 1;
+    }
+    host->on_changed([this, idx](size_t changed, uint64_t now) {
+            if (changed != idx || received_ >= latencies_.size())
+                return;
+            auto sent = log_->sent_ns[received_].load();
+            latencies_[received_++] = now - sent;
+        });
+
+    auto const &initial = scenario->values[0];
+    auto is_initialized = [&host, idx, initial]() {
+        return host->read(idx) == initial;
+    };
+    if (!wait_for(is_initialized, 10000)) {
+        std::cerr << scenario->provider << ": " << scenario->property
+                  << " is '" << host->read(idx) << "', expected '"
+                  << initial << "'" << std::endl;
+        return 1;
+    }
+
+    int errors = 0;
+    for (auto rate : opts_.rates)
+        errors += run_rate(*host, scenario_idx, idx, rate);
+    return errors;
+}
+
+int Harness::run_rate(ProviderHost &host, size_t scenario, size_t idx
+                      , unsigned rate)
+{
+    auto const &info = mock::scenarios()[scenario];
+    received_ = 0;
+    latencies_.assign(opts_.count, 0);
+    host.reset_counters();
+
+    auto cpu_before = cpu_ns();
+    Command cmd = {static_cast<uint32_t>(scenario), opts_.count, rate};
+    if (::write(cmd_fd_, &cmd, sizeof(cmd)) != sizeof(cmd)) {
+        std::cerr << "Mock process is gone" << std::endl;
+        return 1;
+    }
+    auto timeout = static_cast<int>(1000ull * opts_.count / rate) + 5000;
+    wait_for([this]() { return received_ >= latencies_.size(); }, timeout);
+    auto cpu = cpu_ns() - cpu_before;
+
+    auto received = received_;
+    std::vector<uint64_t> sorted(latencies_.begin()
+                                 , latencies_.begin() + received);
+    std::sort(sorted.begin(), sorted.end());
+    ::printf("%-8s %6u/s %6zu/%-6u p50 %8.1f p90 %8.1f p99 %8.1f"
+             " max %8.1f us, cpu %7.1f us/event\n"
+             , info.provider, rate, received, opts_.count
+             , percentile(sorted, 0.5), percentile(sorted, 0.9)
+             , percentile(sorted, 0.99), percentile(sorted, 1.0)
+             , received ? cpu / 1000.0 / received : 0.0);
+    ::fflush(stdout);
+
+    // even number of changes returns property to the initial value
+    auto value = host.read(idx);
+    if (received != opts_.count || value != info.values[0]) {
+        std::cerr << info.provider << ": lost "
+                  << (opts_.count - received) << " event(s), value is '"
+                  << value << "'" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+bool parse_options(int argc, char *argv[], Options &opts)
+{
+    int c;
+    while ((c = ::getopt(argc, argv, "n:r:v")) != -1) {
+        switch (c) {
+        case 'n':
+            opts.count = ::atoi(optarg);
+            break;
+        case 'r': {
+            std::istringstream in(optarg);
+            std::string rate;
+            while (std::getline(in, rate, ','))
+                opts.rates.push_back(::atoi(rate.c_str()));
+            break;
+        }
+        case 'v':
+            opts.is_verbose = true;
+            break;
+        default:
+            return false;
+        }
+    }
+    for (int i = optind; i < argc; ++i)
+        opts.libs.push_back(argv[i]);
+    if (opts.rates.empty())
+        opts.rates = {100, 1000};
+    // each pair of changes returns property to the initial value
+    opts.count = std::min<unsigned>(opts.count + (opts.count & 1)
+                                    , max_events);
+    return opts.count && !opts.libs.empty()
+        && std::find(opts.rates.begin(), opts.rates.end(), 0u)
+        == opts.rates.end();
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    Options opts;
+    if (!parse_options(argc, argv, opts)) {
+        std::cerr << "Usage: " << argv[0]
+                  << " [-n events] [-r rate,...] [-v] provider.so..."
+                  << std::endl;
+        return 1;
+    }
+
+    auto log = static_cast<SendLog*>
+        (::mmap(nullptr, sizeof(SendLog), PROT_READ | PROT_WRITE
+                , MAP_SHARED | MAP_ANONYMOUS, -1, 0));
+    if (log == MAP_FAILED) {
+        std::cerr << "Can't map send log" << std::endl;
+        return 1;
+    }
+
+    std::string address;
+    auto bus_pid = start_bus(address);
+    if (bus_pid < 0) {
+        std::cerr << "Can't start dbus-daemon, skipping" << std::endl;
+        return 0;
+    }
+    // providers are connecting to the system or session bus
+    ::setenv("DBUS_SYSTEM_BUS_ADDRESS", address.c_str(), 1);
+    ::setenv("DBUS_SESSION_BUS_ADDRESS", address.c_str(), 1);
+
+    // mock process is forked before Qt starts any thread
+    int cmd[2], ready[2];
+    if (::pipe(cmd) || ::pipe(ready)) {
+        stop_process(bus_pid);
+        return 1;
+    }
+    auto mock_pid = ::fork();
+    if (!mock_pid) {
+        ::close(cmd[1]);
+        ::close(ready[0]);
+        ::_exit(run_mocks(address, cmd[0], ready[1], log));
+    }
+    ::close(cmd[0]);
+    ::close(ready[1]);
+    char c = 0;
+    if (mock_pid < 0 || !wait_readable(ready[0], 10000)
+        || ::read(ready[0], &c, 1) != 1) {
+        std::cerr << "Mock services are not started" << std::endl;
+        stop_process(mock_pid);
+        stop_process(bus_pid);
+        return 1;
+    }
+
+    if (!opts.is_verbose)
+        qInstallMessageHandler(mock::quiet_debug);
+
+    int errors = 0;
+    {
+        QCoreApplication app(argc, argv);
+        Harness harness(opts, cmd[1], log);
+        for (auto const &lib : opts.libs)
+            errors += harness.run(lib);
+    }
+
+    // mock process exits when command pipe is closed
+    ::close(cmd[1]);
+    ::close(ready[0]);
+    ::waitpid(mock_pid, nullptr, 0);
+    stop_process(bus_pid);
+    return errors ? 1 : 0;
+}
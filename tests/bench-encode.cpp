@@ -0,0 +1,114 @@
+#include <statefs/qt/ns.hpp>
+#include <statefs/qt/util.hpp>
+#include <statefs/qt/value.hpp>
+#include "bench.hpp"
+
+#include <cmath>
+#include <limits>
+#include <vector>
+
+using statefs::qt::valueEncode;
+
+namespace {
+
+class BenchNs : public statefs::qt::Namespace
+{
+public:
+    BenchNs()
+        : Namespace("Bench", std::unique_ptr<statefs::qt::PropertiesSource>())
+    {}
+
+    using Namespace::addProperty;
+    using Namespace::updateProperty;
+};
+
+std::string legacy_encode(QVariant const &v)
+{
+    return valueEncode(v).toStdString();
+}
+
+// encodeDirect() should produce exactly the same as valueEncode()
+int check_equivalence()
+{
+    std::vector<QVariant> samples = {
+        true, false, 0, 1, -1, 100, std::numeric_limits<int>::min()
+        , QVariant::fromValue<uchar>(42), QVariant::fromValue<uchar>(0)
+        , QVariant::fromValue<uchar>(200)
+        , QVariant::fromValue<short>(-32768), QVariant::fromValue<short>(7)
+        , QVariant::fromValue<ushort>(65535)
+        , 4000000000u, std::numeric_limits<qlonglong>::min()
+        , std::numeric_limits<qulonglong>::max()
+        , 87.0, 0.0, -12.0, 0.5, 1e20, 999999.0, 1e6, 1e7, 123456789.0
+        , QString(""), QString("home"), QString::fromUtf8("\xd0\x94\xd0\xb0")
+        , QByteArray("wifi"), QByteArray("\xff\x01"), QByteArray("a\0b", 3)
+    };
+    int errors = 0;
+    std::string buf;
+    for (auto const &v : samples) {
+        auto expected = legacy_encode(v);
+        statefs::qt::encode(v, buf);
+        if (buf != expected) {
+            std::cerr << "Mismatch for " << v.typeName() << ": '"
+                      << buf << "' != '" << expected << "'" << std::endl;
+            ++errors;
+        }
+    }
+    return errors;
+}
+
+}
+
+int main()
+{
+    if (check_equivalence())
+        return 1;
+
+    static const size_t count = 1000000;
+    std::string buf;
+    // all basic D-Bus types, non-integral double and non-ASCII
+    // string are encoded through valueEncode() fallback
+    QVariant const values[] = {
+        QVariant(true), QVariant::fromValue<uchar>(42)
+        , QVariant::fromValue<short>(-7), QVariant::fromValue<ushort>(7)
+        , QVariant(-73), QVariant(87u)
+        , QVariant(qlonglong(-5000000000ll))
+        , QVariant(qulonglong(5000000000ull))
+        , QVariant(std::round(87.4)), QVariant(87.4)
+        , QVariant(QString("registered"))
+        , QVariant(QString::fromUtf8("\xd0\x94\xd0\xb0"))
+        , QVariant(QByteArray("wifi"))
+    };
+    char const *names[] = {
+        "bool", "uchar", "short", "ushort", "int", "uint"
+        , "qlonglong", "qulonglong", "double", "double(fraction)"
+        , "QString", "QString(UTF-8)", "QByteArray"
+    };
+    static_assert(sizeof(values) / sizeof(values[0])
+                  == sizeof(names) / sizeof(names[0])
+                  , "Each value should be named");
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+        auto const &v = values[i];
+        std::string before = std::string("valueEncode ") + names[i];
+        bench::report(before.c_str(), bench::measure(count, [&v](size_t) {
+                    auto s = legacy_encode(v);
+                }));
+        std::string after = std::string("encode ") + names[i];
+        bench::report(after.c_str(), bench::measure(count, [&v, &buf](size_t) {
+                    statefs::qt::encode(v, buf);
+                }));
+    }
+
+    BenchNs ns;
+    auto idx = ns.addProperty("SignalStrength", "0");
+    // alternate values to avoid change suppression
+    QVariant const strength[] = { QVariant(42u), QVariant(43u) };
+    bench::report("Namespace::updateProperty(idx)"
+                  , bench::measure(count, [&ns, idx, &strength](size_t i) {
+                          ns.updateProperty(idx, strength[i & 1]);
+                      }));
+    bench::report("Namespace::updateProperty(unchanged)"
+                  , bench::measure(count, [&ns, idx, &strength](size_t) {
+                          ns.updateProperty(idx, strength[0]);
+                      }));
+    return 0;
+}
@@ -0,0 +1,190 @@
+#include "estimate.hpp"
+#include "bench.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+using statefs::udev::Estimator;
+using statefs::udev::create_estimator;
+
+namespace {
+
+struct Sample
+{
+    long t;
+    long energy;
+    // actual discharge rate at t, energy units per second
+    double rate;
+};
+
+// constant load interval of the discharge curve
+struct Load
+{
+    long duration;
+    double power;
+};
+
+/**
+ * Discharge curve as it is seen by the provider: the fuel gauge
+ * updates energy_now each period +/- jitter seconds, value is
+ * quantized and noisy, samples w/o energy change are not reported.
+ */
+std::vector<Sample> discharge(std::vector<Load> const &loads, long energy
+                              , long period, long jitter, long quantum)
+{
+    std::vector<Sample> res;
+    // deterministic LCG, curves should be the same on each run
+    uint32_t seed = 12345;
+    auto random = [&seed](long range) {
+        seed = seed * 1103515245 + 12345;
+        return static_cast<long>((seed >> 16) % (2 * range + 1)) - range;
+    };
+    double e = energy;
+    long t = 0, reported = energy;
+    for (auto const &load : loads) {
+        for (long end = t + load.duration; t < end; ) {
+            auto dt = period + random(jitter);
+            t += dt;
+            e -= load.power * dt;
+            auto v = static_cast<long>(e + random(quantum / 2))
+                / quantum * quantum;
+            if (v != reported) {
+                res.push_back(Sample{t, v, -load.power});
+                reported = v;
+            }
+        }
+    }
+    return res;
+}
+
+struct Curve
+{
+    char const *name;
+    std::vector<Sample> samples;
+    // the load is changed after this sample
+    size_t step;
+};
+
+std::vector<Curve> curves()
+{
+    // energy is in uWh like energy_now, 5Wh battery; power is in
+    // uWh/s: 83 is 0.3W (idle), 417 is 1.5W (active)
+    return {
+        { "idle->active", discharge({{1800, 83}, {1800, 417}}
+                                    , 5000000, 30, 5, 1000), 0 }
+        , { "active->idle", discharge({{1800, 417}, {1800, 83}}
+                                      , 5000000, 30, 5, 1000), 0 }
+        , { "steady", discharge({{3600, 250}}, 5000000, 10, 3, 100), 0 }
+    };
+}
+
+struct Accuracy
+{
+    // mean relative error over steady state samples
+    double steady_error;
+    // samples after the load step until error is below 10%
+    size_t settle;
+};
+
+Accuracy accuracy(Estimator &est, Curve const &curve)
+{
+    est.clear();
+    auto const &samples = curve.samples;
+    double error_sum = 0;
+    size_t error_count = 0;
+    size_t settle = 0;
+    bool is_settled = false;
+    for (size_t i = 0; i < samples.size(); ++i) {
+        auto const &s = samples[i];
+        est.push(s.t, s.energy);
+        auto error = std::fabs(est.rate() - s.rate) / std::fabs(s.rate);
+        // skip warm up and transition intervals
+        auto since_step = i - curve.step;
+        if (i >= curve.step && !is_settled) {
+            if (error < 0.1)
+                is_settled = true;
+            else
+                ++settle;
+        }
+        if (i >= 16 && (i < curve.step || since_step >= 16)) {
+            error_sum += error;
+            ++error_count;
+        }
+    }
+    return Accuracy{error_count ? error_sum / error_count : 1.0, settle};
+}
+
+size_t step_of(std::vector<Sample> const &samples)
+{
+    for (size_t i = 1; i < samples.size(); ++i)
+        if (samples[i].rate != samples[i - 1].rate)
+            return i;
+    return samples.size();
+}
+
+struct Limits
+{
+    char const *spec;
+    double max_steady_error;
+    size_t max_settle;
+};
+
+int check_accuracy()
+{
+    Limits const limits[] = {
+        { "average", 0.05, 8 }
+        , { "ewma", 0.05, 15 }
+        , { "slope", 0.03, 10 }
+    };
+    auto all = curves();
+    for (auto &c : all)
+        c.step = step_of(c.samples);
+
+    int errors = 0;
+    for (auto const &l : limits) {
+        auto est = create_estimator(l.spec);
+        for (auto const &c : all) {
+            auto res = accuracy(*est, c);
+            ::printf("%-8s %-14s error %5.1f%%, settled in %zu samples\n"
+                     , l.spec, c.name, res.steady_error * 100, res.settle);
+            if (res.steady_error > l.max_steady_error
+                || res.settle > l.max_settle) {
+                std::cerr << l.spec << " is inaccurate on " << c.name
+                          << std::endl;
+                ++errors;
+            }
+        }
+    }
+    if (create_estimator("ewma:2") || create_estimator("slope:1")
+        || create_estimator("unknown")) {
+        std::cerr << "Invalid specification is accepted" << std::endl;
+        ++errors;
+    }
+    return errors;
+}
+
+}
+
+int main()
+{
+    if (check_accuracy())
+        return 1;
+
+    auto const samples = curves()[0].samples;
+    static const size_t count = 1000000;
+    char const *specs[] = { "average", "ewma", "slope", "slope:32" };
+    for (auto spec : specs) {
+        auto est = create_estimator(spec);
+        volatile double rate = 0;
+        std::string name = std::string("push+rate ") + spec;
+        bench::report(name.c_str(), bench::measure(count, [&](size_t i) {
+                    auto const &s = samples[i % samples.size()];
+                    // time should grow monotonically
+                    est->push(s.t + (i / samples.size()) * 3600, s.energy);
+                    rate = est->rate();
+                }));
+    }
+    return 0;
+}
@@ -0,0 +1,396 @@
+#include <statefs/qt/dbus.hpp>
+#include <statefs/qt/dispatcher.hpp>
+#include "bench.hpp"
+#include "mock-services.hpp"
+
+#include <QCoreApplication>
+#include <QDBusConnection>
+#include <QDBusMessage>
+#include <QDBusServer>
+#include <QDBusVariant>
+#include <QDBusVirtualObject>
+#include <QEventLoop>
+#include <QTimer>
+
+#include <functional>
+#include <string>
+#include <tuple>
+#include <vector>
+
+using statefs::qt::Future;
+using statefs::qt::ServiceWatch;
+using statefs::qt::SignalDispatcher;
+using statefs::qt::Subscription;
+using statefs::qt::future;
+using statefs::qt::when_all;
+
+namespace {
+
+static char const *interface = "test.Future";
+
+/**
+ * Peer side: Get replies with 42, Fail with the error, Hang never
+ * replies and Delay replies after delay_ms
+ */
+class Service : public QDBusVirtualObject
+{
+public:
+    enum { delay_ms = 50 };
+
+    Service()
+    {
+        delay_.setSingleShot(true);
+        QObject::connect(&delay_, &QTimer::timeout, [this]() {
+                for (auto const &m : delayed_)
+                    std::get<0>(m).send(std::get<1>(m).createReply(42));
+                delayed_.clear();
+            });
+    }
+
+    virtual QString introspect(QString const &) const
+    {
+        return QString();
+    }
+
+    virtual bool handleMessage(QDBusMessage const &msg
+                               , QDBusConnection const &conn)
+    {
+        auto method = msg.member();
+        if (method == "Get")
+            return conn.send(msg.createReply(42));
+        if (method == "Fail")
+            return conn.send(msg.createErrorReply
+                             (QDBusError::InvalidArgs, "Failure"));
+        if (method == "Delay") {
+            delayed_.push_back(std::make_tuple(conn, msg));
+            delay_.start(delay_ms);
+        }
+        // Hang is not replied
+        return true;
+    }
+
+private:
+    QTimer delay_;
+    std::vector<std::tuple<QDBusConnection, QDBusMessage> > delayed_;
+};
+
+class Client
+{
+public:
+    Client(QDBusConnection const &conn) : conn_(conn) {}
+
+    QDBusPendingReply<int> call(char const *method)
+    {
+        auto msg = QDBusMessage::createMethodCall("", "/", interface, method);
+        return conn_.asyncCall(msg);
+    }
+
+private:
+    QDBusConnection conn_;
+};
+
+/// process events until is_done() or timeout, both the peer and the
+/// client are served by this thread
+void wait(std::function<bool()> const &is_done, int timeout_ms = 2000)
+{
+    QEventLoop loop;
+    QTimer step;
+    QObject::connect(&step, &QTimer::timeout, [&]() {
+            timeout_ms -= 10;
+            if (is_done() || timeout_ms <= 0)
+                loop.quit();
+        });
+    step.start(10);
+    loop.exec();
+}
+
+int check(bool is_ok, char const *what)
+{
+    if (!is_ok)
+        std::cerr << "Failed: " << what << std::endl;
+    return is_ok ? 0 : 1;
+}
+
+int check_resolve(Client &client)
+{
+    QObject ctx;
+    int value = 0, late_value = 0;
+    bool is_error = false;
+    auto f = future(&ctx, client.call("Get"), "test.Future.Get");
+    f.then([&value](int v) { value = v; })
+        .on_error([&is_error](QDBusError const &) { is_error = true; });
+    wait([&value]() { return value != 0; });
+    // continuation added after the reply is called immediately
+    f.then([&late_value](int v) { late_value = v; });
+    return check(value == 42 && !is_error && !f.is_pending(), "resolve")
+        + check(late_value == 42, "then() after resolve");
+}
+
+int check_error(Client &client)
+{
+    QObject ctx;
+    bool is_value = false;
+    QDBusError error;
+    future(&ctx, client.call("Fail"))
+        .then([&is_value](int) { is_value = true; })
+        .on_error([&error](QDBusError const &e) { error = e; });
+    wait([&error]() { return error.isValid(); });
+    return check(!is_value && error.type() == QDBusError::InvalidArgs
+                 , "error");
+}
+
+int check_timeout(Client &client)
+{
+    QObject ctx;
+    bool is_value = false;
+    QDBusError error;
+    future(&ctx, client.call("Hang"), 50)
+        .then([&is_value](int) { is_value = true; })
+        .on_error([&error](QDBusError const &e) { error = e; });
+    wait([&error]() { return error.isValid(); });
+    return check(!is_value && error.type() == QDBusError::Timeout
+                 , "timeout");
+}
+
+int check_cancel(Client &client)
+{
+    QObject ctx;
+    bool is_called = false;
+    auto f = future(&ctx, client.call("Delay"));
+    f.then([&is_called](int) { is_called = true; })
+        .on_error([&is_called](QDBusError const &) { is_called = true; });
+    f.cancel();
+    // the reply is received but it is ignored
+    auto ref = future(&ctx, client.call("Delay"));
+    wait([&ref]() { return !ref.is_pending(); });
+    return check(!is_called && !f.is_pending(), "cancel");
+}
+
+int check_context(Client &client)
+{
+    QObject ctx;
+    bool is_called = false;
+    auto context = new QObject();
+    future(context, client.call("Delay"))
+        .then([&is_called](int) { is_called = true; })
+        .on_error([&is_called](QDBusError const &) { is_called = true; });
+    delete context;
+    auto ref = future(&ctx, client.call("Delay"));
+    wait([&ref]() { return !ref.is_pending(); });
+    return check(!is_called, "context is destroyed");
+}
+
+int check_when_all(Client &client)
+{
+    QObject ctx;
+    int errors = 0;
+    std::tuple<int, int> values;
+    bool is_done = false;
+    when_all(&ctx, future(&ctx, client.call("Get"))
+             , future(&ctx, client.call("Delay")))
+        .then([&](std::tuple<int, int> const &v) {
+                values = v;
+                is_done = true;
+            });
+    wait([&is_done]() { return is_done; });
+    errors += check(is_done && values == std::make_tuple(42, 42), "when_all");
+
+    bool is_value = false;
+    QDBusError error;
+    when_all(&ctx, future(&ctx, client.call("Delay"))
+             , future(&ctx, client.call("Fail")))
+        .then([&is_value](std::tuple<int, int> const &) { is_value = true; })
+        .on_error([&error](QDBusError const &e) { error = e; });
+    wait([&error]() { return error.isValid(); });
+    // the other reply should not resolve already failed result
+    auto ref = future(&ctx, client.call("Delay"));
+    wait([&ref]() { return !ref.is_pending(); });
+    errors += check(!is_value && error.type() == QDBusError::InvalidArgs
+                    , "when_all with failed request");
+    return errors;
+}
+
+typedef std::vector<std::string> events_type;
+
+// short outage is held and followed by the resync, long one is
+// reported after the grace period
+int check_service_watch(QDBusConnection &owner, QDBusConnection &client)
+{
+    static char const *name = "test.Watched";
+    int errors = 0;
+    events_type events;
+    auto add = [&events](char const *e) {
+        return [&events, e]() { events.push_back(e); };
+    };
+    ServiceWatch watch(client, name);
+    watch.set_policy(ServiceWatch::Policy(300, 100)
+                     , add("begin"), add("end"));
+    watch.init(add("register"), add("unregister"));
+
+    owner.registerService(name);
+    wait([&events]() { return !events.empty(); });
+    errors += check(events == events_type{"register"}, "registration");
+
+    events.clear();
+    owner.unregisterService(name);
+    wait([]() { return false; }, 50);
+    errors += check(events.empty(), "values are held");
+    owner.registerService(name);
+    wait([&events]() { return events.size() >= 4; });
+    errors += check(events == events_type{
+            "begin", "unregister", "register", "end"}, "resync");
+
+    events.clear();
+    owner.unregisterService(name);
+    wait([&events]() { return !events.empty(); });
+    errors += check(events == events_type{"unregister"}, "grace period");
+    return errors;
+}
+
+void send_signal(QDBusConnection &conn, char const *path
+                 , char const *interface, char const *member
+                 , QVariantList const &args = QVariantList())
+{
+    auto msg = QDBusMessage::createSignal(path, interface, member);
+    msg.setArguments(args);
+    conn.send(msg);
+}
+
+// signals are routed by the path, interface and member, empty path
+// or member matches any
+int check_dispatcher(QDBusConnection &owner, QDBusConnection &client)
+{
+    static char const *name = "test.Signals";
+    static char const *iface = "test.Signals";
+    int errors = 0;
+    owner.registerService(name);
+    auto dispatcher = SignalDispatcher::get(client, name);
+    errors += check(dispatcher == SignalDispatcher::get(client, name)
+                    , "dispatcher is shared");
+
+    int on_a = 0, on_any_path = 0, on_any_member = 0;
+    QString prop_name;
+    QVariant prop_value;
+    auto a = dispatcher->subscribe<int>
+        ("/a", iface, "Changed", [&on_a](int v) { on_a += v; });
+    auto any_path = dispatcher->subscribe_raw
+        ("", iface, "Changed"
+         , [&on_any_path](QDBusMessage const &) { ++on_any_path; });
+    auto any_member = dispatcher->subscribe_raw
+        ("/a", iface, ""
+         , [&on_any_member](QDBusMessage const &) { ++on_any_member; });
+    auto prop = dispatcher->subscribe_property_changed
+        ("/b", iface, [&](QString const &n, QVariant const &v) {
+            prop_name = n;
+            prop_value = v;
+        });
+    auto property_changed = [](char const *n, QVariant const &v) {
+        return QVariantList{n, QVariant::fromValue(QDBusVariant(v))};
+    };
+
+    send_signal(owner, "/a", iface, "Changed", {1});
+    send_signal(owner, "/b", iface, "Changed", {10});
+    send_signal(owner, "/a", iface, "Other", {100});
+    send_signal(owner, "/a", "test.Other", "Changed", {1000});
+    // signals are received in order, so the last one marks the end
+    send_signal(owner, "/b", iface, "PropertyChanged"
+                , property_changed("Name", 5));
+    wait([&prop_name]() { return !prop_name.isEmpty(); });
+    errors += check(on_a == 1, "path and member");
+    errors += check(on_any_path == 2, "any path");
+    errors += check(on_any_member == 2, "any member");
+    errors += check(prop_name == "Name" && prop_value.toInt() == 5
+                    , "PropertyChanged");
+
+    // handler can unsubscribe itself and subscribe other one, it is
+    // called starting from the next signal
+    a.reset();
+    int self_calls = 0, added_calls = 0;
+    Subscription self, added;
+    self = dispatcher->subscribe_raw
+        ("/c", iface, "Changed", [&](QDBusMessage const &) {
+            ++self_calls;
+            self.reset();
+            added = dispatcher->subscribe_raw
+                ("/c", iface, "Changed"
+                 , [&added_calls](QDBusMessage const &) { ++added_calls; });
+        });
+    prop_name.clear();
+    send_signal(owner, "/a", iface, "Changed", {1});
+    send_signal(owner, "/c", iface, "Changed", {0});
+    send_signal(owner, "/c", iface, "Changed", {0});
+    send_signal(owner, "/b", iface, "PropertyChanged"
+                , property_changed("Done", 1));
+    wait([&prop_name]() { return !prop_name.isEmpty(); });
+    errors += check(on_a == 1, "unsubscribe");
+    errors += check(self_calls == 1 && added_calls == 1
+                    , "(un)subscribe from the handler");
+    owner.unregisterService(name);
+    return errors;
+}
+
+/// ServiceWatch and SignalDispatcher need the bus daemon to track
+/// name owners
+int check_bus(std::string const &address)
+{
+    auto owner = QDBusConnection::connectToBus
+        (QString::fromStdString(address), "owner");
+    auto client = QDBusConnection::connectToBus
+        (QString::fromStdString(address), "client");
+    if (!owner.isConnected() || !client.isConnected()) {
+        std::cerr << "Can't connect to the bus" << std::endl;
+        return 1;
+    }
+    return check_service_watch(owner, client)
+        + check_dispatcher(owner, client);
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    // bus daemon is forked before Qt starts any thread
+    std::string address;
+    auto bus_pid = mock::start_bus(address);
+    QCoreApplication app(argc, argv);
+
+    Service service;
+    QDBusServer server("unix:tmpdir=/tmp");
+    QObject::connect(&server, &QDBusServer::newConnection
+                     , [&service](QDBusConnection conn) {
+                         conn.registerVirtualObject("/", &service);
+                     });
+    auto conn = QDBusConnection::connectToPeer(server.address(), "future");
+    int errors = 0;
+    if (conn.isConnected()) {
+        Client client(conn);
+        errors += check_resolve(client) + check_error(client)
+            + check_timeout(client) + check_cancel(client)
+            + check_context(client) + check_when_all(client);
+    } else {
+        std::cerr << "Can't connect to the peer, skipping" << std::endl;
+    }
+    QDBusConnection::disconnectFromPeer("future");
+    if (bus_pid >= 0) {
+        errors += check_bus(address);
+        QDBusConnection::disconnectFromBus("owner");
+        QDBusConnection::disconnectFromBus("client");
+        mock::stop_process(bus_pid);
+    } else {
+        std::cerr << "Can't start dbus-daemon, skipping bus checks"
+                  << std::endl;
+    }
+    if (errors)
+        return 1;
+
+    static const size_t count = 100000;
+    QObject ctx;
+    volatile int sink = 0;
+    bench::report("Future::then+resolve", bench::measure
+                  (count, [&](size_t i) {
+                      Future<int> f(&ctx);
+                      f.then([&sink](int v) { sink = v; });
+                      f.resolve(static_cast<int>(i));
+                  }));
+    return 0;
+}
@@ -0,0 +1,329 @@
+#include <statefs/qt/ns.hpp>
+#include <statefs/qt/dbus.hpp>
+#include "bench.hpp"
+#include "dbus-types.hpp"
+#include "host.hpp"
+
+#include <QCoreApplication>
+#include <QDBusArgument>
+#include <QDBusMetaType>
+#include <QDBusObjectPath>
+#include <QEventLoop>
+#include <QTimer>
+
+#include <functional>
+#include <tuple>
+
+#include <stdlib.h>
+#include <string.h>
+
+using statefs::qt::DefaultProperties;
+using statefs::qt::PropertiesSource;
+using statefs::qt::Transaction;
+using statefs::host::ProviderHost;
+
+namespace {
+
+// ofono-like cellular namespace, property setters are not connected
+// to the statefs server, so only the namespace itself is measured
+char const *names[][3] = {
+    {"SignalStrength", "Strength", "0"}
+    , {"DataTechnology", "Technology", "unknown"}
+    , {"RegistrationStatus", "Status", "offline"}
+    , {"Status", "Mode", "offline"}
+    , {"Cell", "CellId", "0"}
+    , {"CurrentMCC", "MobileCountryCode", "0"}
+    , {"CurrentMNC", "MobileNetworkCode", "0"}
+    , {"NetworkName", "Name", ""}
+    , {"ExtendedNetworkName", "Ext", ""}
+    , {"SubscriberIdentity", "IMSI", ""}
+};
+
+// lazy initialization delay, it is set before the first use
+static char const *lazy_delay_ms = "300";
+
+class BenchSource : public statefs::qt::PropertiesSource
+{
+public:
+    BenchSource(statefs::qt::Namespace *ns)
+        : PropertiesSource(ns), inits(0)
+    {}
+
+    virtual void init() { ++inits; }
+
+    int inits;
+};
+
+class BenchNs : public statefs::qt::Namespace
+{
+public:
+    BenchNs()
+        : Namespace("Bench", std::unique_ptr<statefs::qt::PropertiesSource>())
+    {
+        for (auto const &n : names)
+            addProperty(n[0], n[2], n[1]);
+        src_.reset(new BenchSource(this));
+    }
+
+    BenchSource & source()
+    {
+        return static_cast<BenchSource&>(*src_);
+    }
+
+    void setDefaultProperties(DefaultProperties const &src)
+    {
+        setProperties(src);
+    }
+
+    using Namespace::updateProperty;
+};
+
+QVariantMap source_properties(unsigned strength, QString const &tech)
+{
+    return QVariantMap{
+        {"Strength", strength}, {"Technology", tech}
+        , {"Status", "registered"}, {"Mode", "online"}
+        , {"CellId", 0x1a2bu}, {"MobileCountryCode", "244"}
+        , {"MobileNetworkCode", "91"}, {"Name", "Operator"}
+        , {"Ext", "Operator Ltd"}, {"IMSI", "244910000000000"}
+        // not mapped to namespace properties
+        , {"LocationAreaCode", 0x42u}, {"Roaming", false}
+    };
+}
+
+/// namespace with its diagnostics, served by the in-process host
+class BenchProvider : public statefs::AProvider
+{
+public:
+    BenchProvider(char const *name, statefs_server *server)
+        : AProvider(name, server)
+        , ns_(std::make_shared<BenchNs>())
+    {
+        insert(std::static_pointer_cast<statefs::ANode>(ns_));
+        statefs::qt::insert_diagnostics(*this, *ns_, name, "test.Bench");
+    }
+    virtual ~BenchProvider() {}
+
+    virtual void release() { delete this; }
+
+    BenchNs & ns() { return *ns_; }
+
+private:
+    std::shared_ptr<BenchNs> ns_;
+};
+
+/// process events until is_done() or timeout
+void wait(std::function<bool()> const &is_done, int timeout_ms = 2000)
+{
+    QEventLoop loop;
+    QTimer step;
+    QObject::connect(&step, &QTimer::timeout, [&]() {
+            timeout_ms -= 10;
+            if (is_done() || timeout_ms <= 0)
+                loop.quit();
+        });
+    step.start(10);
+    loop.exec();
+}
+
+int check(bool is_ok, char const *what)
+{
+    if (!is_ok)
+        std::cerr << "Failed: " << what << std::endl;
+    return is_ok ? 0 : 1;
+}
+
+// source is initialized from the event loop after the delay, Ready
+// is 0 until that
+int check_lazy_init(statefs_server *server)
+{
+    int errors = 0;
+    auto provider = new BenchProvider("bench", server);
+    ProviderHost host(provider);
+    auto const &src = provider->ns().source();
+    auto ready = host.find("ProviderState.bench.Ready");
+    errors += check(ready != ProviderHost::npos, "Ready property");
+    if (errors)
+        return errors;
+
+    errors += check(!src.inits && host.read(ready) == "0", "pending init");
+    wait([]() { return false; }, 50);
+    errors += check(!src.inits && host.read(ready) == "0", "init delay");
+    wait([&src]() { return src.inits != 0; });
+    errors += check(src.inits == 1 && host.read(ready) == "1", "lazy init");
+    return errors;
+}
+
+// opened property starts initialization w/o waiting for the delay
+int check_init_on_open(statefs_server *server)
+{
+    int errors = 0;
+    auto provider = new BenchProvider("bench-open", server);
+    ProviderHost host(provider);
+    auto const &src = provider->ns().source();
+    auto ready = host.find("ProviderState.bench-open.Ready");
+    host.connect(host.find("Bench.SignalStrength"));
+    auto start = statefs::host::monotonic_ns();
+    wait([&src]() { return src.inits != 0; });
+    auto elapsed_ms = (statefs::host::monotonic_ns() - start) / 1000000;
+    errors += check(src.inits == 1 && host.read(ready) == "1"
+                    , "init on open");
+    errors += check(elapsed_ms < static_cast<uint64_t>(atoi(lazy_delay_ms))
+                    , "init is not delayed");
+    return errors;
+}
+
+// staged values are published on the outermost commit, once per
+// changed property
+int check_transactions(statefs_server *server)
+{
+    int errors = 0;
+    auto provider = new BenchProvider("bench-tx", server);
+    ProviderHost host(provider);
+    auto &ns = provider->ns();
+    auto strength = host.find("Bench.SignalStrength");
+    auto tech = host.find("Bench.DataTechnology");
+    auto status = host.find("Bench.RegistrationStatus");
+    host.connect_all();
+    host.reset_counters();
+    {
+        Transaction<PropertiesSource> outer(&ns.source());
+        ns.updateProperty(size_t(0), 1u);
+        {
+            Transaction<PropertiesSource> inner(&ns.source());
+            ns.updateProperty(size_t(0), 2u);
+            // the same as the default value
+            ns.updateProperty(size_t(1), "unknown");
+            ns.updateProperty(size_t(2), "registered");
+        }
+        errors += check(!host.changes(strength) && !host.changes(status)
+                        , "inner commit");
+    }
+    errors += check(host.changes(strength) == 1 && host.changes(status) == 1
+                    && !host.changes(tech), "outer commit");
+    errors += check(host.read(strength) == "2"
+                    && host.read(status) == "registered", "last value");
+
+    // value returned to the published one is not published again
+    host.reset_counters();
+    {
+        Transaction<PropertiesSource> tx(&ns.source());
+        ns.updateProperty(size_t(0), 3u);
+        ns.updateProperty(size_t(0), 2u);
+    }
+    errors += check(!host.changes(strength), "restored value");
+    return errors;
+}
+
+DefaultProperties defaults(char const *strength)
+{
+    DefaultProperties res;
+    for (auto const &n : names)
+        res.push_back(std::make_pair(n[0], n[2]));
+    res[0].second = strength;
+    return res;
+}
+
+// unchanged values should not reach setters
+int check_counters(BenchNs &ns)
+{
+    auto const a = source_properties(50, "lte");
+    auto const b = source_properties(51, "umts");
+    auto before = ns.counters();
+    ns.source().setProperties(a);
+    ns.source().setProperties(b);
+    ns.source().setProperties(b);
+    auto after = ns.counters();
+    auto updates = after.updates - before.updates;
+    auto suppressed = after.suppressed - before.suppressed;
+    // 3 maps with 10 known properties each: the second one changes
+    // 2 of them, the last one is the same
+    if (updates != 30 || suppressed != 18) {
+        std::cerr << "Unexpected counters: updates=" << updates
+                  << " suppressed=" << suppressed << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+PathPropertiesArray path_properties(int count)
+{
+    PathPropertiesArray res;
+    for (int i = 0; i < count; ++i) {
+        QDBusObjectPath path(QString("/ril_%1/context%2").arg(i / 4).arg(i));
+        QVariantMap props = {
+            {"Type", "internet"}, {"Active", i == 0}
+            , {"AccessPointName", "internet"}, {"Protocol", "ip"}
+        };
+        res.append(std::make_tuple(path, props));
+    }
+    return res;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    ::setenv("STATEFS_PROVIDER_LAZY", lazy_delay_ms, 1);
+    QCoreApplication app(argc, argv);
+    qDBusRegisterMetaType<PathProperties>();
+    qDBusRegisterMetaType<PathPropertiesArray>();
+
+    statefs_server server;
+    ::memset(&server, 0, sizeof(server));
+    if (check_lazy_init(&server) || check_init_on_open(&server)
+        || check_transactions(&server))
+        return 1;
+
+    BenchNs ns;
+    if (check_counters(ns))
+        return 1;
+
+    static const size_t count = 100000;
+    QVariantMap const maps[] = {
+        source_properties(50, "lte"), source_properties(51, "umts")
+    };
+    // alternating values to avoid change suppression
+    bench::report("setProperties(QVariantMap)"
+                  , bench::measure(count, [&ns, &maps](size_t i) {
+                          ns.source().setProperties(maps[i & 1]);
+                      }));
+    bench::report("setProperties(QVariantMap, unchanged)"
+                  , bench::measure(count, [&ns, &maps](size_t) {
+                          ns.source().setProperties(maps[0]);
+                      }));
+
+    DefaultProperties const defs[] = { defaults("0"), defaults("1") };
+    bench::report("setProperties(DefaultProperties)"
+                  , bench::measure(count, [&ns, &defs](size_t i) {
+                          ns.setDefaultProperties(defs[i & 1]);
+                      }));
+
+    QString const strength_name("Strength");
+    QVariant const strength[] = { QVariant(42u), QVariant(43u) };
+    bench::report("updateProperty(name)"
+                  , bench::measure(count, [&](size_t i) {
+                          ns.updateProperty(strength_name, strength[i & 1]);
+                      }));
+    bench::report("updateProperty(idx)"
+                  , bench::measure(count, [&ns, &strength](size_t i) {
+                          ns.updateProperty(size_t(0), strength[i & 1]);
+                      }));
+
+    // marshalling goes through TupleDBus for each array element,
+    // demarshalling of the received reply is measured by
+    // bench-objects
+    PathProperties const one = path_properties(1).at(0);
+    auto const all = path_properties(40);
+    bench::report("TupleDBus output (oa{sv})"
+                  , bench::measure(count, [&one](size_t) {
+                          QDBusArgument arg;
+                          arg << one;
+                      }));
+    bench::report("TupleDBus output a(oa{sv}) x40"
+                  , bench::measure(count / 100, [&all](size_t) {
+                          QDBusArgument arg;
+                          arg << all;
+                      }));
+    return 0;
+}
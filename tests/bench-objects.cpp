@@ -0,0 +1,192 @@
+#include <statefs/qt/objects.hpp>
+#include "bench.hpp"
+#include "dbus-types.hpp"
+
+#include <QCoreApplication>
+#include <QDBusConnection>
+#include <QDBusMessage>
+#include <QDBusMetaType>
+#include <QDBusObjectPath>
+#include <QDBusPendingReply>
+#include <QDBusServer>
+#include <QDBusVirtualObject>
+#include <QEventLoop>
+#include <QStringList>
+#include <QTimer>
+
+#include <tuple>
+
+using statefs::qt::find_object;
+
+namespace {
+
+enum { service_count = 40 };
+
+// connman-like service list, only a few properties are used by the
+// provider
+PathPropertiesArray services()
+{
+    PathPropertiesArray res;
+    for (int i = 0; i < service_count; ++i) {
+        auto name = QString("wifi_%1").arg(i);
+        QVariantMap ipv4 = {
+            {"Method", "dhcp"}, {"Address", "192.168.1.10"}
+            , {"Netmask", "255.255.255.0"}, {"Gateway", "192.168.1.1"}
+        };
+        QVariantMap ethernet = {
+            {"Method", "auto"}, {"Interface", "wlan0"}
+            , {"Address", "00:11:22:33:44:55"}, {"MTU", 1500u}
+        };
+        QVariantMap props = {
+            {"Type", "wifi"}, {"Name", name}
+            , {"State", (i == service_count - 1) ? "online" : "idle"}
+            , {"Strength", QVariant::fromValue<uchar>(i)}
+            , {"Security", QStringList({"psk", "wps"})}
+            , {"Favorite", false}, {"Immutable", false}
+            , {"AutoConnect", false}, {"Error", ""}
+            , {"IPv4", ipv4}, {"IPv4.Configuration", ipv4}
+            , {"Ethernet", ethernet}
+            , {"Nameservers", QStringList({"8.8.8.8", "8.8.4.4"})}
+            , {"Domains", QStringList({"example.com"})}
+        };
+        QDBusObjectPath path("/net/connman/service/" + name);
+        res.append(std::make_tuple(path, props));
+    }
+    return res;
+}
+
+class Services : public QDBusVirtualObject
+{
+public:
+    Services() : reply_(QVariant::fromValue(services())) {}
+
+    virtual QString introspect(QString const &) const
+    {
+        return QString();
+    }
+
+    virtual bool handleMessage(QDBusMessage const &msg
+                               , QDBusConnection const &conn)
+    {
+        return conn.send(msg.createReply(reply_));
+    }
+
+private:
+    QVariant reply_;
+};
+
+static QStringList const keys = {"Name", "Strength", "Type", "State"};
+
+// received reply argument is not demarshalled until it is read, so
+// each iteration reads its own copy
+QDBusArgument argument(QDBusMessage const &reply)
+{
+    return qvariant_cast<QDBusArgument>(reply.arguments().value(0));
+}
+
+int check_equivalence(QDBusMessage const &reply)
+{
+    auto expected = qdbus_cast<PathPropertiesArray>(argument(reply));
+    int pos = 0, errors = 0;
+    find_object(argument(reply), keys
+                , [&](QString const &path, QVariantMap const &props) {
+                    auto const &info = expected.at(pos++);
+                    auto const &all = std::get<1>(info);
+                    if (path != std::get<0>(info).path()) {
+                        std::cerr << "Path mismatch " << path.toStdString()
+                                  << std::endl;
+                        ++errors;
+                    }
+                    if (props.size() != keys.size()) {
+                        std::cerr << "Got " << props.size() << " props"
+                                  << std::endl;
+                        ++errors;
+                    }
+                    for (auto const &k : keys) {
+                        if (props.value(k) != all.value(k)) {
+                            std::cerr << "Mismatch for " << k.toStdString()
+                                      << std::endl;
+                            ++errors;
+                        }
+                    }
+                    return false;
+                });
+    if (pos != expected.size()) {
+        std::cerr << "Read " << pos << " objects of " << expected.size()
+                  << std::endl;
+        ++errors;
+    }
+    return errors;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    qDBusRegisterMetaType<PathProperties>();
+    qDBusRegisterMetaType<PathPropertiesArray>();
+
+    // reply should be really marshalled and received to get
+    // QDBusArgument, so it is passed through the peer connection
+    Services services;
+    QDBusServer server("unix:tmpdir=/tmp");
+    QObject::connect(&server, &QDBusServer::newConnection
+                     , [&services](QDBusConnection conn) {
+                         conn.registerVirtualObject("/", &services);
+                     });
+    auto conn = QDBusConnection::connectToPeer(server.address(), "bench");
+    if (!conn.isConnected()) {
+        std::cerr << "Can't connect to the peer, skipping" << std::endl;
+        return 0;
+    }
+    auto msg = QDBusMessage::createMethodCall
+        ("", "/", "net.connman.Manager", "GetServices");
+    QDBusPendingReply<PathPropertiesArray> call = conn.asyncCall(msg);
+    // server side can be processed in this thread
+    QDBusPendingCallWatcher watcher(call);
+    QEventLoop loop;
+    QObject::connect(&watcher, &QDBusPendingCallWatcher::finished
+                     , &loop, &QEventLoop::quit);
+    QTimer::singleShot(5000, &loop, SLOT(quit()));
+    loop.exec();
+    if (!call.isFinished() || call.isError()) {
+        std::cerr << "GetServices error: "
+                  << call.error().message().toStdString() << std::endl;
+        return 1;
+    }
+    auto reply = call.reply();
+    if (check_equivalence(reply))
+        return 1;
+
+    static const size_t count = 10000;
+    bench::report("qdbus_cast<PathPropertiesArray>"
+                  , bench::measure(count, [&reply](size_t) {
+                          auto v = qdbus_cast<PathPropertiesArray>
+                              (argument(reply));
+                      }));
+    bench::report("find_object(all keys)"
+                  , bench::measure(count, [&reply](size_t) {
+                          find_object(argument(reply), QStringList()
+                                      , [](QString const&, QVariantMap const&) {
+                                          return false;
+                                      });
+                      }));
+    bench::report("find_object(4 keys)"
+                  , bench::measure(count, [&reply](size_t) {
+                          find_object(argument(reply), keys
+                                      , [](QString const&, QVariantMap const&) {
+                                          return false;
+                                      });
+                      }));
+    // the usual case: default service is online
+    bench::report("find_object(4 keys, first)"
+                  , bench::measure(count, [&reply](size_t) {
+                          find_object(argument(reply), keys
+                                      , [](QString const&, QVariantMap const&) {
+                                          return true;
+                                      });
+                      }));
+    QDBusConnection::disconnectFromPeer("bench");
+    return 0;
+}
@@ -0,0 +1,109 @@
+#include "schedule.hpp"
+#include "bench.hpp"
+
+#include <algorithm>
+#include <cstdio>
+
+using statefs::udev::PollSchedule;
+
+namespace {
+
+int check(bool is_ok, char const *what)
+{
+    if (!is_ok)
+        std::cerr << "Failed: " << what << std::endl;
+    return is_ok ? 0 : 1;
+}
+
+// 5Wh battery, energy is in uWh like energy_now
+const long energy_per_percent = 50000;
+
+struct Load
+{
+    char const *name;
+    // uWh/s, negative while discharging
+    double rate;
+    bool is_blanked;
+    // upper limit of wakeups per hour
+    long max_wakeups;
+};
+
+/// interval used before: half of the time per percent at the
+/// maximal discharge rate seen (10000 initially), 4s while charging
+long old_interval(double rate)
+{
+    if (rate > 0)
+        return 4;
+    return rate ? std::max(energy_per_percent / 10000 / 2, 1l) : 5;
+}
+
+int check_wakeups()
+{
+    Load const loads[] = {
+        { "idle, blanked", -83, true, 4 }
+        , { "idle", -83, false, 15 }
+        , { "active", -417, false, 65 }
+        , { "charging", 1000, false, 150 }
+        , { "no energy_now", 0, true, 50 }
+    };
+    PollSchedule schedule;
+    int errors = 0;
+    for (auto const &l : loads) {
+        auto interval = schedule.interval
+            (energy_per_percent, l.rate, false, l.is_blanked);
+        auto wakeups = 3600 / interval;
+        ::printf("%-14s interval %4lds, wakeups/hour %4ld (was %4ld)\n"
+                 , l.name, interval, wakeups, 3600 / old_interval(l.rate));
+        if (wakeups > l.max_wakeups) {
+            std::cerr << "Too many wakeups: " << l.name << std::endl;
+            ++errors;
+        }
+    }
+    errors += check(schedule.interval(energy_per_percent, -1e6, false, false)
+                    == 2, "minimal interval");
+    errors += check(schedule.interval(energy_per_percent, -1e-9, false, true)
+                    == 1200, "maximal interval, very low rate");
+    errors += check(schedule.interval(energy_per_percent, 1000, true, false)
+                    == 5, "settling");
+    errors += check(schedule.interval(0, -83, false, false) == 20
+                    , "unknown energy");
+    return errors;
+}
+
+int check_coalescing()
+{
+    static const uint64_t sec = 1000000000ull;
+    int errors = 0;
+    uint64_t slack = PollSchedule::slack_ns(300);
+    errors += check(slack == 37 * sec + sec / 2, "slack");
+    auto expire = 1000 * sec + 123;
+    auto res = PollSchedule::coalesce(expire, slack);
+    errors += check(res >= expire && res < expire + slack, "slack range");
+    errors += check(res % (37 * sec) == 0, "grid");
+    errors += check(PollSchedule::coalesce(expire, sec / 2) == expire
+                    , "subsecond slack");
+    errors += check(PollSchedule::coalesce(74 * sec, slack) == 74 * sec
+                    , "aligned expiration");
+    return errors;
+}
+
+}
+
+int main()
+{
+    if (check_wakeups() || check_coalescing())
+        return 1;
+
+    static const size_t count = 1000000;
+    PollSchedule schedule;
+    volatile uint64_t sink = 0;
+    bench::report("PollSchedule::interval+coalesce", bench::measure
+                  (count, [&](size_t i) {
+                      auto interval = schedule.interval
+                          (energy_per_percent, -83.0 - (i % 100), false
+                           , i & 1);
+                      sink = PollSchedule::coalesce
+                          (i * 1000000ull, PollSchedule::slack_ns(interval));
+                  }));
+    return 0;
+}
@@ -0,0 +1,104 @@
+#include <statefs/qt/static_map.hpp>
+#include "bench.hpp"
+
+#include <QHash>
+#include <QString>
+#include <QStringList>
+
+using statefs::qt::StaticMapEntry;
+using statefs::qt::make_static_map;
+
+namespace {
+
+// ofono network registration properties
+static constexpr StaticMapEntry<int> net_entries[] = {
+    { "Name", 1 }
+    , { "Strength", 2 }
+    , { "Status", 3 }
+    , { "Technology", 4 }
+};
+static constexpr auto net_map = make_static_map(net_entries);
+static_assert(net_map.is_perfect(), "Check network property names");
+
+// both keys get the same slot with the initial seed, so the map
+// should use another one
+static constexpr StaticMapEntry<int> colliding_entries[] = {
+    { "Status", 1 }
+    , { "Online", 2 }
+};
+static_assert(statefs::qt::static_map::slot(colliding_entries, 0, 7, 0)
+              == statefs::qt::static_map::slot(colliding_entries, 0, 7, 1)
+              , "Keys should collide with the seed 0");
+static constexpr auto colliding_map = make_static_map(colliding_entries);
+static_assert(colliding_map.is_perfect(), "Seed is not found");
+
+static constexpr StaticMapEntry<int> duplicated_entries[] = {
+    { "Name", 1 }
+    , { "Name", 2 }
+};
+static_assert(!make_static_map(duplicated_entries).is_perfect()
+              , "Duplicated keys can't be mapped");
+
+int check(bool is_ok, char const *what)
+{
+    if (!is_ok)
+        std::cerr << "Failed: " << what << std::endl;
+    return is_ok ? 0 : 1;
+}
+
+template <typename MapT>
+bool is_found(MapT const &map, QString const &key, int expected)
+{
+    auto p = map.find(key);
+    return p && *p == expected;
+}
+
+int check_lookup()
+{
+    int errors = 0;
+    for (auto const &e : net_entries)
+        errors += check(is_found(net_map, e.key, e.value), e.key);
+    errors += check(is_found(colliding_map, "Status", 1)
+                    && is_found(colliding_map, "Online", 2)
+                    , "colliding keys");
+
+    QString const misses[] = {
+        "", "Stat", "Statuss", "status", "Names", "Nam"
+        , QString(QChar(0x153)) + "tatus", "Offline", "Strength "
+    };
+    for (auto const &k : misses)
+        errors += check(!net_map.find(k) && !colliding_map.find(k)
+                        , "miss");
+    // many of them share slots with present keys
+    for (int i = 0; i < 100; ++i) {
+        auto k = QString("Key%1").arg(i);
+        errors += check(!net_map.find(k) && !colliding_map.find(k)
+                        , "generated miss");
+    }
+    errors += check(net_map.value("Unknown", -1) == -1
+                    && net_map.value("Status", -1) == 3, "value()");
+    return errors;
+}
+
+}
+
+int main()
+{
+    if (check_lookup())
+        return 1;
+
+    static const size_t count = 1000000;
+    QStringList const names = {"Name", "Strength", "Status", "Mode"};
+    QHash<QString, int> hash;
+    for (auto const &e : net_entries)
+        hash.insert(e.key, e.value);
+    volatile int sink = 0;
+    bench::report("StaticMap::find", bench::measure(count, [&](size_t i) {
+                auto p = net_map.find(names[i % names.size()]);
+                sink = p ? *p : 0;
+            }));
+    bench::report("QHash::value", bench::measure(count, [&](size_t i) {
+                sink = hash.value(names[i % names.size()]);
+            }));
+    return 0;
+}
@@ -0,0 +1,69 @@
+#include <statefs/qt/stats.hpp>
+#include "bench.hpp"
+
+#include <cstdlib>
+
+using statefs::qt::CallTimer;
+using statefs::qt::MethodStats;
+using statefs::qt::method_stats;
+
+namespace {
+
+bool check_range(char const *name, uint64_t v, uint64_t lo, uint64_t hi)
+{
+    if (v >= lo && v <= hi)
+        return true;
+    std::cerr << name << "=" << v << " is out of ["
+              << lo << ", " << hi << "]" << std::endl;
+    return false;
+}
+
+// percentiles are reported with bucket precision (<25%)
+int check_percentiles()
+{
+    auto stats = method_stats("test.Percentiles");
+    if (!stats) {
+        std::cerr << "No statistics" << std::endl;
+        return 1;
+    }
+    for (uint64_t us = 1; us <= 1000; ++us)
+        stats->record(us * 1000, (us % 10) == 0);
+
+    auto s = stats->summary();
+    int errors = 0;
+    errors += !check_range("calls", s.calls, 1000, 1000);
+    errors += !check_range("errors", s.errors, 100, 100);
+    errors += !check_range("max", s.max, 1000, 1000);
+    errors += !check_range("p50", s.p50, 500, 625);
+    errors += !check_range("p90", s.p90, 900, 1000);
+    errors += !check_range("p99", s.p99, 990, 1000);
+    if (method_stats("test.Percentiles") != stats) {
+        std::cerr << "Lookup returns different entry" << std::endl;
+        ++errors;
+    }
+    return errors;
+}
+
+}
+
+int main()
+{
+    ::setenv("STATEFS_PROVIDER_STATS", "1", 1);
+    if (check_percentiles())
+        return 1;
+
+    static const size_t count = 1000000;
+    auto stats = method_stats("test.Record");
+    bench::report("MethodStats::record", bench::measure(count, [stats](size_t i) {
+                stats->record(i, false);
+            }));
+    bench::report("CallTimer w/o method", bench::measure(count, [](size_t) {
+                CallTimer timer;
+                timer.done(false);
+            }));
+    bench::report("CallTimer", bench::measure(count, [](size_t) {
+                CallTimer timer("org.ofono.NetworkRegistration.GetProperties");
+                timer.done(false);
+            }));
+    return 0;
+}
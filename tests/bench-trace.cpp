@@ -0,0 +1,101 @@
+#include <statefs/qt/record.hpp>
+#include "bench.hpp"
+
+#include <QDBusObjectPath>
+#include <QDBusVariant>
+#include <QStringList>
+
+#include <string>
+#include <vector>
+
+namespace trace = statefs::qt::trace;
+
+namespace {
+
+// net.connman.Technology.PropertyChanged (sv)
+QVariantList property_changed()
+{
+    return QVariantList{
+        QString("Powered"), QVariant::fromValue(QDBusVariant(true))};
+}
+
+// org.freedesktop.DBus.Properties.PropertiesChanged (sa{sv}as)
+QVariantList properties_changed()
+{
+    QVariantMap changed;
+    changed.insert("Percentage", 87.0);
+    changed.insert("State", 2u);
+    changed.insert("TimeToEmpty", qlonglong(12345));
+    changed.insert("NativePath", QString("battery"));
+    return QVariantList{
+        QString("org.freedesktop.UPower.Device"), changed
+            , QStringList{"IconName"}};
+}
+
+// decoded arguments should be encoded into the same bytes
+int check_roundtrip()
+{
+    std::vector<QVariantList> samples = {
+        property_changed(), properties_changed()
+        , QVariantList{QVariant::fromValue(QDBusObjectPath("/ril_0"))
+                       , QByteArray("\x01\xff", 2), -7, 4000000000u}
+    };
+    int errors = 0;
+    for (size_t i = 0; i < samples.size(); ++i) {
+        std::string encoded, reencoded;
+        trace::Encoder e(encoded);
+        if (!trace::encode(e, samples[i])) {
+            std::cerr << "Can't encode sample " << i << std::endl;
+            ++errors;
+            continue;
+        }
+        QVariantList decoded;
+        trace::Decoder d(encoded);
+        trace::Encoder e2(reencoded);
+        if (!trace::decode(d, decoded) || !d.at_end()
+            || decoded.size() != samples[i].size()
+            || !trace::encode(e2, decoded) || reencoded != encoded) {
+            std::cerr << "Roundtrip mismatch for sample " << i << std::endl;
+            ++errors;
+        }
+    }
+    return errors;
+}
+
+}
+
+int main()
+{
+    if (check_roundtrip())
+        return 1;
+
+    static const size_t count = 200000;
+    struct {
+        char const *name;
+        QVariantList args;
+    } const samples[] = {
+        { "PropertyChanged", property_changed() }
+        , { "PropertiesChanged", properties_changed() }
+    };
+    std::string buf;
+    for (auto const &sample : samples) {
+        auto const &args = sample.args;
+        std::string name = std::string("encode ") + sample.name;
+        bench::report(name.c_str(), bench::measure(count, [&](size_t) {
+                    buf.clear();
+                    trace::Encoder e(buf);
+                    trace::encode(e, args);
+                }));
+
+        std::string encoded;
+        trace::Encoder e(encoded);
+        trace::encode(e, args);
+        name = std::string("decode ") + sample.name;
+        bench::report(name.c_str(), bench::measure(count, [&](size_t) {
+                    trace::Decoder d(encoded);
+                    QVariantList decoded;
+                    trace::decode(d, decoded);
+                }));
+    }
+    return 0;
+}
@@ -0,0 +1,196 @@
+#include "power_supply.hpp"
+#include "bench.hpp"
+
+#include <stdlib.h>
+#include <string>
+#include <string.h>
+
+using statefs::udev::PowerSupplyInfo;
+using statefs::udev::PowerDevice;
+using statefs::udev::PowerTable;
+using statefs::udev::parse_long;
+
+namespace {
+
+struct Property
+{
+    char const *name;
+    char const *value;
+};
+
+// typical power_supply change event properties
+Property const battery_event[] = {
+    {"POWER_SUPPLY_NAME", "battery"}
+    , {"POWER_SUPPLY_STATUS", "Discharging"}
+    , {"POWER_SUPPLY_HEALTH", "Good"}
+    , {"POWER_SUPPLY_PRESENT", "1"}
+    , {"POWER_SUPPLY_ONLINE", "1"}
+    , {"POWER_SUPPLY_TECHNOLOGY", "Li-ion"}
+    , {"POWER_SUPPLY_VOLTAGE_NOW", "3912000"}
+    , {"POWER_SUPPLY_CAPACITY", "87"}
+    , {"POWER_SUPPLY_ENERGY_FULL", "6950000"}
+    , {"POWER_SUPPLY_ENERGY_NOW", "6046500"}
+    , {"POWER_SUPPLY_CURRENT_NOW", "-412000"}
+    , {"POWER_SUPPLY_TEMP", "293"}
+    , {"POWER_SUPPLY_TYPE", "Battery"}
+    , {nullptr, nullptr}
+};
+
+Property const charger_event[] = {
+    {"POWER_SUPPLY_NAME", "usb"}
+    , {"POWER_SUPPLY_PRESENT", "1"}
+    , {"POWER_SUPPLY_ONLINE", "0"}
+    , {"POWER_SUPPLY_TYPE", "USB"}
+    , {nullptr, nullptr}
+};
+
+Property const invalid_event[] = {
+    {"POWER_SUPPLY_CAPACITY", "abc"}
+    , {"POWER_SUPPLY_ENERGY_NOW", ""}
+    , {"POWER_SUPPLY_TYPE", "SomeVeryLongTypeName"}
+    , {"CAPACITY", "5"}
+    , {nullptr, nullptr}
+};
+
+/// the same lookup as udev_device_get_property_value() does
+struct Event
+{
+    Event(Property const *props) : props_(props) {}
+
+    char const *operator ()(char const *name) const
+    {
+        for (auto p = props_; p->name; ++p)
+            if (!strcmp(p->name, name))
+                return p->value;
+        return nullptr;
+    }
+
+    Property const *props_;
+};
+
+int check(bool is_ok, char const *what)
+{
+    if (!is_ok)
+        std::cerr << "Failed: " << what << std::endl;
+    return is_ok ? 0 : 1;
+}
+
+int check_parsing()
+{
+    int errors = 0;
+    PowerSupplyInfo info;
+    info.load(Event(battery_event));
+    errors += check(info.type() && std::string(info.type()) == "Battery"
+                    , "battery type");
+    errors += check(info.has(PowerSupplyInfo::EnergyNow)
+                    && info.value(PowerSupplyInfo::EnergyNow) == 6046500
+                    , "energy_now");
+    errors += check(info.value(PowerSupplyInfo::EnergyFull) == 6950000
+                    , "energy_full");
+    errors += check(info.value(PowerSupplyInfo::Capacity) == 87, "capacity");
+    errors += check(info.value(PowerSupplyInfo::Online) == 1, "online");
+
+    info.load(Event(charger_event));
+    errors += check(info.type() && std::string(info.type()) == "USB"
+                    , "charger type");
+    errors += check(info.has(PowerSupplyInfo::Online)
+                    && !info.value(PowerSupplyInfo::Online), "offline");
+    // missing properties are read from sysfs
+    errors += check(!info.has(PowerSupplyInfo::EnergyNow)
+                    && !info.has(PowerSupplyInfo::Capacity)
+                    , "missing properties");
+
+    info.load(Event(invalid_event));
+    errors += check(!info.has(PowerSupplyInfo::Capacity)
+                    && !info.has(PowerSupplyInfo::EnergyNow)
+                    && !info.type(), "invalid values");
+    info.load([](char const *) -> char const * { return nullptr; });
+    errors += check(!info.type() && !info.has(PowerSupplyInfo::Online)
+                    , "no properties");
+
+    long v = 0;
+    char const negative[] = "-412000";
+    errors += check(parse_long(negative, negative + sizeof(negative) - 1, v)
+                    && v == -412000, "negative");
+    errors += check(!parse_long(negative, negative + 1, v), "sign only");
+    return errors;
+}
+
+int check_aggregation()
+{
+    typedef PowerDevice::Kind K;
+    int errors = 0;
+    PowerTable t;
+    t.update("/bat0", PowerDevice{K::Battery, false, 3000000, 6000000, 50});
+    t.update("/bat1", PowerDevice{K::Battery, false, 1800000, 2000000, 90});
+    t.update("/usb", PowerDevice{K::Charger, false, 0, 0, 0});
+    t.update("/ac", PowerDevice{K::Charger, true, 0, 0, 0});
+    errors += check(t.size() == 4 && t.batteries() == 2, "table size");
+    errors += check(t.energy_now() == 4800000 && t.energy_full() == 8000000
+                    , "energy sum");
+    // (50 * 6 + 90 * 2) / 8
+    errors += check(t.capacity() == 60, "weighted capacity");
+    errors += check(t.is_online(), "online");
+    errors += check(t.main_battery() == std::string("/bat0"), "main battery");
+
+    // the state is replaced, not accumulated
+    t.update("/bat1", PowerDevice{K::Battery, false, 1600000, 2000000, 80});
+    t.update("/ac", PowerDevice{K::Charger, false, 0, 0, 0});
+    errors += check(t.energy_now() == 4600000 && t.capacity() == 57
+                    && t.size() == 4, "update");
+    errors += check(!t.is_online(), "offline");
+
+    t.remove("/bat0");
+    t.remove("/unknown");
+    errors += check(t.energy_full() == 2000000 && t.capacity() == 80
+                    && t.main_battery() == std::string("/bat1"), "remove");
+    t.clear();
+    errors += check(!t.size() && !t.main_battery() && !t.capacity()
+                    , "clear");
+    // energy_full is not provided
+    t.update("/bat", PowerDevice{K::Battery, false, 0, 0, 40});
+    errors += check(t.capacity() == 40, "capacity w/o energy");
+    return errors;
+}
+
+}
+
+int main()
+{
+    if (check_parsing() || check_aggregation())
+        return 1;
+
+    static const size_t count = 1000000;
+    PowerSupplyInfo info;
+    Event const battery(battery_event);
+    bench::report("PowerSupplyInfo::load(battery)"
+                  , bench::measure(count, [&](size_t) {
+                          info.load(battery);
+                      }));
+    // the way attributes were converted before
+    char const *values[] = {"6046500", "87", "1"};
+    volatile long sink = 0;
+    bench::report("atoi(std::string) x3", bench::measure(count, [&](size_t) {
+                for (auto v : values)
+                    sink = atoi(std::string(v).c_str());
+            }));
+    bench::report("strtol x3", bench::measure(count, [&](size_t) {
+                for (auto v : values)
+                    sink = strtol(v, nullptr, 10);
+            }));
+
+    PowerTable table;
+    char const *paths[] = {"/ac", "/usb", "/bat0", "/bat1"};
+    for (auto p : paths)
+        table.update(p, PowerDevice{PowerDevice::Kind::Battery, false
+                    , 1000000, 2000000, 50});
+    std::string const bat1("/bat1");
+    bench::report("PowerTable::update+capacity", bench::measure
+                  (count, [&](size_t i) {
+                      table.update(bat1, PowerDevice{
+                              PowerDevice::Kind::Battery, false
+                                  , long(i % 1000), 2000000, 50});
+                      sink = table.capacity();
+                  }));
+    return 0;
+}
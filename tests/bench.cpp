@@ -0,0 +1,65 @@
+#include "bench.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+
+static std::atomic<size_t> alloc_count(0);
+
+// glibc allocator entry points, used to count allocations made by
+// all libraries w/o replacing the allocator itself
+extern "C" {
+
+void *__libc_malloc(size_t);
+void *__libc_calloc(size_t, size_t);
+void *__libc_realloc(void *, size_t);
+
+void *malloc(size_t size)
+{
+    alloc_count.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+    alloc_count.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t size)
+{
+    alloc_count.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(p, size);
+}
+
+}
+
+namespace bench {
+
+size_t allocations()
+{
+    return alloc_count.load(std::memory_order_relaxed);
+}
+
+Result median(std::vector<Result> res)
+{
+    auto mid = res.begin() + res.size() / 2;
+    std::nth_element(res.begin(), mid, res.end()
+                     , [](Result const &a, Result const &b) {
+                         return a.ns_per_op < b.ns_per_op;
+                     });
+    auto ns = mid->ns_per_op;
+    std::nth_element(res.begin(), mid, res.end()
+                     , [](Result const &a, Result const &b) {
+                         return a.allocs_per_op < b.allocs_per_op;
+                     });
+    return Result{ns, mid->allocs_per_op};
+}
+
+void report(char const *name, Result const &res)
+{
+    ::printf("%-40s %10.1f ns/op %8.2f allocs/op\n"
+             , name, res.ns_per_op, res.allocs_per_op);
+}
+
+}
@@ -0,0 +1,56 @@
+#ifndef _STATEFS_PROVIDERS_TESTS_BENCH_HPP_
+#define _STATEFS_PROVIDERS_TESTS_BENCH_HPP_
+
+#include <chrono>
+#include <cstddef>
+#include <iostream>
+#include <vector>
+
+namespace bench {
+
+/// number of malloc/calloc/realloc calls made by the process, it
+/// covers also allocations made by Qt and libstdc++
+size_t allocations();
+
+struct Result
+{
+    double ns_per_op;
+    double allocs_per_op;
+};
+
+/// median of each field separately, results should not be empty
+Result median(std::vector<Result> res);
+
+/// number of measurement rounds, median of rounds is reported to
+/// filter out scheduling noise
+enum { default_rounds = 5 };
+
+template <typename FnT>
+Result measure(size_t count, FnT fn, size_t rounds = default_rounds)
+{
+    // warm up: let buffers to grow to the steady state size
+    for (size_t i = 0; i < count / 10 + 1; ++i)
+        fn(i);
+
+    std::vector<Result> res;
+    res.reserve(rounds);
+    for (size_t r = 0; r < rounds; ++r) {
+        auto allocs_before = allocations();
+        auto begin = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < count; ++i)
+            fn(i);
+        auto end = std::chrono::steady_clock::now();
+        auto allocs = allocations() - allocs_before;
+
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>
+            (end - begin).count();
+        res.push_back(Result{double(ns) / count, double(allocs) / count});
+    }
+    return median(res);
+}
+
+void report(char const *name, Result const &);
+
+}
+
+#endif // _STATEFS_PROVIDERS_TESTS_BENCH_HPP_
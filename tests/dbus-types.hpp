@@ -0,0 +1,17 @@
+#ifndef _STATEFS_PROVIDERS_TESTS_DBUS_TYPES_HPP_
+#define _STATEFS_PROVIDERS_TESTS_DBUS_TYPES_HPP_
+
+#include <QDBusObjectPath>
+#include <QList>
+#include <QMetaType>
+#include <QVariant>
+
+#include <tuple>
+
+// a(oa{sv}) returned by connman GetServices and ofono GetModems etc.
+typedef std::tuple<QDBusObjectPath, QVariantMap> PathProperties;
+Q_DECLARE_METATYPE(PathProperties);
+typedef QList<PathProperties> PathPropertiesArray;
+Q_DECLARE_METATYPE(PathPropertiesArray);
+
+#endif // _STATEFS_PROVIDERS_TESTS_DBUS_TYPES_HPP_
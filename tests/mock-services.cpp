@@ -0,0 +1,355 @@
+#include "mock-services.hpp"
+
+#include <statefs/qt/dbus.hpp>
+
+#include <QDBusMetaType>
+#include <QDBusVariant>
+#include <QStringList>
+
+#include <iostream>
+
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace mock {
+
+static char const *properties_interface = "org.freedesktop.DBus.Properties";
+
+void registerDataTypes()
+{
+    qDBusRegisterMetaType<PathProperties>();
+    qDBusRegisterMetaType<PathPropertiesArray>();
+}
+
+void Object::method(QString const &interface, QString const &member
+                    , QVariantList const &reply)
+{
+    method(interface, member, [reply](QDBusMessage const &) {
+            return reply;
+        });
+}
+
+void Object::method(QString const &interface, QString const &member
+                    , method_type const &fn)
+{
+    methods_.insert(interface + "." + member, fn);
+}
+
+QDBusMessage Object::properties_reply(QDBusMessage const &msg)
+{
+    auto args = msg.arguments();
+    auto props = props_.find(args.value(0).toString());
+    if (props == props_.end())
+        return msg.createErrorReply(QDBusError::InvalidArgs
+                                    , args.value(0).toString());
+
+    if (msg.member() == "GetAll")
+        return msg.createReply(QVariant::fromValue(props.value()));
+
+    auto name = args.value(1).toString();
+    auto p = props.value().find(name);
+    if (msg.member() != "Get" || p == props.value().end())
+        return msg.createErrorReply(QDBusError::InvalidArgs, name);
+    return msg.createReply(QVariant::fromValue(QDBusVariant(p.value())));
+}
+
+bool Object::handleMessage(QDBusMessage const &msg
+                           , QDBusConnection const &conn)
+{
+    if (msg.type() != QDBusMessage::MethodCallMessage)
+        return false;
+
+    if (msg.interface() == properties_interface)
+        return conn.send(properties_reply(msg));
+
+    auto p = methods_.find(msg.interface() + "." + msg.member());
+    if (p == methods_.end())
+        return conn.send(msg.createErrorReply(QDBusError::UnknownMethod
+                                              , msg.member()));
+    return conn.send(msg.createReply(p.value()(msg)));
+}
+
+Service::Service(QString const &address, QString const &name)
+    : name_(name)
+    , conn_(QDBusConnection::connectToBus(address, "mock-" + name))
+{
+}
+
+Service::~Service()
+{
+    conn_.unregisterService(name_);
+    for (auto const &kv : objects_)
+        conn_.unregisterObject(kv.first);
+    QDBusConnection::disconnectFromBus("mock-" + name_);
+}
+
+Object & Service::object(QString const &path)
+{
+    auto &p = objects_[path];
+    if (!p)
+        p.reset(new Object());
+    return *p;
+}
+
+bool Service::start()
+{
+    if (!conn_.isConnected())
+        return false;
+
+    for (auto const &kv : objects_) {
+        if (!conn_.registerVirtualObject(kv.first, kv.second.get()))
+            return false;
+    }
+    return conn_.registerService(name_);
+}
+
+bool Service::send(size_t seq)
+{
+    auto msg = QDBusMessage::createSignal
+        (signal.path, signal.interface, signal.member);
+    msg.setArguments(signal.args[(seq + 1) & 1]);
+    return conn_.send(msg);
+}
+
+namespace {
+
+QVariant variant(QVariant const &v)
+{
+    return QVariant::fromValue(QDBusVariant(v));
+}
+
+QVariant byte(uchar v)
+{
+    return QVariant::fromValue(v);
+}
+
+QVariantList property_changed(QString const &name, QVariant const &v)
+{
+    return QVariantList{name, variant(v)};
+}
+
+QVariant objects(QString const &path, QVariantMap const &props)
+{
+    PathPropertiesArray res;
+    res.append(std::make_tuple(QDBusObjectPath(path), props));
+    return QVariant::fromValue(res);
+}
+
+QVariant paths(QStringList const &src)
+{
+    QList<QDBusObjectPath> res;
+    for (auto const &p : src)
+        res.append(QDBusObjectPath(p));
+    return QVariant::fromValue(res);
+}
+
+// modem signal strength storm
+void setup_ofono(Service &s)
+{
+    static const QString modem = "/ril_0";
+    s.object("/").method("org.ofono.Manager", "GetModems", {objects(modem, {
+                    {"Type", "hardware"}, {"Powered", true}, {"Online", true}
+                    , {"Interfaces", QStringList({
+                                "org.ofono.SimManager"
+                                , "org.ofono.NetworkRegistration"})}
+                })});
+    auto &m = s.object(modem);
+    m.method("org.ofono.SimManager", "GetProperties", {QVariantMap{
+                {"Present", true}, {"SubscriberIdentity", "244910000000000"}
+                , {"MobileCountryCode", "244"}, {"MobileNetworkCode", "91"}
+            }});
+    m.method("org.ofono.NetworkRegistration", "GetProperties", {QVariantMap{
+                {"Status", "registered"}, {"Name", "Mock"}
+                , {"Strength", byte(50)}, {"Technology", "lte"}
+                , {"MobileCountryCode", "244"}, {"MobileNetworkCode", "91"}
+            }});
+    m.method("org.ofono.NetworkRegistration", "GetOperators"
+             , {QVariant::fromValue(PathPropertiesArray())});
+    s.signal = {modem, "org.ofono.NetworkRegistration", "PropertyChanged"
+                , {property_changed("Strength", byte(50))
+                   , property_changed("Strength", byte(51))}};
+}
+
+// WLAN roaming: default service signal strength
+void setup_connman(Service &s)
+{
+    static const QString service = "/net/connman/service/wifi_mock";
+    auto &m = s.object("/");
+    m.method("net.connman.Manager", "GetProperties", {QVariantMap{
+                {"State", "online"}, {"OfflineMode", false}
+            }});
+    m.method("net.connman.Manager", "GetServices", {objects(service, {
+                    {"Name", "mock"}, {"Strength", byte(50)}
+                    , {"Type", "wifi"}, {"State", "online"}
+                })});
+    m.method("net.connman.Manager", "GetTechnologies"
+             , {QVariant::fromValue(PathPropertiesArray())});
+    s.object(service);
+    s.signal = {service, "net.connman.Service", "PropertyChanged"
+                , {property_changed("Strength", byte(50))
+                   , property_changed("Strength", byte(51))}};
+}
+
+QVariantList percentage_changed(double v)
+{
+    return QVariantList{QString("org.freedesktop.UPower.Device")
+            , QVariantMap{{"Percentage", v}}, QStringList()};
+}
+
+void setup_upower(Service &s)
+{
+    static const QString manager = "/org/freedesktop/UPower";
+    static const QString battery = manager + "/devices/battery_BAT0";
+    auto &m = s.object(manager);
+    m.properties("org.freedesktop.UPower") = QVariantMap{
+        {"OnBattery", true}, {"OnLowBattery", false}
+    };
+    m.method("org.freedesktop.UPower", "EnumerateDevices"
+             , {paths({battery})});
+    s.object(battery).properties("org.freedesktop.UPower.Device") = QVariantMap{
+        {"NativePath", "battery"}, {"Type", 2u}, {"State", 2u}
+        , {"Percentage", 50.0}, {"TimeToEmpty", qlonglong(36000)}
+        , {"TimeToFull", qlonglong(0)}
+    };
+    s.signal = {battery, properties_interface, "PropertiesChanged"
+                , {percentage_changed(50.0), percentage_changed(51.0)}};
+}
+
+void setup_bluez(Service &s)
+{
+    static const QString adapter = "/org/bluez/hci0";
+    s.object("/").method("org.bluez.Manager", "DefaultAdapter"
+                         , {QVariant::fromValue(QDBusObjectPath(adapter))});
+    auto &m = s.object(adapter);
+    m.method("org.bluez.Adapter", "GetProperties", {QVariantMap{
+                {"Powered", true}, {"Discoverable", false}
+                , {"Address", "00:11:22:33:44:55"}, {"Name", "mock"}
+            }});
+    m.method("org.bluez.Adapter", "ListDevices", {paths(QStringList())});
+    s.signal = {adapter, "org.bluez.Adapter", "PropertyChanged"
+                , {property_changed("Discoverable", false)
+                   , property_changed("Discoverable", true)}};
+}
+
+// display is blanked and unblanked
+void setup_mce(Service &s)
+{
+    auto &m = s.object("/com/nokia/mce/request");
+    m.method("com.nokia.mce.request", "get_psm_state", {false});
+    m.method("com.nokia.mce.request", "get_display_status", {"on"});
+    m.method("com.nokia.mce.request", "get_radio_states", {0xffu});
+    s.object("/com/nokia/mce/signal");
+    s.signal = {"/com/nokia/mce/signal", "com.nokia.mce.signal"
+                , "display_status_ind"
+                , {QVariantList{"on"}, QVariantList{"off"}}};
+}
+
+// profile values (the last a(sss) argument) are not used by the
+// provider, so they are not sent
+void setup_profile(Service &s)
+{
+    auto &m = s.object("/com/nokia/profiled");
+    m.method("com.nokia.profiled", "get_profile", {"general"});
+    s.signal = {"/com/nokia/profiled", "com.nokia.profiled", "profile_changed"
+                , {QVariantList{true, true, "general"}
+                   , QVariantList{true, true, "silent"}}};
+}
+
+}
+
+std::vector<Scenario> const & scenarios()
+{
+    static const std::vector<Scenario> res = {
+        {"ofono", "org.ofono", "Cellular.SignalStrength"
+         , {"50", "51"}, &setup_ofono}
+        , {"connman", "net.connman", "Internet.SignalStrength"
+           , {"50", "51"}, &setup_connman}
+        , {"upower", "org.freedesktop.UPower", "Battery.ChargePercentage"
+           , {"50", "51"}, &setup_upower}
+        , {"bluez", "org.bluez", "Bluetooth.Visible"
+           , {"0", "1"}, &setup_bluez}
+        , {"mce", "com.nokia.mce", "Screen.Blanked"
+           , {"0", "1"}, &setup_mce}
+        , {"profile", "com.nokia.profiled", "Profile.Name"
+           , {"general", "silent"}, &setup_profile}
+    };
+    return res;
+}
+
+Scenario const * find_scenario(std::string const &lib_path)
+{
+    auto pos = lib_path.rfind('/');
+    auto name = lib_path.substr(pos == std::string::npos ? 0 : pos + 1);
+    for (auto const &s : scenarios()) {
+        auto prefix = std::string("provider-") + s.provider;
+        // e.g. libprovider-ofono.so
+        auto p = name.find(prefix);
+        if (p != std::string::npos
+            && (name.size() == p + prefix.size()
+                || name[p + prefix.size()] == '.'))
+            return &s;
+    }
+    return nullptr;
+}
+
+bool wait_readable(int fd, int timeout_ms)
+{
+    pollfd p = {fd, POLLIN, 0};
+    return ::poll(&p, 1, timeout_ms) > 0;
+}
+
+void stop_process(pid_t pid)
+{
+    if (pid <= 0)
+        return;
+    ::kill(pid, SIGTERM);
+    ::waitpid(pid, nullptr, 0);
+}
+
+pid_t start_bus(std::string &address)
+{
+    int fds[2];
+    if (::pipe(fds))
+        return -1;
+
+    auto pid = ::fork();
+    if (pid < 0)
+        return -1;
+
+    if (!pid) {
+        ::close(fds[0]);
+        auto opt = "--print-address=" + std::to_string(fds[1]);
+        ::execlp("dbus-daemon", "dbus-daemon", "--session", "--nofork"
+                 , opt.c_str(), (char*)nullptr);
+        ::_exit(127);
+    }
+    ::close(fds[1]);
+    char buf[512];
+    size_t len = 0;
+    while (len < sizeof(buf) && !memchr(buf, '\n', len)
+           && wait_readable(fds[0], 5000)) {
+        auto n = ::read(fds[0], buf + len, sizeof(buf) - len);
+        if (n <= 0)
+            break;
+        len += n;
+    }
+    ::close(fds[0]);
+    auto end = static_cast<char const*>(memchr(buf, '\n', len));
+    if (!end) {
+        stop_process(pid);
+        return -1;
+    }
+    address.assign(buf, end - buf);
+    return pid;
+}
+
+void quiet_debug(QtMsgType type, QMessageLogContext const &, QString const &msg)
+{
+    if (type != QtDebugMsg)
+        std::cerr << msg.toStdString() << std::endl;
+}
+
+}
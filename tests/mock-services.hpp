@@ -0,0 +1,148 @@
+#ifndef _STATEFS_PROVIDERS_TESTS_MOCK_SERVICES_HPP_
+#define _STATEFS_PROVIDERS_TESTS_MOCK_SERVICES_HPP_
+
+#include <QDBusConnection>
+#include <QDBusMessage>
+#include <QDBusObjectPath>
+#include <QDBusVirtualObject>
+#include <QEventLoop>
+#include <QHash>
+#include <QString>
+#include <QTimer>
+#include <QVariant>
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "dbus-types.hpp"
+
+namespace mock {
+
+void registerDataTypes();
+
+/**
+ * Object replying to method calls with predefined values,
+ * org.freedesktop.DBus.Properties Get/GetAll are served from the
+ * property maps. Unknown methods are answered with UnknownMethod
+ * error, so providers are not waiting for the timeout.
+ */
+class Object : public QDBusVirtualObject
+{
+public:
+    typedef std::function<QVariantList (QDBusMessage const&)> method_type;
+
+    void method(QString const &interface, QString const &member
+                , QVariantList const &reply);
+    void method(QString const &interface, QString const &member
+                , method_type const &);
+
+    QVariantMap & properties(QString const &interface)
+    {
+        return props_[interface];
+    }
+
+    virtual QString introspect(QString const &) const { return QString(); }
+    virtual bool handleMessage(QDBusMessage const &, QDBusConnection const &);
+
+private:
+    QDBusMessage properties_reply(QDBusMessage const &);
+
+    // "<interface>.<member>" -> method
+    QHash<QString, method_type> methods_;
+    QHash<QString, QVariantMap> props_;
+};
+
+/// signal generating the load, arguments are alternated to avoid
+/// suppression of unchanged values
+struct Signal
+{
+    QString path;
+    QString interface;
+    QString member;
+    QVariantList args[2];
+};
+
+/**
+ * Service mock owning the service name on its own connection, like
+ * the real daemon. Replies correspond to the initial state
+ * (Scenario::values[0]), k-th emitted signal (counting from 0)
+ * switches the property to Scenario::values[(k + 1) % 2].
+ */
+class Service
+{
+public:
+    Service(QString const &address, QString const &name);
+    ~Service();
+
+    Object & object(QString const &path);
+
+    /// register objects and the service name
+    bool start();
+    bool send(size_t seq);
+
+    Signal signal;
+
+private:
+    QString name_;
+    QDBusConnection conn_;
+    std::map<QString, std::unique_ptr<Object> > objects_;
+};
+
+struct Scenario
+{
+    // provider library is matched by "provider-<provider>" substring
+    char const *provider;
+    char const *service;
+    // "<namespace>.<property>" updated by the signal
+    char const *property;
+    char const *values[2];
+    void (*setup)(Service &);
+};
+
+std::vector<Scenario> const & scenarios();
+
+/// @return scenario for the provider library path or nullptr
+Scenario const * find_scenario(std::string const &lib_path);
+
+bool wait_readable(int fd, int timeout_ms);
+
+/// private bus daemon, @return -1 if it can't be started
+pid_t start_bus(std::string &address);
+void stop_process(pid_t);
+
+/// message handler dropping qDebug() output of providers
+void quiet_debug(QtMsgType, QMessageLogContext const &, QString const &);
+
+/// process events until the condition is true, @return false on
+/// timeout
+template <typename FnT>
+bool wait_for(FnT const &is_done, int timeout_ms)
+{
+    if (is_done())
+        return true;
+
+    QEventLoop loop;
+    QTimer check, timeout;
+    // latency is measured in the setter, so polling period does not
+    // affect it
+    QObject::connect(&check, &QTimer::timeout, [&]() {
+            if (is_done())
+                loop.quit();
+        });
+    QObject::connect(&timeout, &QTimer::timeout, &loop, &QEventLoop::quit);
+    check.start(5);
+    timeout.setSingleShot(true);
+    timeout.start(timeout_ms);
+    loop.exec();
+    return is_done();
+}
+
+}
+
+#endif // _STATEFS_PROVIDERS_TESTS_MOCK_SERVICES_HPP_
@@ -0,0 +1,422 @@
+#include "host.hpp"
+#include "mock-services.hpp"
+
+#include <statefs/qt/record.hpp>
+
+#include <QCoreApplication>
+#include <QDBusConnection>
+#include <QDBusMessage>
+#include <QDBusVirtualObject>
+#include <QEventLoop>
+#include <QHash>
+#include <QStringList>
+#include <QTimer>
+
+#include <cstdio>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+using statefs::host::ProviderHost;
+using statefs::host::cpu_ns;
+using statefs::host::monotonic_ns;
+using mock::start_bus;
+using mock::stop_process;
+using mock::wait_for;
+
+namespace trace = statefs::qt::trace;
+
+/*
+ * Replays trace recorded with STATEFS_PROVIDER_RECORD into the
+ * provider loaded by ProviderHost, so provider code can be profiled
+ * (perf, valgrind) on the same input again and again.
+ *
+ * D-Bus traces are served by the fake service on the private bus:
+ * recorded replies are returned to method calls in the recorded
+ * order and signals are emitted at the recorded time. Other traces
+ * (udev, bme, evdev) are replayed by providers themselves, they are
+ * passed through STATEFS_PROVIDER_REPLAY.
+ */
+
+namespace {
+
+static char const *properties_interface = "org.freedesktop.DBus.Properties";
+
+struct Options
+{
+    Options() : speed(1), idle_ms(1000), is_verbose(false) {}
+
+    double speed;
+    int idle_ms;
+    bool is_verbose;
+    std::string lib;
+    std::string trace;
+};
+
+struct Reply
+{
+    bool is_error;
+    QString error_name;
+    QString error_message;
+    QVariantList args;
+};
+
+struct Signal
+{
+    uint64_t ns;
+    QString path;
+    QString interface;
+    QString member;
+    QVariantList args;
+    // replies recorded before the signal, signal is not sent until
+    // provider requests them
+    size_t replies_before;
+};
+
+struct Trace
+{
+    Trace() : replies_count(0), duration_ns(0), has_dbus(false) {}
+
+    bool load(std::string const &path);
+
+    QStringList services;
+    // method key -> replies in the recorded order
+    QHash<QString, std::deque<Reply> > replies;
+    size_t replies_count;
+    std::vector<Signal> recorded_signals;
+    uint64_t duration_ns;
+    bool has_dbus;
+};
+
+QString qstring(std::string const &s)
+{
+    return QString::fromUtf8(s.data(), s.size());
+}
+
+bool Trace::load(std::string const &path)
+{
+    trace::Reader reader(path);
+    if (!reader.is_valid()) {
+        std::cerr << path << " is not a trace" << std::endl;
+        return false;
+    }
+
+    trace::Record rec;
+    while (reader.next(rec)) {
+        duration_ns = rec.ns;
+        trace::Decoder d(rec.data);
+        std::string s1, s2, s3, s4;
+        switch (rec.kind) {
+        case trace::Kind::DBusService:
+            if (!d.get(s1))
+                return false;
+            if (!services.contains(qstring(s1)))
+                services.push_back(qstring(s1));
+            break;
+        case trace::Kind::DBusSignal: {
+            Signal sig;
+            // service is not needed: all services are owned by the
+            // same connection
+            if (!(d.get(s1) && d.get(s2) && d.get(s3) && d.get(s4)
+                  && trace::decode(d, sig.args)))
+                return false;
+            sig.ns = rec.ns;
+            sig.path = qstring(s2);
+            sig.interface = qstring(s3);
+            sig.member = qstring(s4);
+            sig.replies_before = replies_count;
+            recorded_signals.push_back(sig);
+            break;
+        }
+        case trace::Kind::DBusReply: {
+            Reply reply{false, QString(), QString(), QVariantList()};
+            if (!(d.get(s1) && trace::decode(d, reply.args)))
+                return false;
+            replies[qstring(s1)].push_back(reply);
+            ++replies_count;
+            break;
+        }
+        case trace::Kind::DBusError: {
+            if (!(d.get(s1) && d.get(s2) && d.get(s3)))
+                return false;
+            Reply reply{true, qstring(s2), qstring(s3), QVariantList()};
+            replies[qstring(s1)].push_back(reply);
+            ++replies_count;
+            break;
+        }
+        default:
+            continue;
+        }
+        has_dbus = true;
+    }
+    return true;
+}
+
+/**
+ * Fake upstream: owns all recorded service names and answers method
+ * calls on any path with recorded replies. Replies are matched by
+ * the method name only, the last reply to the method is repeated
+ * when recorded ones are exhausted.
+ */
+class Upstream : public QDBusVirtualObject
+{
+public:
+    Upstream(QString const &address, Trace &trace)
+        : conn_(QDBusConnection::connectToBus(address, "replay-upstream"))
+        , trace_(trace), served_(0), unmatched_(0)
+    {}
+
+    ~Upstream()
+    {
+        for (auto const &name : trace_.services)
+            conn_.unregisterService(name);
+        conn_.unregisterObject("/");
+        QDBusConnection::disconnectFromBus("replay-upstream");
+    }
+
+    bool start()
+    {
+        if (!conn_.isConnected()
+            || !conn_.registerVirtualObject
+            ("/", this, QDBusConnection::SubPath))
+            return false;
+        for (auto const &name : trace_.services) {
+            if (!conn_.registerService(name)) {
+                std::cerr << "Can't register " << name.toStdString()
+                          << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool send(Signal const &sig)
+    {
+        auto msg = QDBusMessage::createSignal
+            (sig.path, sig.interface, sig.member);
+        msg.setArguments(sig.args);
+        return conn_.send(msg);
+    }
+
+    size_t served() const { return served_; }
+    size_t unmatched() const { return unmatched_; }
+
+    virtual QString introspect(QString const &) const { return QString(); }
+    virtual bool handleMessage(QDBusMessage const &, QDBusConnection const &);
+
+private:
+    QDBusConnection conn_;
+    Trace &trace_;
+    size_t served_;
+    size_t unmatched_;
+};
+
+// the same key is used by providers to name methods (see dbus.hpp)
+QString method_key(QDBusMessage const &msg)
+{
+    if (msg.interface() == properties_interface)
+        return msg.arguments().value(0).toString() + "." + msg.member();
+    return msg.interface() + "." + msg.member();
+}
+
+bool Upstream::handleMessage(QDBusMessage const &msg
+                             , QDBusConnection const &conn)
+{
+    if (msg.type() != QDBusMessage::MethodCallMessage)
+        return false;
+
+    auto key = method_key(msg);
+    auto p = trace_.replies.find(key);
+    if (p == trace_.replies.end() || p.value().empty()) {
+        ++unmatched_;
+        return conn.send(msg.createErrorReply(QDBusError::UnknownMethod, key));
+    }
+    auto &queue = p.value();
+    auto reply = queue.front();
+    if (queue.size() > 1)
+        queue.pop_front();
+    ++served_;
+    return conn.send(reply.is_error
+                     ? msg.createErrorReply(reply.error_name
+                                            , reply.error_message)
+                     : msg.createReply(reply.args));
+}
+
+void process_events(int ms)
+{
+    QEventLoop loop;
+    QTimer::singleShot(ms, &loop, SLOT(quit()));
+    loop.exec();
+}
+
+void convert_path_properties()
+{
+    // connman and ofono are reading these structures
+    trace::set_converter("(oa{sv})", [](QVariant const &v) {
+            auto fields = v.toList();
+            return QVariant::fromValue
+                (std::make_tuple(qvariant_cast<QDBusObjectPath>(fields.value(0))
+                                 , fields.value(1).toMap()));
+        });
+    trace::set_converter("a(oa{sv})", [](QVariant const &v) {
+            PathPropertiesArray res;
+            for (auto const &item : v.toList())
+                res.append(qvariant_cast<PathProperties>(item));
+            return QVariant::fromValue(res);
+        });
+}
+
+struct Stats
+{
+    Stats() : sent(0), diverged(0) {}
+    size_t sent;
+    size_t diverged;
+};
+
+void replay_dbus(Options const &opts, Trace const &trace, Upstream &upstream
+                 , Stats &stats)
+{
+    trace::Pacer pacer(opts.speed);
+    for (auto const &sig : trace.recorded_signals) {
+        for (auto ms = pacer.delay_ms(sig.ns); ms; ms = pacer.delay_ms(sig.ns))
+            process_events(ms);
+        auto is_in_sync = [&upstream, &sig]() {
+            return upstream.served() >= sig.replies_before;
+        };
+        if (!wait_for(is_in_sync, 1000))
+            ++stats.diverged;
+        if (upstream.send(sig))
+            ++stats.sent;
+    }
+}
+
+void report(Options const &opts, ProviderHost const &host
+            , Trace const &trace, Upstream const *upstream
+            , Stats const &stats, uint64_t wall_ns, uint64_t cpu)
+{
+    ::printf("%s: trace %.3f s, replayed in %.3f s, cpu %.1f us\n"
+             , opts.trace.c_str(), trace.duration_ns / 1e9, wall_ns / 1e9
+             , cpu / 1000.0);
+    if (upstream)
+        ::printf("signals %zu/%zu, diverged %zu, replies %zu, unmatched %zu\n"
+                 , stats.sent, trace.recorded_signals.size(), stats.diverged
+                 , upstream->served(), upstream->unmatched());
+    for (size_t i = 0; i < host.size(); ++i) {
+        auto changes = host.changes(i);
+        if (changes || opts.is_verbose)
+            ::printf("%-48s %8llu '%s'\n", host.property(i).path.c_str()
+                     , static_cast<unsigned long long>(changes)
+                     , host.read(i).c_str());
+    }
+    ::fflush(stdout);
+}
+
+bool parse_options(int argc, char *argv[], Options &opts)
+{
+    int c;
+    while ((c = ::getopt(argc, argv, "s:i:v")) != -1) {
+        switch (c) {
+        case 's':
+            opts.speed = ::atof(optarg);
+            break;
+        case 'i':
+            opts.idle_ms = ::atoi(optarg);
+            break;
+        case 'v':
+            opts.is_verbose = true;
+            break;
+        default:
+            return false;
+        }
+    }
+    if (argc - optind != 2 || opts.speed < 0 || opts.idle_ms < 0)
+        return false;
+    opts.lib = argv[optind];
+    opts.trace = argv[optind + 1];
+    return true;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    Options opts;
+    if (!parse_options(argc, argv, opts)) {
+        std::cerr << "Usage: " << argv[0]
+                  << " [-s speed] [-i idle_ms] [-v] provider.so trace\n"
+                  << "speed 0 replays as fast as possible" << std::endl;
+        return 1;
+    }
+
+    Trace trace;
+    if (!trace.load(opts.trace))
+        return 1;
+
+    // replay should not overwrite traces
+    ::unsetenv("STATEFS_PROVIDER_RECORD");
+    pid_t bus_pid = -1;
+    std::string address;
+    if (trace.has_dbus) {
+        bus_pid = start_bus(address);
+        if (bus_pid < 0) {
+            std::cerr << "Can't start dbus-daemon" << std::endl;
+            return 1;
+        }
+        ::setenv("DBUS_SYSTEM_BUS_ADDRESS", address.c_str(), 1);
+        ::setenv("DBUS_SESSION_BUS_ADDRESS", address.c_str(), 1);
+    } else {
+        ::setenv("STATEFS_PROVIDER_REPLAY", opts.trace.c_str(), 1);
+        ::setenv("STATEFS_PROVIDER_REPLAY_SPEED"
+                 , std::to_string(opts.speed).c_str(), 1);
+    }
+
+    if (!opts.is_verbose)
+        qInstallMessageHandler(mock::quiet_debug);
+
+    int rc = 0;
+    {
+        QCoreApplication app(argc, argv);
+        std::unique_ptr<Upstream> upstream;
+        if (trace.has_dbus) {
+            mock::registerDataTypes();
+            convert_path_properties();
+            upstream.reset(new Upstream(QString::fromStdString(address)
+                                        , trace));
+            if (!upstream->start()) {
+                std::cerr << "Can't start upstream services" << std::endl;
+                stop_process(bus_pid);
+                return 1;
+            }
+        }
+
+        auto begin = monotonic_ns();
+        auto cpu_before = cpu_ns();
+        try {
+            ProviderHost host(opts.lib);
+            host.connect_all();
+
+            Stats stats;
+            if (upstream) {
+                replay_dbus(opts, trace, *upstream, stats);
+            } else if (opts.speed > 0) {
+                process_events(static_cast<int>
+                               (trace.duration_ns / opts.speed / 1000000));
+            }
+            // let provider to process the tail of the trace
+            process_events(opts.idle_ms);
+            report(opts, host, trace, upstream.get(), stats
+                   , monotonic_ns() - begin, cpu_ns() - cpu_before);
+        } catch (std::exception const &e) {
+            std::cerr << e.what() << std::endl;
+            rc = 1;
+        }
+    }
+    if (bus_pid >= 0)
+        stop_process(bus_pid);
+    return rc;
+}